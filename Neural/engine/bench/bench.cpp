@@ -0,0 +1,799 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../renderer/main.h"
+#include "../renderer/camera.h"
+#include "../renderer/model.h"
+#include "../renderer/gl_ext.h"
+#include "../renderer/gpu_culling.h"
+#include "../renderer/software_occlusion.h"
+#include "../renderer/transform_batch.h"
+#include "../renderer/job_system.h"
+#include "../renderer/frustum_culler.h"
+#include "../renderer/cpu_features.h"
+#include "../renderer/obj_loader.h"
+#include "../renderer/node_hierarchy.h"
+#include "../renderer/animation.h"
+#include "../renderer/baked_animation.h"
+#include "../renderer/map.h"
+#include "../renderer/command_line.h"
+#include "stopwatch.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cmath>
+#include <string>
+
+GLFWwindow *CreateHiddenContext();
+int ValidateCulling();
+int BenchmarkOcclusion();
+int BenchmarkTransforms();
+int BenchmarkJobs();
+float SyntheticObjectWork(unsigned int object);
+int BenchmarkFrustumCulling();
+int BenchmarkImport(const char *path);
+int BenchmarkAnimation(const char *path);
+void BenchmarkBakedAnimation(const NodeHierarchy &hierarchy, const ModelAnimation &animation);
+void BuildSyntheticRig(NodeHierarchy &hierarchy, Skeleton &skeleton, RawClip &clip);
+void SampleRawClip(const RawClip &clip, float time, glm::mat4 *locals);
+
+// what the context supports, filled in by LoadGLExtensions
+GLExtensions GLExt;
+
+// the map, declared in map.h
+EntityStore scene;
+GeometryRange meshRanges[MESH_TYPES];
+AABB meshBounds[MESH_TYPES];
+Model *nanoSuitModel = NULL;
+
+// The engine's checks and timings, kept out of the renderer. Each flag runs one and exits with 0 when
+// everything it checks passes; run from the Neural directory so resources/ is found.
+int main(int argc, char **argv)
+{
+	// --no-avx2 keeps the SIMD kernels on their SSE2 paths even where the CPU has AVX2
+	if (HasArgument(argc, argv, "--no-avx2"))
+		UseAVX2() = false;
+	// --validate-culling runs the GPU culling check in a hidden window
+	if (HasArgument(argc, argv, "--validate-culling"))
+	{
+		if (CreateHiddenContext() == NULL)
+			return 1;
+		int result = ValidateCulling();
+		glfwTerminate();
+		return result;
+	}
+	// --benchmark-occlusion times the software occlusion rasteriser on its own, it never opens a window
+	if (HasArgument(argc, argv, "--benchmark-occlusion"))
+	{
+		ReadMap();
+		return BenchmarkOcclusion();
+	}
+	// --benchmark-transforms times and checks the SIMD transform kernel against glm
+	if (HasArgument(argc, argv, "--benchmark-transforms"))
+		return BenchmarkTransforms();
+	// --benchmark-jobs checks the job system's dependencies and times parallel_for scaling
+	if (HasArgument(argc, argv, "--benchmark-jobs"))
+		return BenchmarkJobs();
+	// --benchmark-frustum times the SIMD frustum culler over a map of more than 100k cells
+	if (HasArgument(argc, argv, "--benchmark-frustum"))
+		return BenchmarkFrustumCulling();
+	// --benchmark-import [file] times ObjLoader against Assimp on the nanosuit or the given OBJ and compares
+	// the triangles they produce
+	if (HasArgument(argc, argv, "--benchmark-import"))
+	{
+		const char *path = ArgumentValue(argc, argv, "--benchmark-import");
+		return BenchmarkImport(path != NULL && path[0] != '-' ? path : "resources/model/nanosuit/nanosuit.obj");
+	}
+	// --benchmark-animation [file] checks clip compression and the SIMD pose sampler on a synthetic rig and
+	// times posing hundreds of instances of it, or of the given animated model
+	if (HasArgument(argc, argv, "--benchmark-animation"))
+	{
+		const char *path = ArgumentValue(argc, argv, "--benchmark-animation");
+		return BenchmarkAnimation(path != NULL && path[0] != '-' ? path : NULL);
+	}
+
+	std::cout << "usage: Bench [--no-avx2] --validate-culling | --benchmark-occlusion | --benchmark-transforms | --benchmark-jobs"
+		<< " | --benchmark-frustum | --benchmark-import [file] | --benchmark-animation [file]" << std::endl;
+	return 1;
+}
+
+// a hidden window with a 4.3 context, or 3.3 where that's all there is, made current with GL and its
+// extensions loaded; NULL when even that fails
+GLFWwindow *CreateHiddenContext()
+{
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Bench", NULL, NULL);
+	if (window == NULL)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Bench", NULL, NULL);
+	}
+	if (window == NULL)
+	{
+		std::cout << "Failed to create GLFW window" << std::endl;
+		glfwTerminate();
+		return NULL;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		glfwTerminate();
+		return NULL;
+	}
+	LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
+	return window;
+}
+
+// loads the map as the renderer does and checks the GPU culling pass over its static draws against
+// Frustum::Intersects from a grid of viewpoints across it, looking in eight directions from each, in
+// every culling mode the context supports
+int ValidateCulling()
+{
+	ImportedModel imported;
+	if (!Model::Import("resources/model/nanosuit/nanosuit.obj", imported))
+		return 1;
+	Model suit(std::move(imported), false, MODEL_RELEASE_CPU_DATA);
+	LoadMapMeshes(suit);
+	ReadMap();
+	IndirectDrawList draws;
+	if (GLExt.multiDrawIndirect)
+		BuildStaticDraws(draws, suit);
+	GpuCuller culler;
+	if (!culler.Build(draws, GLExt.multiDrawIndirect))
+	{
+		std::cout << "ERROR::CULLING::compute culling is not supported by this context" << std::endl;
+		return 1;
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	unsigned int failures = 0;
+	for (int mode = 0; mode < 2; mode++)
+	{
+		culler.SetCompaction(mode == 0);
+		if (mode == 1 && !GLExt.indirectCount)
+			break;
+
+		unsigned int views = 0;
+		unsigned int mismatches = 0;
+		for (int x = 0; x < 48; x += 4)
+		{
+			for (int z = 0; z < 50; z += 4)
+			{
+				for (int yaw = 0; yaw < 360; yaw += 45)
+				{
+					Camera viewpoint(glm::vec3(x, 0.0f, z), glm::vec3(0.0f, 1.0f, 0.0f), (float)yaw, 0.0f);
+					mismatches += culler.Validate(projection * viewpoint.GetViewMatrix());
+					views++;
+				}
+			}
+		}
+		std::cout << "CULLING::" << (culler.Compacting() ? "compacted" : "in place") << ": " << views << " views, " << mismatches << " mismatches" << std::endl;
+		failures += mismatches;
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+// runs the software occlusion rasteriser over the same grid of views as ValidateCulling with one thread
+// and then twice as many up to every hardware thread, then checks its depth against RenderReference.
+// A unit box around every floor, door, lamp and nanosuit cell stands in for the draws being tested.
+int BenchmarkOcclusion()
+{
+	std::vector<AABB> occluders = BuildWallOccluders();
+	std::vector<AABB> boxes;
+	std::vector<EntityChunk*> chunks = scene.Query(HAS_COLLIDER);
+	unsigned int wallCells = 0;
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		for (unsigned int i = 0; i < chunks[c]->count; i++)
+		{
+			if (chunks[c]->colliders[i].occluder)
+				wallCells++;
+			else
+				boxes.push_back(chunks[c]->colliders[i].bounds);
+		}
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	std::vector<glm::mat4> views;
+	for (int x = 0; x < 48; x += 4)
+	{
+		for (int z = 0; z < 50; z += 4)
+		{
+			for (int yaw = 0; yaw < 360; yaw += 45)
+			{
+				Camera viewpoint(glm::vec3(x, 0.0f, z), glm::vec3(0.0f, 1.0f, 0.0f), (float)yaw, 0.0f);
+				views.push_back(projection * viewpoint.GetViewMatrix());
+			}
+		}
+	}
+
+	SoftwareOcclusion occlusion(256, 192, 1);
+	occlusion.SetOccluders(occluders);
+	std::cout << "OCCLUSION::" << wallCells << " wall cells merged into " << occluders.size() << " occluders, "
+		<< boxes.size() << " boxes tested from " << views.size() << " views at " << occlusion.Width() << "x" << occlusion.Height()
+		<< ", " << SoftwareOcclusion::Lanes() << " pixels per SIMD step" << std::endl;
+
+	unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	float singleThreadMs = 0.0f;
+	std::vector<float> tileUs(occlusion.TilesX() * occlusion.TilesY(), 0.0f);
+	for (unsigned int threads = 1; ; threads = std::min(threads * 2, hardwareThreads))
+	{
+		occlusion.SetThreads(threads);
+		occlusion.Render(views[0]);
+		occlusion.ResetStats();
+		float setupMs = 0.0f, rasterMs = 0.0f;
+		for (unsigned int v = 0; v < views.size(); v++)
+		{
+			occlusion.Render(views[v]);
+			setupMs += occlusion.Stats().setupMs;
+			rasterMs += occlusion.Stats().rasterMs;
+			for (unsigned int b = 0; b < boxes.size(); b++)
+				occlusion.Visible(boxes[b]);
+			if (threads == 1)
+			{
+				for (unsigned int t = 0; t < tileUs.size(); t++)
+					tileUs[t] += occlusion.TileTimes()[t];
+			}
+		}
+		float frameMs = (setupMs + rasterMs) / views.size();
+		if (threads == 1)
+			singleThreadMs = frameMs;
+		std::cout << "OCCLUSION::" << threads << " threads: " << frameMs << "ms per view (setup " << setupMs / views.size()
+			<< "ms, raster " << rasterMs / views.size() << "ms), " << singleThreadMs / frameMs << "x, "
+			<< 100.0f * occlusion.Stats().outside / occlusion.Stats().tested << "% of boxes outside the view, "
+			<< 100.0f * occlusion.Stats().occluded / occlusion.Stats().tested << "% occluded" << std::endl;
+		if (threads == hardwareThreads)
+			break;
+	}
+
+	// average microseconds per tile on one thread, laid out like the screen with the top row first
+	std::cout << "OCCLUSION::tile times (us):" << std::endl;
+	for (int y = occlusion.TilesY() - 1; y >= 0; y--)
+	{
+		std::stringstream row;
+		for (int x = 0; x < occlusion.TilesX(); x++)
+			row << " " << (int)(tileUs[y * occlusion.TilesX() + x] / views.size() + 0.5f);
+		std::cout << row.str() << std::endl;
+	}
+
+	std::vector<float> reference;
+	unsigned int mismatches = 0;
+	float largestError = 0.0f;
+	for (unsigned int v = 0; v < views.size(); v++)
+	{
+		occlusion.Render(views[v]);
+		std::vector<float> depth = occlusion.Depth();
+		occlusion.RenderReference(views[v], reference);
+		for (unsigned int p = 0; p < depth.size(); p++)
+		{
+			// coverage has to agree exactly, depth within rounding
+			float error = std::abs(depth[p] - reference[p]);
+			if ((depth[p] == 1.0f) != (reference[p] == 1.0f) || error > 1e-5f)
+				mismatches++;
+			largestError = std::max(largestError, error);
+		}
+	}
+	std::cout << "OCCLUSION::against the reference: " << mismatches << " of " << reference.size() * views.size()
+		<< " pixels differ, largest depth error " << largestError << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// builds the world matrices of ten thousand or so moving objects with TransformBatch and with glm one at a
+// time, both straight into per-draw data the way a mapped buffer is filled, and compares the results.
+// The odd count leaves a tail for the scalar kernel, and the yaws include the quadrant boundaries.
+int BenchmarkTransforms()
+{
+	const unsigned int objects = 10007;
+	const int iterations = 200;
+	TransformBatch batch;
+	unsigned int seed = 1;
+	for (unsigned int i = 0; i < objects; i++)
+	{
+		float random[7];
+		for (int j = 0; j < 7; j++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			random[j] = (seed >> 8) / 16777216.0f;
+		}
+		Transform transform;
+		transform.SetPosition(glm::vec3(random[0], random[1], random[2]) * 100.0f - glm::vec3(50.0f));
+		transform.SetRotation(i < 16 ? ((int)i - 8) * 90.0f : random[3] * 1440.0f - 720.0f);
+		transform.SetScale(glm::vec3(random[4], random[5], random[6]) * 2.0f + glm::vec3(0.05f));
+		batch.Add(transform);
+	}
+
+	std::vector<DrawData> reference(objects), batched(objects);
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; i++)
+		batch.ComputeReference(&reference[0].model, sizeof(DrawData));
+	float referenceNs = stopwatch.Lap() * 1e6f / (iterations * objects);
+	for (int i = 0; i < iterations; i++)
+		batch.Compute(&batched[0].model, sizeof(DrawData));
+	float batchNs = stopwatch.Lap() * 1e6f / (iterations * objects);
+
+	// error relative to the size of the element, positions reach 50
+	float largestError = 0.0f;
+	for (unsigned int i = 0; i < objects; i++)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				float expected = reference[i].model[column][row];
+				float error = std::abs(batched[i].model[column][row] - expected) / std::max(1.0f, std::abs(expected));
+				largestError = std::max(largestError, error);
+			}
+		}
+	}
+
+	bool passed = largestError <= 1e-5f;
+	std::cout << "TRANSFORMS::" << objects << " objects, " << TransformBatch::Lanes() << " per SIMD step: glm " << referenceNs
+		<< "ns per object, batch " << batchNs << "ns per object, " << referenceNs / batchNs << "x" << std::endl;
+	std::cout << "TRANSFORMS::against glm: largest error " << largestError << (passed ? ", passed" : ", FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// stands in for a per object update: a few hundred dependent float operations, the same result
+// whichever thread runs it
+float SyntheticObjectWork(unsigned int object)
+{
+	float x = (object % 1000) * 0.001f, v = 0.0f;
+	for (int step = 0; step < 256; step++)
+	{
+		v += (0.5f - x) * 0.01f - v * 0.001f;
+		x += v;
+	}
+	return x;
+}
+
+// runs the synthetic object work over the same objects on one thread and then on job systems of twice
+// as many threads up to every hardware thread, and checks a chain of dependent jobs and nested waits
+int BenchmarkJobs()
+{
+	const unsigned int objects = 65536;
+	const int iterations = 10;
+	std::vector<float> reference(objects), results(objects);
+	// the serial loop calls the same body the jobs do, so only the scheduling differs
+	std::vector<float> *output = &reference;
+	std::function<void(unsigned int, unsigned int)> body = [&output](unsigned int begin, unsigned int end) {
+		for (unsigned int j = begin; j < end; j++)
+			(*output)[j] = SyntheticObjectWork(j);
+	};
+
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; i++)
+		body(0, objects);
+	float serialMs = stopwatch.Ms() / iterations;
+	std::cout << "JOBS::" << objects << " objects, serial loop " << serialMs << "ms" << std::endl;
+
+	bool passed = true;
+	unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (unsigned int threads = 1; ; threads = std::min(threads * 2, hardwareThreads))
+	{
+		JobSystem jobs(threads);
+		std::fill(results.begin(), results.end(), 0.0f);
+		output = &results;
+		stopwatch.Restart();
+		for (int i = 0; i < iterations; i++)
+			jobs.ParallelFor(objects, 1024, body);
+		float jobMs = stopwatch.Ms() / iterations;
+		bool matches = results == reference;
+		passed = passed && matches;
+		JobSystemStats stats = jobs.Stats();
+		std::cout << "JOBS::" << threads << " threads: " << jobMs << "ms, " << serialMs / jobMs << "x ("
+			<< 100.0f * serialMs / jobMs / threads << "% of linear), " << stats.stolen << " of " << stats.jobs << " jobs stolen"
+			<< (matches ? "" : ", results DIFFER") << std::endl;
+
+		// three stages, each only released once the one before has finished: the second reads what other
+		// jobs of the first wrote, the third counts it with jobs that wait on jobs of their own
+		std::vector<unsigned int> filled(objects, 0), checked(objects, 0);
+		JobCounter first, second, third;
+		for (unsigned int begin = 0; begin < objects; begin += 4096)
+		{
+			jobs.Run([&filled, begin]() {
+				for (unsigned int j = begin; j < begin + 4096; j++)
+					filled[j] = 1;
+			}, &first);
+		}
+		for (unsigned int begin = 0; begin < objects; begin += 4096)
+		{
+			jobs.Run([&filled, &checked, begin]() {
+				for (unsigned int j = begin; j < begin + 4096; j++)
+					checked[j] = filled[(j + 4096) % objects];
+			}, &second, &first);
+		}
+		std::atomic<unsigned int> counted(0);
+		for (unsigned int begin = 0; begin < objects; begin += 16384)
+		{
+			jobs.Run([&jobs, &checked, &counted, begin]() {
+				jobs.ParallelFor(16384, 512, [&](unsigned int from, unsigned int to) {
+					unsigned int count = 0;
+					for (unsigned int j = begin + from; j < begin + to; j++)
+						count += checked[j];
+					counted += count;
+				});
+			}, &third, &second);
+		}
+		jobs.Wait(third);
+		bool ordered = counted.load() == objects;
+		passed = passed && ordered;
+		std::cout << "JOBS::" << threads << " threads: dependent stages " << (ordered ? "ran in order" : "ran OUT OF ORDER") << std::endl;
+
+		if (threads == hardwareThreads)
+			break;
+	}
+	std::cout << "JOBS::" << (passed ? "passed" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// culls a square map of single cells, more than 100k of them with the odd one raised, from a spread of
+// views inside it: with the scalar Frustum::Intersects loop, with the SIMD kernel on one thread and
+// with the kernel split over the job system. Every view has to come out the same all three ways.
+int BenchmarkFrustumCulling()
+{
+	const int mapSize = 384;
+	FrustumCuller culler;
+	unsigned int seed = 1;
+	for (int z = 0; z < mapSize; z++)
+	{
+		for (int x = 0; x < mapSize; x++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			AABB cell;
+			cell.min = glm::vec3(x - 0.5f, -0.5f, z - 0.5f);
+			cell.max = glm::vec3(x + 0.5f, (seed >> 28) == 0 ? 2.5f : 0.5f, z + 0.5f);
+			culler.Add(cell);
+		}
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	std::vector<Frustum> frustums;
+	for (int x = 16; x < mapSize; x += 64)
+	{
+		for (int z = 16; z < mapSize; z += 64)
+		{
+			for (int yaw = 0; yaw < 360; yaw += 30)
+			{
+				Camera viewpoint(glm::vec3(x, 0.5f, z), glm::vec3(0.0f, 1.0f, 0.0f), (float)yaw, (float)(yaw % 90) / 3.0f - 15.0f);
+				frustums.push_back(Frustum(projection * viewpoint.GetViewMatrix()));
+			}
+		}
+	}
+
+	std::vector<std::vector<unsigned int> > reference(frustums.size());
+	std::vector<unsigned int> visible;
+	unsigned int visibleTotal = 0, mismatches = 0;
+	Stopwatch stopwatch;
+	for (unsigned int i = 0; i < frustums.size(); i++)
+		culler.CullReference(frustums[i], reference[i]);
+	float referenceMs = stopwatch.Ms() / frustums.size();
+
+	float kernelMs[2];
+	for (int threaded = 0; threaded < 2; threaded++)
+	{
+		JobSystem *jobs = threaded ? &Jobs() : NULL;
+		float total = 0.0f;
+		for (unsigned int i = 0; i < frustums.size(); i++)
+		{
+			stopwatch.Restart();
+			culler.Cull(frustums[i], visible, jobs);
+			total += stopwatch.Ms();
+			mismatches += visible != reference[i];
+			visibleTotal += visible.size();
+		}
+		kernelMs[threaded] = total / frustums.size();
+	}
+
+	bool passed = mismatches == 0;
+	std::cout << "FRUSTUM::" << culler.Size() << " cells from " << frustums.size() << " views, " << FrustumCuller::Lanes() << " boxes per SIMD step, "
+		<< 50.0f * visibleTotal / (frustums.size() * culler.Size()) << "% visible" << std::endl;
+	std::cout << "FRUSTUM::per view: scalar " << referenceMs << "ms, SIMD " << kernelMs[0] << "ms (" << referenceMs / kernelMs[0] << "x), SIMD on "
+		<< Jobs().Threads() << " threads " << kernelMs[1] << "ms (" << referenceMs / kernelMs[1] << "x)" << std::endl;
+	std::cout << "FRUSTUM::against Frustum::Intersects: " << mismatches << " views differ" << (passed ? ", passed" : ", FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// imports the file with ObjLoader and with Assimp, on one thread and on the job system, a few times each,
+// and checks every triangle corner of the two importers' meshes has the same position, normal and texture
+// coordinates. ObjLoader shares vertices between corners where Assimp, without JoinIdenticalVertices,
+// gives every corner its own, so only what is drawn is compared and not the vertex arrays
+int BenchmarkImport(const char *path)
+{
+	const int runs = 3;
+	std::vector<ImportedMesh> obj, assimp;
+	float objMs[2] = { 0.0f, 0.0f }, assimpMs[2] = { 0.0f, 0.0f };
+	for (int run = 0; run < runs; run++)
+	{
+		for (int threaded = 0; threaded < 2; threaded++)
+		{
+			Stopwatch stopwatch;
+			if (!ObjLoader().Load(path, obj, threaded ? &Jobs() : NULL))
+				return 1;
+			objMs[threaded] += stopwatch.Lap() / runs;
+			if (!Model::ImportAssimp(path, assimp, threaded ? &Jobs() : NULL))
+				return 1;
+			assimpMs[threaded] += stopwatch.Lap() / runs;
+		}
+	}
+
+	unsigned int objVertices = 0, assimpVertices = 0, triangles = 0, mismatches = 0;
+	for (unsigned int i = 0; i < obj.size(); i++)
+		objVertices += obj[i].vertices.size();
+	for (unsigned int i = 0; i < assimp.size(); i++)
+	{
+		assimpVertices += assimp[i].vertices.size();
+		triangles += assimp[i].indices.size() / 3;
+	}
+	bool sameShape = obj.size() == assimp.size();
+	for (unsigned int i = 0; i < obj.size() && sameShape; i++)
+	{
+		if (obj[i].indices.size() != assimp[i].indices.size() || obj[i].textures.size() != assimp[i].textures.size())
+		{
+			sameShape = false;
+			break;
+		}
+		for (unsigned int j = 0; j < obj[i].indices.size(); j++)
+		{
+			const Vertex &a = obj[i].vertices[obj[i].indices[j]];
+			const Vertex &b = assimp[i].vertices[assimp[i].indices[j]];
+			float difference = glm::length(a.Position - b.Position) + glm::length(a.Normal - b.Normal) + glm::length(a.TexCoords - b.TexCoords);
+			mismatches += difference > 1e-5f;
+		}
+		for (unsigned int j = 0; j < obj[i].textures.size(); j++)
+			mismatches += obj[i].textures[j].type != assimp[i].textures[j].type || obj[i].textures[j].path != assimp[i].textures[j].path;
+	}
+
+	bool passed = sameShape && mismatches == 0;
+	std::cout << "IMPORT::" << path << ": " << assimp.size() << " meshes, " << triangles << " triangles, " << objVertices << " vertices from ObjLoader, "
+		<< assimpVertices << " from Assimp" << std::endl;
+	std::cout << "IMPORT::Assimp " << assimpMs[0] << "ms, on " << Jobs().Threads() << " threads " << assimpMs[1] << "ms ("
+		<< assimpMs[0] / assimpMs[1] << "x)" << std::endl;
+	std::cout << "IMPORT::ObjLoader " << objMs[0] << "ms (" << assimpMs[0] / objMs[0] << "x Assimp), on " << Jobs().Threads() << " threads "
+		<< objMs[1] << "ms (" << assimpMs[0] / objMs[1] << "x)" << std::endl;
+	if (!sameShape)
+		std::cout << "IMPORT::the importers split the file into different meshes, FAILED" << std::endl;
+	else
+		std::cout << "IMPORT::against Assimp: " << mismatches << " corners or textures differ" << (passed ? ", passed" : ", FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// A stand in for an animated character when no animated model is given: a spine of 8 bones with two arms
+// of 3 bones off each, every bone a node and every node but the root a bone. All but every fourth bone
+// swing on a sine of their own, keyed 30 times a second for 4 seconds; positions and scales never change.
+void BuildSyntheticRig(NodeHierarchy &hierarchy, Skeleton &skeleton, RawClip &clip)
+{
+	const unsigned int spine = 8, arm = 3;
+	hierarchy.Clear();
+	skeleton = Skeleton();
+	hierarchy.AddNode(-1, "root", glm::mat4(1.0f));
+	int parent = 0;
+	for (unsigned int s = 0; s < spine; s++)
+	{
+		parent = hierarchy.AddNode(parent, "spine" + std::to_string(s), glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, s == 0 ? 0.0f : 1.0f, 0.0f)));
+		for (int side = -1; side <= 1; side += 2)
+		{
+			int bone = parent;
+			for (unsigned int a = 0; a < arm; a++)
+				bone = hierarchy.AddNode(bone, "arm" + std::to_string(s) + (side < 0 ? "l" : "r") + std::to_string(a),
+					glm::translate(glm::mat4(1.0f), glm::vec3(side * (a == 0 ? 0.5f : 1.0f), 0.0f, 0.0f)));
+		}
+	}
+	NodeTransforms bind(hierarchy);
+	for (unsigned int n = 1; n < hierarchy.Size(); n++)
+		skeleton.Add(hierarchy.nodes[n].name, n, glm::inverse(bind.World(n)));
+
+	const float duration = 4.0f, rate = 30.0f;
+	clip = RawClip();
+	clip.name = "synthetic";
+	clip.duration = duration;
+	for (unsigned int n = 1; n < hierarchy.Size(); n++)
+	{
+		RawChannel channel;
+		channel.node = n;
+		glm::vec3 position = glm::vec3(hierarchy.localTransforms[n][3]);
+		glm::vec3 axis = glm::normalize(glm::vec3(std::sin(n * 1.7f), 1.0f, std::cos(n * 2.3f)));
+		float amplitude = n % 4 == 0 ? 0.0f : 0.4f, frequency = 0.25f * (1 + n % 3), phase = n * 0.37f;
+		for (unsigned int k = 0; k <= (unsigned int)(duration * rate); k++)
+		{
+			float time = k / rate;
+			float angle = amplitude * std::sin(6.2831853f * (frequency * time + phase));
+			channel.positions.push_back({ time, position });
+			channel.rotations.push_back({ time, glm::vec4(axis * std::sin(angle * 0.5f), std::cos(angle * 0.5f)) });
+			channel.scales.push_back({ time, glm::vec3(1.0f) });
+		}
+		clip.channels.push_back(channel);
+	}
+}
+
+// the uncompressed keys interpolated like AnimationClip interpolates its own, what compression is measured against
+void SampleRawClip(const RawClip &clip, float time, glm::mat4 *locals)
+{
+	for (unsigned int c = 0; c < clip.channels.size(); c++)
+	{
+		const RawChannel &channel = clip.channels[c];
+		std::vector<float> times;
+		unsigned int key, next;
+		float t;
+		glm::vec3 position(0.0f), scale(1.0f);
+		glm::vec4 rotation = QuatIdentity();
+		for (unsigned int k = 0; k < channel.positions.size(); k++)
+			times.push_back(channel.positions[k].time);
+		if (!times.empty())
+		{
+			FindKey(times, time, key, next, t);
+			position = glm::mix(channel.positions[key].value, channel.positions[next].value, t);
+		}
+		times.clear();
+		for (unsigned int k = 0; k < channel.rotations.size(); k++)
+			times.push_back(channel.rotations[k].time);
+		if (!times.empty())
+		{
+			FindKey(times, time, key, next, t);
+			rotation = QuatNlerp(channel.rotations[key].value, channel.rotations[next].value, t);
+		}
+		times.clear();
+		for (unsigned int k = 0; k < channel.scales.size(); k++)
+			times.push_back(channel.scales[k].time);
+		if (!times.empty())
+		{
+			FindKey(times, time, key, next, t);
+			scale = glm::mix(channel.scales[key].value, channel.scales[next].value, t);
+		}
+		locals[c] = ComposeTRS(position, rotation, scale);
+	}
+}
+
+// compresses the synthetic rig's clip and measures how far its bones end up from the uncompressed keys,
+// checks the SIMD sampler against the scalar one and the quaternion quantization, then times posing
+// hundreds of instances of the rig, or of the given animated model, with the scalar sampler, the SIMD
+// one and the SIMD one spread over the job system
+int BenchmarkAnimation(const char *path)
+{
+	NodeHierarchy hierarchy;
+	ModelAnimation animation;
+	RawClip raw;
+	BuildSyntheticRig(hierarchy, animation.skeleton, raw);
+	animation.clips.push_back(AnimationClip::Compress(raw));
+	const AnimationClip &clip = animation.clips[0];
+	unsigned int rawKeys = 0;
+	for (unsigned int c = 0; c < raw.channels.size(); c++)
+		rawKeys += raw.channels[c].positions.size() + raw.channels[c].rotations.size() + raw.channels[c].scales.size();
+	std::cout << "ANIMATION::synthetic rig of " << animation.skeleton.Size() << " bones, " << raw.duration << "s: " << rawKeys << " keys in "
+		<< raw.Bytes() / 1024 << "KB reduced to " << clip.Keys() << " keys in " << clip.Bytes() / 1024 << "KB ("
+		<< (float)raw.Bytes() / clip.Bytes() << "x)" << std::endl;
+
+	// bone positions in model space, the error of a rotation grows with the length of the chain below it
+	NodeTransforms expected(hierarchy), compressed(hierarchy);
+	std::vector<glm::mat4> rawLocals(raw.channels.size()), locals(clip.channels.size()), reference(clip.channels.size());
+	float largestError = 0.0f, largestSimdError = 0.0f;
+	for (unsigned int step = 0; step <= 400; step++)
+	{
+		float time = raw.duration * step / 400.0f;
+		SampleRawClip(raw, time, &rawLocals[0]);
+		clip.Sample(time, &locals[0]);
+		clip.SampleReference(time, &reference[0]);
+		for (unsigned int c = 0; c < clip.channels.size(); c++)
+		{
+			expected.SetLocal(raw.channels[c].node, rawLocals[c]);
+			compressed.SetLocal(clip.channels[c].node, locals[c]);
+			for (int column = 0; column < 4; column++)
+			{
+				for (int row = 0; row < 4; row++)
+					largestSimdError = std::max(largestSimdError, std::abs(locals[c][column][row] - reference[c][column][row]));
+			}
+		}
+		expected.Update();
+		compressed.Update();
+		for (unsigned int n = 0; n < hierarchy.Size(); n++)
+			largestError = std::max(largestError, glm::length(glm::vec3(expected.World(n)[3]) - glm::vec3(compressed.World(n)[3])));
+	}
+
+	float largestQuantization = 0.0f;
+	unsigned int seed = 1;
+	for (unsigned int i = 0; i < 100000; i++)
+	{
+		float random[4];
+		for (int j = 0; j < 4; j++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			random[j] = (seed >> 8) / 16777216.0f * 2.0f - 1.0f;
+		}
+		glm::vec4 q = glm::vec4(random[0], random[1], random[2], random[3]);
+		if (glm::dot(q, q) < 1e-4f)
+			continue;
+		q = glm::normalize(q);
+		largestQuantization = std::max(largestQuantization, QuatAngle(q, DequantizeQuat(QuantizeQuat(q))));
+	}
+
+	bool passed = largestSimdError <= 1e-5f && largestQuantization <= 2e-4f;
+	std::cout << "ANIMATION::compressed against the uncompressed keys: bones at most " << largestError << " units away, in a rig 7 units tall" << std::endl;
+	std::cout << "ANIMATION::quantized rotations within " << largestQuantization << " radians, " << ANIMATION_LANES << " channels per SIMD step within "
+		<< largestSimdError << " of the scalar sampler" << (passed ? ", passed" : ", FAILED") << std::endl;
+
+	// an animated model to time instead of the rig, imported without a window
+	ImportedModel imported;
+	const NodeHierarchy *timedHierarchy = &hierarchy;
+	const ModelAnimation *timedAnimation = &animation;
+	if (path != NULL)
+	{
+		if (Model::Import(path, imported, MODEL_IMPORT_ASSIMP) && !imported.animation.clips.empty())
+		{
+			timedHierarchy = &imported.hierarchy;
+			timedAnimation = &imported.animation;
+		}
+		else
+			std::cout << "ANIMATION::" << path << " has no clips, timing the synthetic rig" << std::endl;
+	}
+
+	const unsigned int instances = 512;
+	const int iterations = 20;
+	Animator animator(*timedHierarchy, *timedAnimation);
+	for (unsigned int i = 0; i < instances; i++)
+		animator.Add(i % timedAnimation->clips.size(), i * 0.137f, 0.5f + (i % 7) * 0.1f);
+	float updateMs[3];
+	for (int mode = 0; mode < 3; mode++)
+	{
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; i++)
+			animator.Update(1.0f / 60.0f, mode == 2 ? &Jobs() : NULL, mode == 0);
+		updateMs[mode] = stopwatch.Ms() / iterations;
+	}
+	std::cout << "ANIMATION::posing " << instances << " instances of " << animator.BoneCount() << " bones: scalar " << updateMs[0] << "ms, SIMD "
+		<< updateMs[1] << "ms (" << updateMs[0] / updateMs[1] << "x), SIMD on " << Jobs().Threads() << " threads " << updateMs[2] << "ms ("
+		<< updateMs[0] / updateMs[2] << "x)" << std::endl;
+
+	BenchmarkBakedAnimation(*timedHierarchy, *timedAnimation);
+	return passed ? 0 : 1;
+}
+
+// bakes the clips for a crowd instead, whose instances cost nothing a frame but the bake and its texture
+// once, and measures the baked frames blended the way the shader blends them against posing the clip, by
+// where each bone's bind position ends up
+void BenchmarkBakedAnimation(const NodeHierarchy &hierarchy, const ModelAnimation &animation)
+{
+	Stopwatch stopwatch;
+	BakedAnimation baked;
+	baked.Bake(hierarchy, animation, &Jobs());
+	float bakeMs = stopwatch.Ms();
+	const Skeleton &skeleton = animation.skeleton;
+	NodeTransforms pose(hierarchy);
+	std::vector<glm::mat4> bones(skeleton.Size());
+	float largestBakeError = 0.0f;
+	for (unsigned int i = 0; i < 64 && !skeleton.Empty(); i++)
+	{
+		CrowdInstance instance = { i % (unsigned int)animation.clips.size(), i * 0.137f, 0.5f + (i % 7) * 0.1f };
+		float time = i * 0.29f;
+		const AnimationClip &clip = animation.clips[instance.clip];
+		std::vector<glm::mat4> clipLocals(clip.channels.size());
+		pose.Reset(hierarchy);
+		if (!clipLocals.empty())
+			clip.Sample(clip.Wrap(time * instance.speed + instance.offset), &clipLocals[0]);
+		for (unsigned int c = 0; c < clipLocals.size(); c++)
+			pose.SetLocal(clip.channels[c].node, clipLocals[c]);
+		pose.Update();
+		skeleton.Compute(pose, &bones[0]);
+		for (unsigned int b = 0; b < skeleton.Size(); b++)
+		{
+			glm::vec4 bind = glm::vec4(glm::vec3(glm::inverse(skeleton.offsets[b])[3]), 1.0f);
+			largestBakeError = std::max(largestBakeError, glm::length(glm::vec3(baked.Sample(instance, time, b) * bind) - glm::vec3(bones[b] * bind)));
+		}
+	}
+	std::cout << "ANIMATION::baked " << baked.Frames() << " frames of " << baked.BoneCount() << " bones into " << baked.Bytes() / 1024 << "KB in "
+		<< bakeMs << "ms, then nothing to do a frame for any number of instances: bones at most " << largestBakeError
+		<< " units from posing the clip" << std::endl;
+}
@@ -0,0 +1,40 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+#include <chrono>
+
+// Wall clock time since it was started, what every benchmark times its loops with. Lap reads it and
+// starts again, so loops that run back to back are timed without a gap between them.
+class Stopwatch
+{
+public:
+	/*  Functions  */
+	Stopwatch() : start(std::chrono::high_resolution_clock::now())
+	{
+	}
+
+	void Restart()
+	{
+		start = std::chrono::high_resolution_clock::now();
+	}
+
+	// milliseconds since the start
+	float Ms() const
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// milliseconds since the start, which is now from here on
+	float Lap()
+	{
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		float ms = std::chrono::duration<float, std::milli>(now - start).count();
+		start = now;
+		return ms;
+	}
+
+private:
+	/*  Stopwatch data  */
+	std::chrono::high_resolution_clock::time_point start;
+};
+#endif
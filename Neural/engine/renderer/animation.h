@@ -0,0 +1,749 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+
+#include "node_hierarchy.h"
+#include "job_system.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANIMATION_LANES 4
+#else
+#define ANIMATION_LANES 1
+#endif
+
+// bones that can move a vertex, and the most a skinned model can have: bone indices are stored in a byte
+const unsigned int MAX_BONE_INFLUENCES = 4;
+const unsigned int MAX_BONES = 256;
+
+// how far a reduced clip may stray from the keys it was made from: in model units, radians and scale
+const float ANIMATION_POSITION_TOLERANCE = 1e-3f;
+const float ANIMATION_ROTATION_TOLERANCE = 1e-3f;
+const float ANIMATION_SCALE_TOLERANCE = 1e-3f;
+
+// Quaternions are kept in glm::vec4s as (x, y, z, w)
+inline glm::vec4 QuatIdentity()
+{
+	return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// towards b along the shorter arc, renormalised rather than spherically interpolated
+inline glm::vec4 QuatNlerp(const glm::vec4 &a, const glm::vec4 &b, float t)
+{
+	glm::vec4 to = glm::dot(a, b) < 0.0f ? b * -1.0f : b;
+	glm::vec4 q = a + (to - a) * t;
+	return q * (1.0f / std::sqrt(glm::dot(q, q)));
+}
+
+// the angle between two orientations, in radians. From the chord between the quaternions rather than
+// the acos of their dot product, which has no precision left for the small angles tolerances are about
+inline float QuatAngle(const glm::vec4 &a, const glm::vec4 &b)
+{
+	glm::vec4 chord = glm::dot(a, b) < 0.0f ? a + b : a - b;
+	return 4.0f * std::asin(std::min(1.0f, glm::length(chord) * 0.5f));
+}
+
+// translate * rotate * scale
+inline glm::mat4 ComposeTRS(const glm::vec3 &position, const glm::vec4 &q, const glm::vec3 &scale)
+{
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return glm::mat4(
+		glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * scale.x,
+		glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * scale.y,
+		glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * scale.z,
+		glm::vec4(position.x, position.y, position.z, 1.0f));
+}
+
+// A unit quaternion in 6 bytes, smallest three: the largest component is dropped, since it follows from
+// the others, and made positive by negating the whole quaternion, which is the same rotation. The other
+// three then lie within +-1/sqrt(2) and are stored in 15 bits each, the top bits of the first two words
+// hold which component was dropped. Good to about 1e-4 radians.
+struct QuantizedQuat {
+	uint16_t packed[3];
+};
+
+inline QuantizedQuat QuantizeQuat(const glm::vec4 &q)
+{
+	const float components[4] = { q.x, q.y, q.z, q.w };
+	int largest = 0;
+	for (int i = 1; i < 4; i++)
+	{
+		if (std::abs(components[i]) > std::abs(components[largest]))
+			largest = i;
+	}
+	float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+	QuantizedQuat quantized;
+	for (int i = 0, j = 0; i < 4; i++)
+	{
+		if (i == largest)
+			continue;
+		float value = std::max(-1.0f, std::min(1.0f, components[i] * sign * 1.41421356f));
+		quantized.packed[j++] = (uint16_t)(int)((value * 0.5f + 0.5f) * 32767.0f + 0.5f);
+	}
+	quantized.packed[0] |= (uint16_t)((largest & 1) << 15);
+	quantized.packed[1] |= (uint16_t)((largest >> 1) << 15);
+	return quantized;
+}
+
+inline glm::vec4 DequantizeQuat(const QuantizedQuat &quantized)
+{
+	int largest = (quantized.packed[0] >> 15) | ((quantized.packed[1] >> 15) << 1);
+	float components[4];
+	float sum = 0.0f;
+	for (int i = 0, j = 0; i < 4; i++)
+	{
+		if (i == largest)
+			continue;
+		float value = ((quantized.packed[j++] & 0x7fff) * (2.0f / 32767.0f) - 1.0f) * 0.70710678f;
+		components[i] = value;
+		sum += value * value;
+	}
+	components[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+	return glm::vec4(components[0], components[1], components[2], components[3]);
+}
+
+// quantizes up to four bone weights to bytes adding up to exactly 255, so the shader needn't renormalise
+inline void PackBoneWeights(const float weights[MAX_BONE_INFLUENCES], unsigned char packed[MAX_BONE_INFLUENCES])
+{
+	float total = 0.0f;
+	for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
+		total += weights[i];
+	if (total <= 0.0f)
+	{
+		for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
+			packed[i] = 0;
+		return;
+	}
+	int sum = 0;
+	unsigned int largest = 0;
+	for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
+	{
+		packed[i] = (unsigned char)(weights[i] / total * 255.0f + 0.5f);
+		sum += packed[i];
+		if (weights[i] > weights[largest])
+			largest = i;
+	}
+	// the largest weight is at least 64, rounding is off by two at most
+	packed[largest] = (unsigned char)(packed[largest] + 255 - sum);
+}
+
+// keys as an importer hands them over, times in seconds
+struct VectorKey {
+	float time;
+	glm::vec3 value;
+};
+
+struct RotationKey {
+	float time;
+	glm::vec4 value;
+};
+
+// the keys of one node, any track without keys leaves that part of the node at rest: no translation,
+// no rotation or a scale of 1
+struct RawChannel {
+	unsigned int node;
+	std::vector<VectorKey> positions;
+	std::vector<RotationKey> rotations;
+	std::vector<VectorKey> scales;
+};
+
+struct RawClip {
+	std::string name;
+	float duration = 0.0f;
+	std::vector<RawChannel> channels;
+
+	size_t Bytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < channels.size(); i++)
+			bytes += (channels[i].positions.size() + channels[i].scales.size()) * sizeof(VectorKey) + channels[i].rotations.size() * sizeof(RotationKey);
+		return bytes;
+	}
+};
+
+// the keys of one node once reduced, with the rotations quantized
+struct AnimationChannel {
+	unsigned int node;
+	std::vector<float> positionTimes;
+	std::vector<glm::vec3> positions;
+	std::vector<float> rotationTimes;
+	std::vector<QuantizedQuat> rotations;
+	std::vector<float> scaleTimes;
+	std::vector<glm::vec3> scales;
+};
+
+// Which keys of a track to keep. The first and last always stay; a key in between only does where
+// interpolating from the last key kept to a later one would miss it by more than tolerance. A track
+// that never strays from its first key further than that is left with just the one
+template <class Value, class Interpolate, class Error>
+std::vector<unsigned int> ReduceKeys(const std::vector<float> &times, const std::vector<Value> &values, float tolerance, Interpolate interpolate, Error error)
+{
+	std::vector<unsigned int> kept;
+	if (times.empty())
+		return kept;
+	kept.push_back(0);
+	bool constant = true;
+	for (unsigned int i = 1; i < times.size() && constant; i++)
+		constant = error(values[0], values[i]) <= tolerance;
+	if (constant)
+		return kept;
+	unsigned int anchor = 0;
+	for (unsigned int next = anchor + 2; next < times.size(); next++)
+	{
+		// can every key between the anchor and next be interpolated?
+		float span = times[next] - times[anchor];
+		bool fits = true;
+		for (unsigned int k = anchor + 1; k < next && fits; k++)
+		{
+			float t = span > 0.0f ? (times[k] - times[anchor]) / span : 0.0f;
+			fits = error(interpolate(values[anchor], values[next], t), values[k]) <= tolerance;
+		}
+		if (!fits)
+		{
+			anchor = next - 1;
+			kept.push_back(anchor);
+		}
+	}
+	kept.push_back(times.size() - 1);
+	return kept;
+}
+
+// The key each track of a channel was last sampled at. Played forward a frame at a time, a clip is
+// almost always still between the same two keys or just past the next one, so starting from where the
+// last search ended saves searching all of the track's times.
+struct KeyCursor {
+	unsigned int position = 0;
+	unsigned int rotation = 0;
+	unsigned int scale = 0;
+};
+
+// how far a cursor steps forward before giving up and searching instead
+const unsigned int KEY_CURSOR_STEPS = 4;
+
+// the key at or before time, and how far time is towards the key after it, starting from and moving
+// cursor on when given one
+inline void FindKey(const std::vector<float> &times, float time, unsigned int &key, unsigned int &next, float &t, unsigned int *cursor = NULL)
+{
+	if (times.size() <= 1 || time <= times[0])
+	{
+		key = next = 0;
+		t = 0.0f;
+		return;
+	}
+	if (time >= times.back())
+	{
+		key = next = times.size() - 1;
+		t = 0.0f;
+		return;
+	}
+	key = cursor != NULL && *cursor < times.size() && times[*cursor] <= time ? *cursor : times.size();
+	for (unsigned int step = 0; key < times.size() && step < KEY_CURSOR_STEPS && times[key + 1] <= time; step++)
+		key++;
+	if (key >= times.size() || times[key + 1] <= time)
+		key = (unsigned int)(std::upper_bound(times.begin(), times.end(), time) - times.begin()) - 1;
+	if (cursor != NULL)
+		*cursor = key;
+	next = key + 1;
+	t = (time - times[key]) / (times[next] - times[key]);
+}
+
+// One animation of a model, the keys of every node it moves reduced and quantized by Compress. Sample
+// poses all of its nodes at a time, four channels at once with SSE2: the keys either side of the time are
+// looked up one lane at a time, then dequantized, interpolated and turned into matrices for all four
+// lanes together. SampleReference does the same one channel at a time, for checking and timing against.
+class AnimationClip
+{
+public:
+	/*  Clip data  */
+	std::string name;
+	float duration = 0.0f;
+	std::vector<AnimationChannel> channels;
+
+	/*  Functions  */
+	static AnimationClip Compress(const RawClip &raw, float positionTolerance = ANIMATION_POSITION_TOLERANCE,
+		float rotationTolerance = ANIMATION_ROTATION_TOLERANCE, float scaleTolerance = ANIMATION_SCALE_TOLERANCE)
+	{
+		auto lerp = [](const glm::vec3 &a, const glm::vec3 &b, float t) { return a + (b - a) * t; };
+		auto distance = [](const glm::vec3 &a, const glm::vec3 &b) { return glm::length(a - b); };
+		AnimationClip clip;
+		clip.name = raw.name;
+		clip.duration = raw.duration;
+		clip.channels.resize(raw.channels.size());
+		for (unsigned int c = 0; c < raw.channels.size(); c++)
+		{
+			const RawChannel &source = raw.channels[c];
+			AnimationChannel &channel = clip.channels[c];
+			channel.node = source.node;
+
+			std::vector<float> times;
+			std::vector<glm::vec3> vectors;
+			splitKeys(source.positions, times, vectors);
+			std::vector<unsigned int> kept = ReduceKeys(times, vectors, positionTolerance, lerp, distance);
+			for (unsigned int k = 0; k < kept.size(); k++)
+			{
+				channel.positionTimes.push_back(times[kept[k]]);
+				channel.positions.push_back(vectors[kept[k]]);
+			}
+
+			splitKeys(source.scales, times, vectors);
+			kept = ReduceKeys(times, vectors, scaleTolerance, lerp, distance);
+			for (unsigned int k = 0; k < kept.size(); k++)
+			{
+				channel.scaleTimes.push_back(times[kept[k]]);
+				channel.scales.push_back(vectors[kept[k]]);
+			}
+
+			// every key on the same side of the sphere as the one before, so interpolating between any
+			// two that are kept takes the short way round just as it would through the ones in between
+			std::vector<glm::vec4> rotations;
+			times.clear();
+			for (unsigned int k = 0; k < source.rotations.size(); k++)
+			{
+				glm::vec4 q = glm::normalize(source.rotations[k].value);
+				if (k > 0 && glm::dot(q, rotations.back()) < 0.0f)
+					q = q * -1.0f;
+				times.push_back(source.rotations[k].time);
+				rotations.push_back(q);
+			}
+			kept = ReduceKeys(times, rotations, rotationTolerance, QuatNlerp, QuatAngle);
+			for (unsigned int k = 0; k < kept.size(); k++)
+			{
+				channel.rotationTimes.push_back(times[kept[k]]);
+				channel.rotations.push_back(QuantizeQuat(rotations[kept[k]]));
+			}
+		}
+		return clip;
+	}
+
+	size_t Bytes() const
+	{
+		size_t bytes = 0;
+		for (unsigned int c = 0; c < channels.size(); c++)
+		{
+			const AnimationChannel &channel = channels[c];
+			bytes += (channel.positionTimes.size() + channel.rotationTimes.size() + channel.scaleTimes.size()) * sizeof(float);
+			bytes += (channel.positions.size() + channel.scales.size()) * sizeof(glm::vec3) + channel.rotations.size() * sizeof(QuantizedQuat);
+		}
+		return bytes;
+	}
+
+	unsigned int Keys() const
+	{
+		unsigned int keys = 0;
+		for (unsigned int c = 0; c < channels.size(); c++)
+			keys += channels[c].positionTimes.size() + channels[c].rotationTimes.size() + channels[c].scaleTimes.size();
+		return keys;
+	}
+
+	// the local transform of every channel's node at time, locals[c] for channels[c]. cursors, one per
+	// channel, carry the keys found from one call to the next; without them every key is searched for
+	void Sample(float time, glm::mat4 *locals, KeyCursor *cursors = NULL) const
+	{
+		unsigned int c = 0;
+#if ANIMATION_LANES > 1
+		for (; c + ANIMATION_LANES <= channels.size(); c += ANIMATION_LANES)
+			sampleLanes(c, time, locals + c, cursors != NULL ? cursors + c : NULL);
+#endif
+		for (; c < channels.size(); c++)
+			locals[c] = sampleOne(c, time, cursors != NULL ? cursors + c : NULL);
+	}
+
+	void SampleReference(float time, glm::mat4 *locals, KeyCursor *cursors = NULL) const
+	{
+		for (unsigned int c = 0; c < channels.size(); c++)
+			locals[c] = sampleOne(c, time, cursors != NULL ? cursors + c : NULL);
+	}
+
+	// time wrapped into the clip, for looping
+	float Wrap(float time) const
+	{
+		if (duration <= 0.0f)
+			return 0.0f;
+		time = std::fmod(time, duration);
+		return time < 0.0f ? time + duration : time;
+	}
+
+private:
+	static void splitKeys(const std::vector<VectorKey> &keys, std::vector<float> &times, std::vector<glm::vec3> &values)
+	{
+		times.clear();
+		values.clear();
+		for (unsigned int k = 0; k < keys.size(); k++)
+		{
+			times.push_back(keys[k].time);
+			values.push_back(keys[k].value);
+		}
+	}
+
+	// the keys either side of time and the weight of the second, for each track of a channel. the
+	// rotations are left quantized for the lanes to decode together unless decode is asked for
+	struct ChannelKeys {
+		glm::vec3 position[2];
+		float positionT;
+		bool rotated;
+		QuantizedQuat packed[2];
+		glm::vec4 rotation[2];
+		float rotationT;
+		glm::vec3 scale[2];
+		float scaleT;
+	};
+
+	void findKeys(unsigned int c, float time, ChannelKeys &keys, KeyCursor *cursor, bool decode) const
+	{
+		const AnimationChannel &channel = channels[c];
+		unsigned int key, next;
+		keys.position[0] = keys.position[1] = glm::vec3(0.0f);
+		keys.positionT = 0.0f;
+		if (!channel.positions.empty())
+		{
+			FindKey(channel.positionTimes, time, key, next, keys.positionT, cursor != NULL ? &cursor->position : NULL);
+			keys.position[0] = channel.positions[key];
+			keys.position[1] = channel.positions[next];
+		}
+		keys.rotated = !channel.rotations.empty();
+		keys.rotation[0] = keys.rotation[1] = QuatIdentity();
+		keys.rotationT = 0.0f;
+		if (keys.rotated)
+		{
+			FindKey(channel.rotationTimes, time, key, next, keys.rotationT, cursor != NULL ? &cursor->rotation : NULL);
+			keys.packed[0] = channel.rotations[key];
+			keys.packed[1] = channel.rotations[next];
+			if (decode)
+			{
+				keys.rotation[0] = DequantizeQuat(keys.packed[0]);
+				keys.rotation[1] = next == key ? keys.rotation[0] : DequantizeQuat(keys.packed[1]);
+			}
+		}
+		keys.scale[0] = keys.scale[1] = glm::vec3(1.0f);
+		keys.scaleT = 0.0f;
+		if (!channel.scales.empty())
+		{
+			FindKey(channel.scaleTimes, time, key, next, keys.scaleT, cursor != NULL ? &cursor->scale : NULL);
+			keys.scale[0] = channel.scales[key];
+			keys.scale[1] = channel.scales[next];
+		}
+	}
+
+	glm::mat4 sampleOne(unsigned int c, float time, KeyCursor *cursor) const
+	{
+		ChannelKeys keys;
+		findKeys(c, time, keys, cursor, true);
+		glm::vec3 position = keys.position[0] + (keys.position[1] - keys.position[0]) * keys.positionT;
+		glm::vec3 scale = keys.scale[0] + (keys.scale[1] - keys.scale[0]) * keys.scaleT;
+		return ComposeTRS(position, QuatNlerp(keys.rotation[0], keys.rotation[1], keys.rotationT), scale);
+	}
+
+#if ANIMATION_LANES > 1
+	// every lane holds one channel, so the components of each quantity are gathered into a register each,
+	// and the four matrix columns transposed back into the channels' matrices at the end, like TransformBatch
+	void sampleLanes(unsigned int first, float time, glm::mat4 *out, KeyCursor *cursors) const
+	{
+		// [component][lane], from the key before and after. the rotations' three stored components and
+		// the index of the one left out, all ones in rotated for the lanes that have rotation keys
+		float p0[3][4], p1[3][4], pt[4];
+		int r0[4][4], r1[4][4], rotated[4];
+		float rt[4];
+		float s0[3][4], s1[3][4], st[4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			ChannelKeys keys;
+			findKeys(first + lane, time, keys, cursors != NULL ? cursors + lane : NULL, false);
+			for (int i = 0; i < 3; i++)
+			{
+				p0[i][lane] = keys.position[0][i];
+				p1[i][lane] = keys.position[1][i];
+				s0[i][lane] = keys.scale[0][i];
+				s1[i][lane] = keys.scale[1][i];
+			}
+			rotated[lane] = keys.rotated ? -1 : 0;
+			for (int i = 0; i < 3; i++)
+			{
+				r0[i][lane] = keys.rotated ? keys.packed[0].packed[i] & 0x7fff : 0;
+				r1[i][lane] = keys.rotated ? keys.packed[1].packed[i] & 0x7fff : 0;
+			}
+			r0[3][lane] = keys.rotated ? (keys.packed[0].packed[0] >> 15) | ((keys.packed[0].packed[1] >> 15) << 1) : 3;
+			r1[3][lane] = keys.rotated ? (keys.packed[1].packed[0] >> 15) | ((keys.packed[1].packed[1] >> 15) << 1) : 3;
+			pt[lane] = keys.positionT;
+			rt[lane] = keys.rotationT;
+			st[lane] = keys.scaleT;
+		}
+
+		__m128 t = _mm_loadu_ps(pt);
+		__m128 position[3], scale[3];
+		for (int i = 0; i < 3; i++)
+		{
+			__m128 a = _mm_loadu_ps(p0[i]);
+			position[i] = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p1[i]), a), t));
+		}
+		t = _mm_loadu_ps(st);
+		for (int i = 0; i < 3; i++)
+		{
+			__m128 a = _mm_loadu_ps(s0[i]);
+			scale[i] = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(s1[i]), a), t));
+		}
+
+		// nlerp, flipping the second key's sign in the lanes where the two are more than half a turn apart
+		__m128 a[4], b[4];
+		__m128 mask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)rotated));
+		dequantizeLanes(r0, mask, a);
+		dequantizeLanes(r1, mask, b);
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+		__m128 flip = _mm_and_ps(_mm_cmplt_ps(d, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+		t = _mm_loadu_ps(rt);
+		__m128 q[4];
+		for (int i = 0; i < 4; i++)
+			q[i] = _mm_add_ps(a[i], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(b[i], flip), a[i]), t));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(q[0], q[0]), _mm_mul_ps(q[1], q[1])), _mm_add_ps(_mm_mul_ps(q[2], q[2]), _mm_mul_ps(q[3], q[3]))));
+		__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), length);
+		for (int i = 0; i < 4; i++)
+			q[i] = _mm_mul_ps(q[i], inverse);
+
+		__m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+		__m128 xx = _mm_mul_ps(q[0], q[0]), yy = _mm_mul_ps(q[1], q[1]), zz = _mm_mul_ps(q[2], q[2]);
+		__m128 xy = _mm_mul_ps(q[0], q[1]), xz = _mm_mul_ps(q[0], q[2]), yz = _mm_mul_ps(q[1], q[2]);
+		__m128 wx = _mm_mul_ps(q[3], q[0]), wy = _mm_mul_ps(q[3], q[1]), wz = _mm_mul_ps(q[3], q[2]);
+		__m128 columns[4][4] = {
+			{ _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scale[0]), _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scale[0]),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scale[0]), zero },
+			{ _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scale[1]), _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scale[1]),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scale[1]), zero },
+			{ _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scale[2]), _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scale[2]),
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scale[2]), zero },
+			{ position[0], position[1], position[2], one }
+		};
+		for (int column = 0; column < 4; column++)
+		{
+			_MM_TRANSPOSE4_PS(columns[column][0], columns[column][1], columns[column][2], columns[column][3]);
+			for (int lane = 0; lane < 4; lane++)
+				_mm_storeu_ps(&out[lane][column][0], columns[column][lane]);
+		}
+	}
+
+	// DequantizeQuat for four lanes: the three stored components are rebuilt the same way, then the
+	// fourth is put back in its place by selecting with masks instead of indexing. lanes outside mask
+	// have no rotation keys and get the identity
+	static void dequantizeLanes(const int packed[4][4], __m128 mask, __m128 q[4])
+	{
+		__m128 scale = _mm_set1_ps(2.0f / 32767.0f), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.70710678f);
+		__m128 stored[3];
+		__m128 sum = _mm_setzero_ps();
+		for (int i = 0; i < 3; i++)
+		{
+			__m128 value = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)packed[i]));
+			stored[i] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(value, scale), one), half);
+			sum = _mm_add_ps(sum, _mm_mul_ps(stored[i], stored[i]));
+		}
+		__m128 largest = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(one, sum)));
+		__m128i index = _mm_loadu_si128((const __m128i *)packed[3]);
+		__m128 is[4];
+		for (int i = 0; i < 4; i++)
+			is[i] = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(i)));
+		auto select = [](__m128 m, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); };
+		q[0] = select(is[0], largest, stored[0]);
+		q[1] = select(is[0], stored[0], select(is[1], largest, stored[1]));
+		q[2] = select(_mm_or_ps(is[0], is[1]), stored[1], select(is[2], largest, stored[2]));
+		q[3] = select(is[3], largest, stored[2]);
+		for (int i = 0; i < 3; i++)
+			q[i] = _mm_and_ps(mask, q[i]);
+		q[3] = select(mask, q[3], one);
+	}
+#endif
+};
+
+// The bones of a skinned model. Every bone follows a node of the model's hierarchy, and its offset
+// matrix takes the meshes' vertices from their bind pose into the bone's space, so a node's model
+// space transform times its bone's offset moves the vertices it weighs on along with the node.
+struct Skeleton {
+	std::vector<std::string> names;
+	std::vector<unsigned int> nodes;
+	std::vector<glm::mat4> offsets;
+
+	unsigned int Size() const { return nodes.size(); }
+	bool Empty() const { return nodes.empty(); }
+
+	// -1 when no bone has the name
+	int Find(const std::string &name) const
+	{
+		for (unsigned int i = 0; i < names.size(); i++)
+		{
+			if (names[i] == name)
+				return i;
+		}
+		return -1;
+	}
+
+	unsigned int Add(const std::string &name, unsigned int node, const glm::mat4 &offset)
+	{
+		names.push_back(name);
+		nodes.push_back(node);
+		offsets.push_back(offset);
+		return nodes.size() - 1;
+	}
+
+	// the skinning matrix of every bone for a posed, updated hierarchy, into bones[0, Size())
+	void Compute(const NodeTransforms &pose, glm::mat4 *bones) const
+	{
+		for (unsigned int i = 0; i < nodes.size(); i++)
+			bones[i] = pose.World(nodes[i]) * offsets[i];
+	}
+};
+
+// everything a model needs to be animated, empty for a static one
+struct ModelAnimation {
+	Skeleton skeleton;
+	std::vector<AnimationClip> clips;
+
+	bool Empty() const { return skeleton.Empty() && clips.empty(); }
+
+	// -1 when no clip has the name
+	int FindClip(const std::string &name) const
+	{
+		for (unsigned int i = 0; i < clips.size(); i++)
+		{
+			if (clips[i].name == name)
+				return i;
+		}
+		return -1;
+	}
+};
+
+// what one member of a crowd plays: a clip, looped from offset seconds into it at speed times its pace
+struct CrowdInstance {
+	unsigned int clip;
+	float offset;
+	float speed;
+};
+
+struct AnimatorStats {
+	unsigned int updates;
+	unsigned int instances;
+	float updateMs;
+};
+
+// Plays clips on any number of instances of one model. Each instance has its own clip, time, speed and
+// NodeTransforms; Update advances them all, poses them and writes their skinning matrices one after
+// another into Bones(), instance i's at i * BoneCount(), ready to upload. Instances don't share anything
+// they write, so with a job system they are updated in parallel.
+class Animator
+{
+public:
+	/*  Functions  */
+	// the hierarchy and animation have to outlive the animator
+	Animator(const NodeHierarchy &hierarchy, const ModelAnimation &animation) : hierarchy(&hierarchy), animation(&animation)
+	{
+		ResetStats();
+	}
+
+	unsigned int Add(unsigned int clip, float time = 0.0f, float speed = 1.0f)
+	{
+		Instance instance;
+		instance.clip = std::min(clip, (unsigned int)animation->clips.size() - 1);
+		instance.time = time;
+		instance.speed = speed;
+		instance.pose.Reset(*hierarchy);
+		if (!animation->clips.empty())
+			instance.cursors.resize(animation->clips[instance.clip].channels.size());
+		instances.push_back(instance);
+		bones.resize(instances.size() * BoneCount());
+		return instances.size() - 1;
+	}
+
+	void Clear()
+	{
+		instances.clear();
+		bones.clear();
+	}
+
+	unsigned int Size() const { return instances.size(); }
+	unsigned int BoneCount() const { return animation->skeleton.Size(); }
+	const std::vector<glm::mat4> &Bones() const { return bones; }
+	const NodeTransforms &Pose(unsigned int instance) const { return instances[instance].pose; }
+
+	// advances every instance by seconds times its speed and poses it. reference samples the clips one
+	// channel at a time instead, for comparing against
+	void Update(float seconds, JobSystem *jobs = NULL, bool reference = false)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		unsigned int channels = 0;
+		for (unsigned int i = 0; i < animation->clips.size(); i++)
+			channels = std::max(channels, (unsigned int)animation->clips[i].channels.size());
+		auto update = [&](unsigned int begin, unsigned int end) {
+			std::vector<glm::mat4> locals(channels);
+			for (unsigned int i = begin; i < end; i++)
+				updateInstance(i, seconds, locals, reference);
+		};
+		if (jobs != NULL)
+			jobs->ParallelFor(instances.size(), 16, update);
+		else
+			update(0, instances.size());
+		stats.updates++;
+		stats.instances += instances.size();
+		stats.updateMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	AnimatorStats Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats.updates = 0;
+		stats.instances = 0;
+		stats.updateMs = 0.0f;
+	}
+
+	void PrintStats() const
+	{
+		if (stats.updates == 0)
+			return;
+		std::cout << "ANIMATION::" << stats.instances / stats.updates << " instances of " << BoneCount() << " bones, "
+			<< stats.updateMs / stats.updates << "ms per update" << std::endl;
+	}
+
+private:
+	struct Instance {
+		unsigned int clip;
+		float time;
+		float speed;
+		NodeTransforms pose;
+		// one per channel of the clip
+		std::vector<KeyCursor> cursors;
+	};
+
+	/*  Animator data  */
+	const NodeHierarchy *hierarchy;
+	const ModelAnimation *animation;
+	std::vector<Instance> instances;
+	std::vector<glm::mat4> bones;
+	AnimatorStats stats;
+
+	void updateInstance(unsigned int i, float seconds, std::vector<glm::mat4> &locals, bool reference)
+	{
+		Instance &instance = instances[i];
+		if (!animation->clips.empty() && !animation->clips[instance.clip].channels.empty())
+		{
+			const AnimationClip &clip = animation->clips[instance.clip];
+			instance.time = clip.Wrap(instance.time + seconds * instance.speed);
+			if (reference)
+				clip.SampleReference(instance.time, &locals[0], &instance.cursors[0]);
+			else
+				clip.Sample(instance.time, &locals[0], &instance.cursors[0]);
+			for (unsigned int c = 0; c < clip.channels.size(); c++)
+				instance.pose.SetLocal(clip.channels[c].node, locals[c]);
+		}
+		instance.pose.Update();
+		if (BoneCount() > 0)
+			animation->skeleton.Compute(instance.pose, &bones[i * BoneCount()]);
+	}
+};
+#endif
@@ -0,0 +1,226 @@
+#ifndef BAKED_ANIMATION_H
+#define BAKED_ANIMATION_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "node_hierarchy.h"
+#include "job_system.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// texture units of the baked frames and of the crowd's playback, after the bone buffer's
+const unsigned int BAKED_ANIMATION_TEXTURE_UNIT = 5;
+const unsigned int CROWD_TEXTURE_UNIT = 6;
+// frames baked for every second of a clip unless asked otherwise, the shader blends the two either side
+const float BAKED_ANIMATION_FRAME_RATE = 30.0f;
+
+// where a clip's frames start in the baked texture, how many it has and how many play a second
+struct BakedClip {
+	unsigned int firstFrame;
+	unsigned int frames;
+	float framesPerSecond;
+};
+
+// Every clip of an animated model posed ahead of time, for crowds that needn't be animated one by one.
+// Bake samples each clip at a fixed rate and keeps the skinning matrices of every frame as a row of an
+// RGBA32F texture, three texels a bone holding the top three rows of its matrix. Each instance of a
+// crowd then only needs its clip, start and speed, uploaded once by SetInstances, and the vertex shader
+// finds its frames from the time alone, see 2.5.baked_crowd.vs, so the CPU does no work per instance
+// and frame at all. Longer clips and more bones cost texture memory instead: Bytes() of it.
+class BakedAnimation
+{
+public:
+	/*  Functions  */
+	BakedAnimation() : texture(0), crowdBuffer(0), crowdTexture(0), boneCount(0), frames(0), instances(0)
+	{
+	}
+
+	// poses every clip framesPerSecond times a second of it, spreading the frames over jobs when given.
+	// The frames of a clip are evenly spaced over its duration and its last one blends into the first,
+	// so clips are taken to loop. Doesn't touch GL, so it can run on any thread
+	void Bake(const NodeHierarchy &hierarchy, const ModelAnimation &animation, JobSystem *jobs = NULL,
+		float framesPerSecond = BAKED_ANIMATION_FRAME_RATE)
+	{
+		clips.clear();
+		texels.clear();
+		boneCount = animation.skeleton.Size();
+		frames = 0;
+		for (unsigned int c = 0; c < animation.clips.size(); c++)
+		{
+			const AnimationClip &clip = animation.clips[c];
+			BakedClip baked;
+			baked.firstFrame = frames;
+			baked.frames = std::max(1u, (unsigned int)std::ceil(clip.duration * framesPerSecond - 1e-3f));
+			baked.framesPerSecond = clip.duration > 0.0f ? baked.frames / clip.duration : 0.0f;
+			clips.push_back(baked);
+			frames += baked.frames;
+		}
+		if (boneCount == 0)
+			return;
+		texels.resize((size_t)frames * boneCount * 3);
+
+		auto bake = [&](unsigned int begin, unsigned int end) {
+			NodeTransforms pose(hierarchy);
+			std::vector<glm::mat4> locals, bones(boneCount);
+			std::vector<KeyCursor> cursors;
+			int posed = -1;
+			for (unsigned int frame = begin; frame < end; frame++)
+			{
+				unsigned int c = 0;
+				while (frame >= clips[c].firstFrame + clips[c].frames)
+					c++;
+				const AnimationClip &clip = animation.clips[c];
+				// nodes a clip doesn't move keep their own transform, not the last clip's
+				if (posed != (int)c)
+				{
+					pose.Reset(hierarchy);
+					locals.resize(clip.channels.size());
+					cursors.assign(clip.channels.size(), KeyCursor());
+					posed = c;
+				}
+				if (!clip.channels.empty())
+				{
+					float time = clips[c].framesPerSecond > 0.0f ? (frame - clips[c].firstFrame) / clips[c].framesPerSecond : 0.0f;
+					clip.Sample(time, &locals[0], &cursors[0]);
+					for (unsigned int i = 0; i < clip.channels.size(); i++)
+						pose.SetLocal(clip.channels[i].node, locals[i]);
+				}
+				pose.Update();
+				animation.skeleton.Compute(pose, &bones[0]);
+				glm::vec4 *row = &texels[(size_t)frame * boneCount * 3];
+				for (unsigned int b = 0; b < boneCount; b++)
+				{
+					for (int r = 0; r < 3; r++)
+						row[b * 3 + r] = glm::vec4(bones[b][0][r], bones[b][1][r], bones[b][2][r], bones[b][3][r]);
+				}
+			}
+		};
+		if (jobs != NULL)
+			jobs->ParallelFor(frames, 8, bake);
+		else
+			bake(0, frames);
+	}
+
+	// the baked frames into a texture, false when there are none or they don't fit in one
+	bool Upload()
+	{
+		if (texture != 0)
+			glDeleteTextures(1, &texture);
+		texture = 0;
+		if (texels.empty())
+			return false;
+		GLint size = 1024;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+		if (boneCount * 3 > (unsigned int)size || frames > (unsigned int)size)
+		{
+			std::cout << "ERROR::BAKED_ANIMATION::" << frames << " frames of " << boneCount << " bones don't fit in a texture of at most "
+				<< size << " texels a side" << std::endl;
+			return false;
+		}
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, boneCount * 3, frames, 0, GL_RGBA, GL_FLOAT, &texels[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return true;
+	}
+
+	// each instance's playback as a texel of a buffer texture, the first frame and frame count of its
+	// clip, the frame it is at when time is 0 and how many frames it moves on a second
+	void SetInstances(const std::vector<CrowdInstance> &crowd)
+	{
+		std::vector<glm::vec4> playback(crowd.size());
+		for (unsigned int i = 0; i < crowd.size(); i++)
+		{
+			const BakedClip &clip = clips[std::min(crowd[i].clip, (unsigned int)clips.size() - 1)];
+			playback[i] = glm::vec4((float)clip.firstFrame, (float)clip.frames, crowd[i].offset * clip.framesPerSecond,
+				clip.framesPerSecond * crowd[i].speed);
+		}
+		if (crowdBuffer == 0)
+		{
+			glGenBuffers(1, &crowdBuffer);
+			glGenTextures(1, &crowdTexture);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, crowdBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, std::max((size_t)1, playback.size()) * sizeof(glm::vec4), playback.empty() ? NULL : &playback[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, crowdTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, crowdBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		instances = crowd.size();
+	}
+
+	void Bind()
+	{
+		glActiveTexture(GL_TEXTURE0 + BAKED_ANIMATION_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glActiveTexture(GL_TEXTURE0 + CROWD_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, crowdTexture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// the skinning matrix of a bone in a baked frame
+	glm::mat4 Matrix(unsigned int frame, unsigned int bone) const
+	{
+		const glm::vec4 *rows = &texels[((size_t)frame * boneCount + bone) * 3];
+		glm::mat4 matrix(1.0f);
+		for (int column = 0; column < 4; column++)
+		{
+			for (int r = 0; r < 3; r++)
+				matrix[column][r] = rows[r][column];
+		}
+		return matrix;
+	}
+
+	// what the shader blends a bone's matrix to for an instance at time, for checking against
+	glm::mat4 Sample(const CrowdInstance &instance, float time, unsigned int bone) const
+	{
+		const BakedClip &clip = clips[std::min(instance.clip, (unsigned int)clips.size() - 1)];
+		float frame = std::fmod(time * clip.framesPerSecond * instance.speed + instance.offset * clip.framesPerSecond, (float)clip.frames);
+		if (frame < 0.0f)
+			frame += clip.frames;
+		unsigned int first = std::min((unsigned int)frame, clip.frames - 1);
+		unsigned int next = first + 1 == clip.frames ? 0 : first + 1;
+		float blend = frame - first;
+		return Matrix(clip.firstFrame + first, bone) * (1.0f - blend) + Matrix(clip.firstFrame + next, bone) * blend;
+	}
+
+	const std::vector<BakedClip> &Clips() const { return clips; }
+	unsigned int Frames() const { return frames; }
+	unsigned int BoneCount() const { return boneCount; }
+	unsigned int Instances() const { return instances; }
+	size_t Bytes() const { return texels.size() * sizeof(glm::vec4); }
+
+	void Release()
+	{
+		if (texture != 0)
+			glDeleteTextures(1, &texture);
+		if (crowdTexture != 0)
+			glDeleteTextures(1, &crowdTexture);
+		if (crowdBuffer != 0)
+			glDeleteBuffers(1, &crowdBuffer);
+		texture = crowdTexture = crowdBuffer = 0;
+		instances = 0;
+	}
+
+private:
+	/*  Bake data  */
+	unsigned int texture;
+	unsigned int crowdBuffer;
+	unsigned int crowdTexture;
+	unsigned int boneCount;
+	unsigned int frames;
+	unsigned int instances;
+	std::vector<BakedClip> clips;
+	// frames one after another, a row of three texels per bone each, as uploaded
+	std::vector<glm::vec4> texels;
+};
+#endif
@@ -0,0 +1,138 @@
+#ifndef BONE_BUFFER_H
+#define BONE_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gl_ext.h"
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// texture unit the bone matrices are bound to, clear of the meshes' textures and the material arrays
+const unsigned int BONE_TEXTURE_UNIT = 4;
+
+// The skinning matrices of every animated instance, as a buffer texture of four RGBA32F texels a matrix
+// that the skinned vertex shader reads with texelFetch. A buffer texture holds far more than a uniform
+// block can, GL 3.3 guarantees 16384 matrices, so all instances' bones go up in a single upload. With
+// texture buffer ranges the bones are streamed through the frame's region of a RingBuffer and the
+// texture is pointed at where they landed, so nothing is allocated or waited on per frame. Without them
+// the texture has a buffer of its own, orphaned on every upload so the upload never waits on the GPU.
+class BoneBuffer
+{
+public:
+	/*  Functions  */
+	BoneBuffer() : buffer(0), texture(0), capacity(0), limit(0), alignment(256), ring(NULL)
+	{
+	}
+
+	void Create(unsigned int matrices = 1024)
+	{
+		Release();
+		GLint texels = 65536;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+		limit = texels / 4;
+		capacity = std::max(1u, std::min(matrices, limit));
+		if (GLExt.textureBufferRange)
+		{
+			GLint offsetAlignment = 256;
+			glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+			alignment = std::max(offsetAlignment, 1);
+		}
+		else
+		{
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		}
+		glGenTextures(1, &texture);
+		if (buffer != 0)
+		{
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+	}
+
+	// bytes capacity matrices take in a ring, alignment included
+	GLsizeiptr RingBytes() const
+	{
+		return GLExt.textureBufferRange && capacity > 0 ? (GLsizeiptr)capacity * sizeof(glm::mat4) + alignment : 0;
+	}
+
+	// uploads go to ring from now on, where texture buffer ranges are available
+	void Stream(RingBuffer &ring)
+	{
+		this->ring = &ring;
+	}
+
+	// false, uploading nothing, when there are more matrices than a buffer texture can hold or the frame's
+	// region of the ring is full
+	bool Upload(const glm::mat4 *matrices, unsigned int count)
+	{
+		if (count > limit)
+		{
+			std::cout << "ERROR::BONE_BUFFER::" << count << " matrices, a buffer texture holds " << limit << std::endl;
+			return false;
+		}
+		if (count == 0)
+			return true;
+		if (GLExt.textureBufferRange)
+		{
+			RingAllocation allocation;
+			GLsizeiptr size = (GLsizeiptr)count * sizeof(glm::mat4);
+			if (ring == NULL || !ring->Allocate(size, alignment, allocation))
+				return false;
+			memcpy(allocation.data, matrices, size);
+			ring->Flush();
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			GLExt.TexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, ring->Buffer(), allocation.offset, size);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+			return true;
+		}
+		while (capacity < count)
+			capacity = std::min(capacity * 2, limit);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)count * sizeof(glm::mat4), matrices);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		return true;
+	}
+
+	void Bind(unsigned int unit = BONE_TEXTURE_UNIT)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	unsigned int Capacity() const { return capacity; }
+
+	void Release()
+	{
+		if (texture != 0)
+			glDeleteTextures(1, &texture);
+		if (buffer != 0)
+			glDeleteBuffers(1, &buffer);
+		texture = buffer = 0;
+		capacity = 0;
+		ring = NULL;
+	}
+
+private:
+	/*  Buffer data  */
+	// only without texture buffer ranges
+	unsigned int buffer;
+	unsigned int texture;
+	unsigned int capacity;
+	// the most matrices the buffer texture can hold
+	unsigned int limit;
+	// what offsets into the ring have to be a multiple of
+	GLint alignment;
+	RingBuffer *ring;
+};
+#endif
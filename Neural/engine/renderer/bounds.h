@@ -0,0 +1,93 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+// Axis aligned bounding box
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void Expand(const glm::vec3 &point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	bool Valid() const
+	{
+		return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+	}
+};
+
+// bounds of a local space box after transforming it, by transforming its centre and extents (Arvo)
+inline AABB TransformAABB(const AABB &box, const glm::mat4 &matrix)
+{
+	glm::vec3 centre = (box.min + box.max) * 0.5f;
+	glm::vec3 extents = (box.max - box.min) * 0.5f;
+	glm::vec3 worldCentre = glm::vec3(matrix * glm::vec4(centre, 1.0f));
+	glm::vec3 worldExtents;
+	for (int i = 0; i < 3; i++)
+		worldExtents[i] = glm::abs(matrix[0][i]) * extents.x + glm::abs(matrix[1][i]) * extents.y + glm::abs(matrix[2][i]) * extents.z;
+
+	AABB result;
+	result.min = worldCentre - worldExtents;
+	result.max = worldCentre + worldExtents;
+	return result;
+}
+
+// Intersects, FrustumCuller and the culling compute shader only agree bit for bit while every multiply
+// and add is rounded on its own, so nothing from here on may be fused into a multiply-add
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+// The six clip planes of a view projection matrix, pointing inwards (Gribb & Hartmann).
+// Planes are left unnormalised, only the sign of the distance matters for the box test.
+class Frustum
+{
+public:
+	// left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+	Frustum()
+	{
+	}
+
+	Frustum(const glm::mat4 &viewProjection)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				planes[i * 2][j] = viewProjection[j][3] + viewProjection[j][i];
+				planes[i * 2 + 1][j] = viewProjection[j][3] - viewProjection[j][i];
+			}
+		}
+	}
+
+	// reference test, the culling shaders spell out exactly the same arithmetic so both agree bit for bit
+	bool Intersects(const AABB &box) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			const glm::vec4 &plane = planes[i];
+			// the box corner furthest along the plane normal
+			float x = plane.x >= 0.0f ? box.max.x : box.min.x;
+			float y = plane.y >= 0.0f ? box.max.y : box.min.y;
+			float z = plane.z >= 0.0f ? box.max.z : box.min.z;
+			float distance = plane.x * x;
+			distance += plane.y * y;
+			distance += plane.z * z;
+			distance += plane.w;
+			if (distance < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+#endif
@@ -0,0 +1,339 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "geometry_buffer.h"
+#include "occlusion_queries.h"
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <iostream>
+
+enum RenderCommandType {
+	COMMAND_USE_PROGRAM,       // program
+	COMMAND_BIND_TEXTURE,      // unit, texture
+	COMMAND_SET_INT,           // uniform, value
+	COMMAND_SET_FLOAT,         // uniform, value
+	COMMAND_SET_VEC3,          // uniform, 3 floats
+	COMMAND_SET_MAT3,          // uniform, 9 floats, column major
+	COMMAND_SET_MAT4,          // uniform, 16 floats, column major
+	COMMAND_DRAW,              // first index, index count, base vertex
+	COMMAND_BEGIN_CONDITIONAL, // query
+	COMMAND_END_CONDITIONAL,
+	COMMAND_BIND_TEXTURE_ARRAY, // unit, texture
+	COMMAND_TYPES
+};
+
+// Draws recorded as a stream of 32 bit words, each command its type followed by its arguments, with
+// uniform names kept once per buffer and referred to by index. Nothing in it calls into GL, so any
+// thread can record a buffer while the render thread replays others, and the same words describe
+// the frame to any backend that can replay them. Programs and textures are whatever the replaying side
+// says the numbers mean; here programs index CommandReplayer's table and textures are GL names.
+//
+// Dump writes a buffer out as readable text and Write/Read as its raw words, to capture a frame and
+// look at it or replay it later.
+class CommandBuffer
+{
+public:
+	/*  Functions  */
+	// keeps the memory, a buffer recorded every frame stops allocating after the first
+	void Clear()
+	{
+		words.clear();
+		uniforms.clear();
+		draws = 0;
+	}
+
+	bool Empty() const { return words.empty(); }
+	unsigned int Draws() const { return draws; }
+	unsigned int Size() const { return words.size(); }
+
+	void UseProgram(unsigned int program)
+	{
+		begin(COMMAND_USE_PROGRAM);
+		words.push_back(program);
+	}
+
+	void BindTexture(unsigned int unit, unsigned int texture)
+	{
+		begin(COMMAND_BIND_TEXTURE);
+		words.push_back(unit);
+		words.push_back(texture);
+	}
+
+	void BindTextureArray(unsigned int unit, unsigned int texture)
+	{
+		begin(COMMAND_BIND_TEXTURE_ARRAY);
+		words.push_back(unit);
+		words.push_back(texture);
+	}
+
+	void SetInt(const char *name, int value)
+	{
+		begin(COMMAND_SET_INT);
+		words.push_back(uniform(name));
+		words.push_back((unsigned int)value);
+	}
+
+	void SetFloat(const char *name, float value)
+	{
+		begin(COMMAND_SET_FLOAT);
+		words.push_back(uniform(name));
+		pushFloats(&value, 1);
+	}
+
+	void SetVec3(const char *name, const glm::vec3 &value)
+	{
+		begin(COMMAND_SET_VEC3);
+		words.push_back(uniform(name));
+		pushFloats(&value[0], 3);
+	}
+
+	void SetMat3(const char *name, const glm::mat3 &value)
+	{
+		begin(COMMAND_SET_MAT3);
+		words.push_back(uniform(name));
+		pushFloats(&value[0][0], 9);
+	}
+
+	void SetMat4(const char *name, const glm::mat4 &value)
+	{
+		begin(COMMAND_SET_MAT4);
+		words.push_back(uniform(name));
+		pushFloats(&value[0][0], 16);
+	}
+
+	void Draw(const GeometryRange &range)
+	{
+		begin(COMMAND_DRAW);
+		words.push_back(range.FirstIndex());
+		words.push_back(range.IndexCount());
+		words.push_back((unsigned int)range.BaseVertex());
+		draws++;
+	}
+
+	// the draws up to EndConditional only happen if the query saw samples
+	void BeginConditional(unsigned int query)
+	{
+		begin(COMMAND_BEGIN_CONDITIONAL);
+		words.push_back(query);
+	}
+
+	void EndConditional()
+	{
+		begin(COMMAND_END_CONDITIONAL);
+	}
+
+	const std::vector<unsigned int> &Words() const { return words; }
+	const std::string &Uniform(unsigned int index) const { return uniforms[index]; }
+
+	// one command per line
+	void Dump(std::ostream &out) const
+	{
+		static const char *names[COMMAND_TYPES] = {
+			"use_program", "bind_texture", "set_int", "set_float", "set_vec3", "set_mat3", "set_mat4", "draw", "begin_conditional", "end_conditional",
+			"bind_texture_array"
+		};
+		for (unsigned int i = 0; i < words.size(); i += Length(words[i]))
+		{
+			unsigned int type = words[i];
+			out << names[type];
+			unsigned int first = 1;
+			if (type >= COMMAND_SET_INT && type <= COMMAND_SET_MAT4)
+			{
+				out << " " << uniforms[words[i + 1]];
+				first = 2;
+			}
+			for (unsigned int j = first; j < Length(type); j++)
+			{
+				if (type == COMMAND_SET_INT)
+					out << " " << (int)words[i + j];
+				else if (type >= COMMAND_SET_FLOAT && type <= COMMAND_SET_MAT4)
+					out << " " << asFloat(words[i + j]);
+				else
+					out << " " << words[i + j];
+			}
+			out << "\n";
+		}
+	}
+
+	// the uniform names, then the words, as little endian 32 bit counts and data
+	void Write(std::ostream &out) const
+	{
+		unsigned int count = uniforms.size();
+		out.write((const char*)&count, sizeof(count));
+		for (unsigned int i = 0; i < uniforms.size(); i++)
+		{
+			unsigned int length = uniforms[i].size();
+			out.write((const char*)&length, sizeof(length));
+			out.write(uniforms[i].data(), length);
+		}
+		count = words.size();
+		out.write((const char*)&count, sizeof(count));
+		if (count > 0)
+			out.write((const char*)&words[0], count * sizeof(unsigned int));
+	}
+
+	bool Read(std::istream &in)
+	{
+		Clear();
+		unsigned int count = 0;
+		in.read((char*)&count, sizeof(count));
+		for (unsigned int i = 0; i < count && in; i++)
+		{
+			unsigned int length = 0;
+			in.read((char*)&length, sizeof(length));
+			std::string name(length, '\0');
+			if (length > 0)
+				in.read(&name[0], length);
+			uniforms.push_back(name);
+		}
+		in.read((char*)&count, sizeof(count));
+		words.resize(in ? count : 0);
+		if (!words.empty())
+			in.read((char*)&words[0], count * sizeof(unsigned int));
+		if (!in)
+		{
+			Clear();
+			return false;
+		}
+		// a truncated or corrupt capture is rejected rather than replayed
+		for (unsigned int i = 0; i < words.size(); i += Length(words[i]))
+		{
+			bool setsUniform = words[i] >= COMMAND_SET_INT && words[i] <= COMMAND_SET_MAT4;
+			if (words[i] >= COMMAND_TYPES || i + Length(words[i]) > words.size() || (setsUniform && words[i + 1] >= uniforms.size()))
+			{
+				Clear();
+				return false;
+			}
+			draws += words[i] == COMMAND_DRAW;
+		}
+		return true;
+	}
+
+	// words taken by a command of the type, its type included
+	static unsigned int Length(unsigned int type)
+	{
+		static const unsigned int lengths[COMMAND_TYPES] = { 2, 3, 3, 3, 5, 11, 18, 4, 2, 1, 3 };
+		return lengths[type];
+	}
+
+	static float asFloat(unsigned int word)
+	{
+		float value;
+		memcpy(&value, &word, sizeof(value));
+		return value;
+	}
+
+private:
+	/*  Buffer data  */
+	std::vector<unsigned int> words;
+	std::vector<std::string> uniforms;
+	unsigned int draws = 0;
+
+	void begin(RenderCommandType type)
+	{
+		words.push_back(type);
+	}
+
+	void pushFloats(const float *values, unsigned int count)
+	{
+		size_t first = words.size();
+		words.resize(first + count);
+		memcpy(&words[first], values, count * sizeof(float));
+	}
+
+	// buffers only ever see a handful of names, a linear search beats hashing them
+	unsigned int uniform(const char *name)
+	{
+		for (unsigned int i = 0; i < uniforms.size(); i++)
+		{
+			if (uniforms[i] == name)
+				return i;
+		}
+		uniforms.push_back(name);
+		return uniforms.size() - 1;
+	}
+};
+
+// Replays command buffers through GL on the context thread. Programs are looked up in the table it's
+// given and conditional rendering goes through the occlusion queries, when there are any.
+class CommandReplayer
+{
+public:
+	/*  Functions  */
+	// the geometry buffer's VAO has to be bound while replaying
+	CommandReplayer(const std::vector<Shader*> &programs, OcclusionQueries *queries = NULL)
+		: programs(programs), queries(queries), current(NULL)
+	{
+	}
+
+	void Replay(const CommandBuffer &commands)
+	{
+		const std::vector<unsigned int> &words = commands.Words();
+		// a conditional the queries declined to start has nothing to end
+		bool conditional = false;
+		float values[16];
+		for (unsigned int i = 0; i < words.size(); i += CommandBuffer::Length(words[i]))
+		{
+			// past the end for a command without arguments closing the buffer, so never indexed
+			const unsigned int *arguments = words.data() + i + 1;
+			switch (words[i])
+			{
+			case COMMAND_USE_PROGRAM:
+				current = programs[arguments[0]];
+				current->use();
+				break;
+			case COMMAND_BIND_TEXTURE:
+				glActiveTexture(GL_TEXTURE0 + arguments[0]);
+				glBindTexture(GL_TEXTURE_2D, arguments[1]);
+				break;
+			case COMMAND_BIND_TEXTURE_ARRAY:
+				glActiveTexture(GL_TEXTURE0 + arguments[0]);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, arguments[1]);
+				break;
+			case COMMAND_SET_INT:
+				current->setInt(commands.Uniform(arguments[0]), (int)arguments[1]);
+				break;
+			case COMMAND_SET_FLOAT:
+				current->setFloat(commands.Uniform(arguments[0]), CommandBuffer::asFloat(arguments[1]));
+				break;
+			case COMMAND_SET_VEC3:
+				memcpy(values, &arguments[1], 3 * sizeof(float));
+				glUniform3fv(glGetUniformLocation(current->ID, commands.Uniform(arguments[0]).c_str()), 1, values);
+				break;
+			case COMMAND_SET_MAT3:
+				memcpy(values, &arguments[1], 9 * sizeof(float));
+				glUniformMatrix3fv(glGetUniformLocation(current->ID, commands.Uniform(arguments[0]).c_str()), 1, GL_FALSE, values);
+				break;
+			case COMMAND_SET_MAT4:
+				memcpy(values, &arguments[1], 16 * sizeof(float));
+				glUniformMatrix4fv(glGetUniformLocation(current->ID, commands.Uniform(arguments[0]).c_str()), 1, GL_FALSE, values);
+				break;
+			case COMMAND_DRAW:
+				glDrawElementsBaseVertex(GL_TRIANGLES, arguments[1], GL_UNSIGNED_INT, (void*)(arguments[0] * sizeof(unsigned int)), (GLint)arguments[2]);
+				break;
+			case COMMAND_BEGIN_CONDITIONAL:
+				conditional = queries != NULL && queries->BeginConditional(arguments[0]);
+				break;
+			case COMMAND_END_CONDITIONAL:
+				if (queries != NULL)
+					queries->EndConditional(conditional);
+				conditional = false;
+				break;
+			}
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+private:
+	/*  Replay data  */
+	std::vector<Shader*> programs;
+	OcclusionQueries *queries;
+	Shader *current;
+};
+#endif
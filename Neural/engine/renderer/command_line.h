@@ -0,0 +1,28 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include <string>
+#include <cstddef>
+
+// whether name is one of the arguments
+inline bool HasArgument(int argc, char **argv, const char *name)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == name)
+			return true;
+	}
+	return false;
+}
+
+// the argument following name, or NULL when name isn't given or is the last argument
+inline const char *ArgumentValue(int argc, char **argv, const char *name)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == name)
+			return argv[i + 1];
+	}
+	return NULL;
+}
+#endif
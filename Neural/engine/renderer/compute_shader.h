@@ -0,0 +1,60 @@
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+#include "gl_ext.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// A program made of a single compute shader. Needs GL 4.3, check GLExt.compute first.
+class ComputeShader : public Shader
+{
+public:
+	// constructor generates the shader on the fly
+	// ------------------------------------------------------------------------
+	ComputeShader(const char* computePath)
+	{
+		// 1. retrieve the compute source code from filePath
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		// ensure ifstream objects can throw exceptions:
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (std::ifstream::failure e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		const char* cShaderCode = computeCode.c_str();
+		// 2. compile shader
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+		checkCompileErrors(compute, "COMPUTE");
+		// shader Program
+		ID = glCreateProgram();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		glDeleteShader(compute);
+	}
+
+	// runs the shader over enough work groups to cover the given number of invocations
+	// ------------------------------------------------------------------------
+	void dispatch(unsigned int invocations, unsigned int groupSize) const
+	{
+		GLExt.DispatchCompute((invocations + groupSize - 1) / groupSize, 1, 1);
+	}
+};
+#endif
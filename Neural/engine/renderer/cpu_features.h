@@ -0,0 +1,57 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// The SIMD kernels' SSE2 paths are picked at compile time, every x86-64 CPU has SSE2. Their AVX2 paths
+// are compiled whatever the build targets and only run once CpuHasAVX2() has found the CPU and the OS
+// support them, so the project can keep the default /arch and still run everywhere.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__GNUC__)
+#define CPU_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC takes any intrinsic in any function
+#define CPU_AVX2_TARGET
+#else
+// only AVX2, without FMA, so the compiler can't fuse any of the kernels' multiplies and adds either
+#define CPU_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+// whether the CPU has AVX2 and the OS saves the YMM registers, asked once
+inline bool CpuHasAVX2()
+{
+#if CPU_AVX2
+	static const bool supported = []() {
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		// AVX and OSXSAVE, then XCR0 for the XMM and YMM state
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+// whether the kernels take their AVX2 paths, cleared to run the SSE2 ones on a CPU that has AVX2 too
+inline bool &UseAVX2()
+{
+	static bool use = CpuHasAVX2();
+	return use;
+}
+#endif
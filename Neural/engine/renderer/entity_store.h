@@ -0,0 +1,274 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <glm/glm.hpp>
+
+#include "transform.h"
+#include "bounds.h"
+
+#include <vector>
+
+typedef unsigned int Entity;
+const Entity NULL_ENTITY = 0xFFFFFFFF;
+
+// one bit per component type, an archetype is the set of components its entities have
+typedef unsigned int ComponentMask;
+const ComponentMask HAS_TRANSFORM = 1 << 0;
+const ComponentMask HAS_RENDERABLE = 1 << 1;
+const ComponentMask HAS_LIGHT = 1 << 2;
+const ComponentMask HAS_COLLIDER = 1 << 3;
+
+// what an entity draws: a mesh the renderer knows by id, with the textures of one material
+struct Renderable {
+	unsigned int mesh;
+	unsigned int material;
+};
+
+// a point light at the entity's position
+struct Light {
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+};
+
+// world space bounds, and whether the entity is solid enough to hide what is behind it
+struct Collider {
+	AABB bounds;
+	bool occluder;
+};
+
+// entities per chunk
+const unsigned int ENTITY_CHUNK_CAPACITY = 128;
+
+// Up to ENTITY_CHUNK_CAPACITY entities of a single archetype. Every component the archetype has gets its own column,
+// allocated once at full capacity so it stays contiguous; columns for components it lacks stay empty.
+// Rows 0..count-1 are live, removing an entity moves the last row into its place.
+struct EntityChunk {
+	ComponentMask mask;
+	unsigned int count;
+	std::vector<Entity> entities;
+	std::vector<Transform> transforms;
+	std::vector<Renderable> renderables;
+	std::vector<Light> lights;
+	std::vector<Collider> colliders;
+};
+
+// Archetype based entity storage. Entities are ids into a table of where their row lives; systems
+// don't look entities up one by one but ask Query for every chunk holding at least a set of
+// components and walk its columns.
+class EntityStore
+{
+public:
+	/*  Functions  */
+	EntityStore()
+	{
+	}
+
+	~EntityStore()
+	{
+		Clear();
+	}
+
+	// chunks are owned by the store
+	EntityStore(const EntityStore&) = delete;
+	EntityStore &operator=(const EntityStore&) = delete;
+
+	Entity Create(ComponentMask mask)
+	{
+		Entity entity;
+		if (!freeEntities.empty())
+		{
+			entity = freeEntities.back();
+			freeEntities.pop_back();
+		}
+		else
+		{
+			entity = locations.size();
+			locations.push_back(Location());
+		}
+
+		unsigned int archetype = findArchetype(mask);
+		std::vector<EntityChunk*> &chunks = archetypes[archetype].chunks;
+		if (chunks.empty() || chunks.back()->count == ENTITY_CHUNK_CAPACITY)
+			chunks.push_back(createChunk(mask));
+		EntityChunk *chunk = chunks.back();
+		unsigned int row = chunk->count++;
+		chunk->entities[row] = entity;
+		if (mask & HAS_TRANSFORM)
+			chunk->transforms[row] = Transform();
+		if (mask & HAS_RENDERABLE)
+			chunk->renderables[row] = Renderable();
+		if (mask & HAS_LIGHT)
+			chunk->lights[row] = Light();
+		if (mask & HAS_COLLIDER)
+			chunk->colliders[row] = Collider();
+
+		locations[entity].archetype = archetype;
+		locations[entity].chunk = chunks.size() - 1;
+		locations[entity].row = row;
+		locations[entity].alive = true;
+		return entity;
+	}
+
+	void Destroy(Entity entity)
+	{
+		if (!Alive(entity))
+			return;
+		Location &location = locations[entity];
+		std::vector<EntityChunk*> &chunks = archetypes[location.archetype].chunks;
+		EntityChunk *chunk = chunks[location.chunk];
+
+		// the last row of the chunk fills the hole
+		unsigned int last = chunk->count - 1;
+		if (location.row != last)
+		{
+			moveRow(chunk, last, location.row);
+			locations[chunk->entities[location.row]].row = location.row;
+		}
+		chunk->count--;
+
+		// and the last chunk gives up a row to keep every chunk but the last full
+		EntityChunk *tail = chunks.back();
+		if (tail != chunk && tail->count > 0)
+		{
+			unsigned int tailRow = tail->count - 1;
+			Entity moved = tail->entities[tailRow];
+			copyRow(tail, tailRow, chunk, chunk->count);
+			chunk->count++;
+			tail->count--;
+			locations[moved].chunk = location.chunk;
+			locations[moved].row = chunk->count - 1;
+		}
+		if (chunks.back()->count == 0)
+		{
+			delete chunks.back();
+			chunks.pop_back();
+		}
+
+		location.alive = false;
+		freeEntities.push_back(entity);
+	}
+
+	bool Alive(Entity entity) const
+	{
+		return entity < locations.size() && locations[entity].alive;
+	}
+
+	ComponentMask Mask(Entity entity) const
+	{
+		return archetypes[locations[entity].archetype].mask;
+	}
+
+	// single entity access, for setting an entity up or the odd lookup; loops should go through Query
+	Transform &GetTransform(Entity entity) { return chunkOf(entity)->transforms[locations[entity].row]; }
+	Renderable &GetRenderable(Entity entity) { return chunkOf(entity)->renderables[locations[entity].row]; }
+	Light &GetLight(Entity entity) { return chunkOf(entity)->lights[locations[entity].row]; }
+	Collider &GetCollider(Entity entity) { return chunkOf(entity)->colliders[locations[entity].row]; }
+
+	// every chunk whose archetype has all the components in mask, and possibly more
+	std::vector<EntityChunk*> Query(ComponentMask mask) const
+	{
+		std::vector<EntityChunk*> result;
+		for (unsigned int i = 0; i < archetypes.size(); i++)
+		{
+			if ((archetypes[i].mask & mask) != mask)
+				continue;
+			result.insert(result.end(), archetypes[i].chunks.begin(), archetypes[i].chunks.end());
+		}
+		return result;
+	}
+
+	unsigned int Count(ComponentMask mask) const
+	{
+		unsigned int count = 0;
+		std::vector<EntityChunk*> chunks = Query(mask);
+		for (unsigned int i = 0; i < chunks.size(); i++)
+			count += chunks[i]->count;
+		return count;
+	}
+
+	void Clear()
+	{
+		for (unsigned int i = 0; i < archetypes.size(); i++)
+		{
+			for (unsigned int j = 0; j < archetypes[i].chunks.size(); j++)
+				delete archetypes[i].chunks[j];
+		}
+		archetypes.clear();
+		locations.clear();
+		freeEntities.clear();
+	}
+
+private:
+	struct Archetype {
+		ComponentMask mask;
+		std::vector<EntityChunk*> chunks;
+	};
+
+	struct Location {
+		unsigned int archetype;
+		unsigned int chunk;
+		unsigned int row;
+		bool alive;
+	};
+
+	/*  Store data  */
+	std::vector<Archetype> archetypes;
+	std::vector<Location> locations;
+	std::vector<Entity> freeEntities;
+
+	EntityChunk *chunkOf(Entity entity)
+	{
+		const Location &location = locations[entity];
+		return archetypes[location.archetype].chunks[location.chunk];
+	}
+
+	unsigned int findArchetype(ComponentMask mask)
+	{
+		for (unsigned int i = 0; i < archetypes.size(); i++)
+		{
+			if (archetypes[i].mask == mask)
+				return i;
+		}
+		Archetype archetype;
+		archetype.mask = mask;
+		archetypes.push_back(archetype);
+		return archetypes.size() - 1;
+	}
+
+	static EntityChunk *createChunk(ComponentMask mask)
+	{
+		EntityChunk *chunk = new EntityChunk();
+		chunk->mask = mask;
+		chunk->count = 0;
+		chunk->entities.resize(ENTITY_CHUNK_CAPACITY);
+		if (mask & HAS_TRANSFORM)
+			chunk->transforms.resize(ENTITY_CHUNK_CAPACITY);
+		if (mask & HAS_RENDERABLE)
+			chunk->renderables.resize(ENTITY_CHUNK_CAPACITY);
+		if (mask & HAS_LIGHT)
+			chunk->lights.resize(ENTITY_CHUNK_CAPACITY);
+		if (mask & HAS_COLLIDER)
+			chunk->colliders.resize(ENTITY_CHUNK_CAPACITY);
+		return chunk;
+	}
+
+	static void copyRow(const EntityChunk *from, unsigned int fromRow, EntityChunk *to, unsigned int toRow)
+	{
+		to->entities[toRow] = from->entities[fromRow];
+		if (from->mask & HAS_TRANSFORM)
+			to->transforms[toRow] = from->transforms[fromRow];
+		if (from->mask & HAS_RENDERABLE)
+			to->renderables[toRow] = from->renderables[fromRow];
+		if (from->mask & HAS_LIGHT)
+			to->lights[toRow] = from->lights[fromRow];
+		if (from->mask & HAS_COLLIDER)
+			to->colliders[toRow] = from->colliders[fromRow];
+	}
+
+	static void moveRow(EntityChunk *chunk, unsigned int fromRow, unsigned int toRow)
+	{
+		copyRow(chunk, fromRow, chunk, toRow);
+	}
+};
+#endif
@@ -0,0 +1,158 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// frames in flight FramePacer allows when it's given no number, and the most it accepts
+const unsigned int FRAME_PACER_DEFAULT_FRAMES = 2;
+const unsigned int FRAME_PACER_MAX_FRAMES = 3;
+
+struct FramePacerStats {
+	unsigned int frames;
+	// CPU time blocked on the fence of an earlier frame, issuing the frame's GL calls, and in the swap
+	float waitMs;
+	float submitMs;
+	float swapMs;
+	// GPU time of the frames whose timer query has come back, and how many that is
+	float gpuMs;
+	unsigned int gpuFrames;
+};
+
+// Lets the render thread get at most a fixed number of frames ahead of the GPU. Every frame is fenced
+// once it has been swapped, and before the CPU starts issuing a frame it waits for the fence of the
+// frame that many frames back: with 1 the CPU and GPU take turns, lowest latency, while 2 or 3 let the
+// CPU build the next frames while the GPU is still drawing, for throughput at the cost of latency.
+// Without it how far ahead the CPU runs is up to the driver, which usually blocks in the swap.
+//
+// Each frame is timed on the GPU with a GL_TIME_ELAPSED query, read back only once its fence has been
+// waited on so the result is always there, and on the CPU as time to submit, time in the swap and time
+// spent blocked on a fence.
+class FramePacer
+{
+public:
+	/*  Functions  */
+	FramePacer() : frame(0), timing(false)
+	{
+		ResetStats();
+	}
+
+	// frames is clamped to 1..FRAME_PACER_MAX_FRAMES
+	void Create(unsigned int frames = FRAME_PACER_DEFAULT_FRAMES)
+	{
+		Release();
+		frames = std::max(1u, std::min(frames, FRAME_PACER_MAX_FRAMES));
+		fences.assign(frames, (GLsync)0);
+		queries.resize(frames);
+		glGenQueries(frames, &queries[0]);
+		pending.assign(frames, false);
+		frame = 0;
+	}
+
+	unsigned int FramesInFlight() const { return fences.size(); }
+
+	// call before issuing any GL for the frame, waits until the frame this one replaces has finished
+	void BeginFrame()
+	{
+		frame = (frame + 1) % fences.size();
+		start = std::chrono::high_resolution_clock::now();
+		if (fences[frame] != 0)
+		{
+			// 0 first so frames that are already done don't count as a wait at all
+			if (glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				while (glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+					std::cout << "ERROR::FRAME_PACER::Still waiting for the GPU after a second" << std::endl;
+			}
+			glDeleteSync(fences[frame]);
+			fences[frame] = 0;
+		}
+		if (pending[frame])
+		{
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[frame], GL_QUERY_RESULT, &elapsed);
+			stats.gpuMs += elapsed / 1000000.0f;
+			stats.gpuFrames++;
+			pending[frame] = false;
+		}
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		stats.waitMs += std::chrono::duration<float, std::milli>(now - start).count();
+		start = now;
+		glBeginQuery(GL_TIME_ELAPSED, queries[frame]);
+		timing = true;
+	}
+
+	// call once the frame's GL calls are issued, right before the swap
+	void EndSubmit()
+	{
+		if (timing)
+			glEndQuery(GL_TIME_ELAPSED);
+		pending[frame] = timing;
+		timing = false;
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		stats.submitMs += std::chrono::duration<float, std::milli>(now - start).count();
+		start = now;
+	}
+
+	// call after the swap, fences everything the frame issued
+	void EndFrame()
+	{
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stats.swapMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats.frames++;
+	}
+
+	FramePacerStats Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats.frames = 0;
+		stats.waitMs = 0.0f;
+		stats.submitMs = 0.0f;
+		stats.swapMs = 0.0f;
+		stats.gpuMs = 0.0f;
+		stats.gpuFrames = 0;
+	}
+
+	void PrintStats() const
+	{
+		if (stats.frames == 0)
+			return;
+		std::cout << "FRAME_TIME::" << fences.size() << " frames in flight, per frame: CPU submit " << stats.submitMs / stats.frames
+			<< "ms, swap " << stats.swapMs / stats.frames << "ms, blocked on the GPU " << stats.waitMs / stats.frames << "ms, GPU "
+			<< (stats.gpuFrames > 0 ? stats.gpuMs / stats.gpuFrames : 0.0f) << "ms" << std::endl;
+	}
+
+	void Release()
+	{
+		if (timing)
+			glEndQuery(GL_TIME_ELAPSED);
+		timing = false;
+		for (unsigned int i = 0; i < fences.size(); i++)
+		{
+			if (fences[i] != 0)
+				glDeleteSync(fences[i]);
+		}
+		if (!queries.empty())
+			glDeleteQueries(queries.size(), &queries[0]);
+		fences.clear();
+		queries.clear();
+		pending.clear();
+	}
+
+private:
+	/*  Pacing data  */
+	// a fence and a timer query per frame in flight, pending while the query's result hasn't been read
+	std::vector<GLsync> fences;
+	std::vector<GLuint> queries;
+	std::vector<bool> pending;
+	unsigned int frame;
+	bool timing;
+	std::chrono::high_resolution_clock::time_point start;
+	FramePacerStats stats;
+};
+#endif
@@ -0,0 +1,122 @@
+#ifndef FRAME_PACKET_H
+#define FRAME_PACKET_H
+
+#include <glm/glm.hpp>
+
+#include "command_buffer.h"
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+
+struct FrameLight {
+	glm::vec3 position;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+};
+
+// Everything the render thread needs to know about one frame, built by the main thread and left alone
+// once it has been submitted. The render thread never reads the camera, the window or the scene itself.
+struct FramePacket {
+	unsigned int frame = 0;
+	float time = 0.0f;
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 projection = glm::mat4(1.0f);
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	int framebufferWidth = 0;
+	int framebufferHeight = 0;
+	int texturePack = 1;
+	std::vector<FrameLight> lights;
+	// where the CPU culls, what it kept: a flag per static draw on the indirect path, and on the legacy
+	// path the draws themselves, recorded per room and material
+	std::vector<unsigned char> staticVisible;
+	std::vector<CommandBuffer> roomCommands;
+	// and the legacy path's nanosuits, unless they are recorded one by one, as a transform each per room
+	std::vector<std::vector<glm::mat4>> roomInstances;
+	// the skinning matrices of every animated instance, posed on the main thread, one instance after another
+	std::vector<glm::mat4> bones;
+	// the last packet, the render thread stops once it sees it
+	bool quit = false;
+};
+
+struct FrameQueueStats {
+	unsigned int frames;
+	// time the main thread spent waiting for the render thread to take a packet, and the render thread
+	// waiting for the next one to arrive
+	float submitWaitMs;
+	float acquireWaitMs;
+};
+
+// Hands frame packets from the main thread to the render thread. It holds a single packet, so the main
+// thread builds frame n + 1 while frame n is drawn and waits there if it gets any further ahead: one
+// frame of pipelining. Packets are swapped in and out rather than copied, so once both threads have had
+// one their vectors are reused instead of reallocated every frame.
+class FrameQueue
+{
+public:
+	/*  Functions  */
+	FrameQueue() : full(false)
+	{
+		ResetStats();
+	}
+
+	// hands the packet over, leaving the caller an old one to fill in next
+	void Submit(FramePacket &packet)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::unique_lock<std::mutex> lock(mutex);
+		taken.wait(lock, [&]() { return !full; });
+		stats.submitWaitMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::swap(slot, packet);
+		full = true;
+		stats.frames++;
+		lock.unlock();
+		submitted.notify_one();
+	}
+
+	// waits for the next packet and swaps it into packet
+	void Acquire(FramePacket &packet)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::unique_lock<std::mutex> lock(mutex);
+		submitted.wait(lock, [&]() { return full; });
+		stats.acquireWaitMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::swap(slot, packet);
+		full = false;
+		lock.unlock();
+		taken.notify_one();
+	}
+
+	FrameQueueStats Stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void ResetStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats = FrameQueueStats();
+	}
+
+	void PrintStats()
+	{
+		FrameQueueStats current = Stats();
+		if (current.frames == 0)
+			return;
+		std::cout << "FRAMES::" << current.frames << " packets, per frame the main thread waited " << current.submitWaitMs / current.frames
+			<< "ms for the render thread and the render thread " << current.acquireWaitMs / current.frames << "ms for a packet" << std::endl;
+	}
+
+private:
+	/*  Queue data  */
+	std::mutex mutex;
+	std::condition_variable submitted, taken;
+	FramePacket slot;
+	bool full;
+	FrameQueueStats stats;
+};
+#endif
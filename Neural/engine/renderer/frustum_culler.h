@@ -0,0 +1,231 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "job_system.h"
+#include "cpu_features.h"
+
+#include <vector>
+#include <algorithm>
+
+// the most boxes a SIMD step tests, the arrays are padded to a multiple of it whichever kernel runs
+#if CPU_SSE2
+#define FRUSTUM_CULLER_LANES 8
+#else
+#define FRUSTUM_CULLER_LANES 1
+#endif
+
+// boxes each job of a parallel cull tests, a multiple of every lane count
+const unsigned int FRUSTUM_CULLER_BATCH = 4096;
+
+// World space bounds of many objects kept as structure of arrays, one array per component of min and
+// max, and frustum culled a SIMD register of boxes at a time (8 where the CPU has AVX2, 4 with SSE2).
+// Each plane picks the box corner furthest along its normal from the sign of the normal, which is the
+// same for every lane, so a plane costs three multiplies, three adds and a compare per register. The arithmetic
+// and the comparison are the ones Frustum::Intersects does, so both always agree.
+//
+// With a JobSystem the boxes are split into batches that each write their own visible list, and the
+// lists are joined in batch order afterwards, so no two jobs ever touch the same output.
+class FrustumCuller
+{
+public:
+	/*  Functions  */
+	void Clear()
+	{
+		count = 0;
+		for (int i = 0; i < 6; i++)
+			bounds[i].clear();
+	}
+
+	// returns the index the box is culled as
+	unsigned int Add(const AABB &box)
+	{
+		Resize(count + 1);
+		Set(count - 1, box);
+		return count - 1;
+	}
+
+	// new boxes are empty and never visible until they are set
+	void Resize(unsigned int size)
+	{
+		count = size;
+		// padded to whole registers, the padding is masked off
+		unsigned int padded = (size + FRUSTUM_CULLER_LANES - 1) / FRUSTUM_CULLER_LANES * FRUSTUM_CULLER_LANES;
+		for (int i = 0; i < 3; i++)
+		{
+			bounds[i].resize(padded, FLT_MAX);
+			bounds[i + 3].resize(padded, -FLT_MAX);
+		}
+	}
+
+	void Set(unsigned int index, const AABB &box)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			bounds[i][index] = box.min[i];
+			bounds[i + 3][index] = box.max[i];
+		}
+	}
+
+	unsigned int Size() const { return count; }
+
+	// boxes the kernel tests a step on this CPU
+	static unsigned int Lanes()
+	{
+#if CPU_SSE2
+		return UseAVX2() ? 8 : 4;
+#else
+		return 1;
+#endif
+	}
+
+	// fills visible with the index of every box inside or touching the frustum, in ascending order
+	void Cull(const Frustum &frustum, std::vector<unsigned int> &visible, JobSystem *jobs = NULL)
+	{
+		visible.clear();
+		if (count == 0)
+			return;
+		if (jobs == NULL || count <= FRUSTUM_CULLER_BATCH)
+		{
+			cullRange(frustum, 0, count, visible);
+			return;
+		}
+
+		unsigned int batches = (count + FRUSTUM_CULLER_BATCH - 1) / FRUSTUM_CULLER_BATCH;
+		if (batchVisible.size() < batches)
+			batchVisible.resize(batches);
+		jobs->ParallelFor(batches, 1, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int batch = begin; batch < end; batch++)
+			{
+				batchVisible[batch].clear();
+				cullRange(frustum, batch * FRUSTUM_CULLER_BATCH, std::min((batch + 1) * FRUSTUM_CULLER_BATCH, count), batchVisible[batch]);
+			}
+		});
+		unsigned int total = 0;
+		for (unsigned int i = 0; i < batches; i++)
+			total += batchVisible[i].size();
+		visible.reserve(total);
+		for (unsigned int i = 0; i < batches; i++)
+			visible.insert(visible.end(), batchVisible[i].begin(), batchVisible[i].end());
+	}
+
+	// one box at a time through Frustum::Intersects, to check the kernel against
+	void CullReference(const Frustum &frustum, std::vector<unsigned int> &visible) const
+	{
+		visible.clear();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			AABB box;
+			box.min = glm::vec3(bounds[0][i], bounds[1][i], bounds[2][i]);
+			box.max = glm::vec3(bounds[3][i], bounds[4][i], bounds[5][i]);
+			if (frustum.Intersects(box))
+				visible.push_back(i);
+		}
+	}
+
+private:
+	/*  Culler data  */
+	unsigned int count = 0;
+	// min x, y, z then max x, y, z
+	std::vector<float> bounds[6];
+	std::vector<std::vector<unsigned int> > batchVisible;
+
+	// begin is a multiple of the lane count, end is either one too or the last box
+	void cullRange(const Frustum &frustum, unsigned int begin, unsigned int end, std::vector<unsigned int> &visible) const
+	{
+		// per plane, the arrays its furthest corner comes from
+		const float *corner[6][3];
+		for (int p = 0; p < 6; p++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+				corner[p][axis] = frustum.planes[p][axis] >= 0.0f ? &bounds[axis + 3][0] : &bounds[axis][0];
+		}
+
+#if CPU_AVX2
+		if (UseAVX2())
+		{
+			cullRange8(frustum, corner, begin, end, visible);
+			return;
+		}
+#endif
+#if CPU_SSE2
+		cullRange4(frustum, corner, begin, end, visible);
+#else
+		for (unsigned int i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				float distance = frustum.planes[p].x * corner[p][0][i];
+				distance += frustum.planes[p].y * corner[p][1][i];
+				distance += frustum.planes[p].z * corner[p][2][i];
+				distance += frustum.planes[p].w;
+				inside = !(distance < 0.0f);
+			}
+			if (inside)
+				visible.push_back(i);
+		}
+#endif
+	}
+
+#if CPU_AVX2
+	static CPU_AVX2_TARGET void cullRange8(const Frustum &frustum, const float *const corner[6][3], unsigned int begin, unsigned int end,
+		std::vector<unsigned int> &visible)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		for (unsigned int i = begin; i < end; i += 8)
+		{
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_mul_ps(_mm256_set1_ps(frustum.planes[p].x), _mm256_loadu_ps(corner[p][0] + i));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(frustum.planes[p].y), _mm256_loadu_ps(corner[p][1] + i)));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(frustum.planes[p].z), _mm256_loadu_ps(corner[p][2] + i)));
+				distance = _mm256_add_ps(distance, _mm256_set1_ps(frustum.planes[p].w));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_NLT_UQ));
+				// most registers are out past the first plane or two
+				if (_mm256_testz_ps(inside, inside))
+					break;
+			}
+			emit(_mm256_movemask_ps(inside), i, end, visible);
+		}
+	}
+#endif
+
+#if CPU_SSE2
+	static void cullRange4(const Frustum &frustum, const float *const corner[6][3], unsigned int begin, unsigned int end,
+		std::vector<unsigned int> &visible)
+	{
+		__m128 zero = _mm_setzero_ps();
+		for (unsigned int i = begin; i < end; i += 4)
+		{
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_mul_ps(_mm_set1_ps(frustum.planes[p].x), _mm_loadu_ps(corner[p][0] + i));
+				distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(frustum.planes[p].y), _mm_loadu_ps(corner[p][1] + i)));
+				distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(frustum.planes[p].z), _mm_loadu_ps(corner[p][2] + i)));
+				distance = _mm_add_ps(distance, _mm_set1_ps(frustum.planes[p].w));
+				inside = _mm_and_ps(inside, _mm_cmpnlt_ps(distance, zero));
+				// most registers are out past the first plane or two
+				if (_mm_movemask_ps(inside) == 0)
+					break;
+			}
+			emit(_mm_movemask_ps(inside), i, end, visible);
+		}
+	}
+#endif
+
+	// appends the lanes set in mask, leaving out the padding past end
+	static void emit(int mask, unsigned int first, unsigned int end, std::vector<unsigned int> &visible)
+	{
+		for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1)
+		{
+			if ((mask & 1) && first + lane < end)
+				visible.push_back(first + lane);
+		}
+	}
+};
+#endif
@@ -0,0 +1,400 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "bounds.h"
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <vector>
+#include <iostream>
+
+// A range handed out by the OffsetAllocator, in elements (vertices or indices), not bytes
+struct Allocation {
+	unsigned int offset = 0;
+	unsigned int size = 0;
+};
+
+struct AllocatorStats {
+	unsigned int capacity;
+	unsigned int used;
+	unsigned int allocations;
+	unsigned int freeBlocks;
+	unsigned int largestFreeBlock;
+	// 0 when all free space is one contiguous block, approaching 1 as it gets split up
+	float fragmentation;
+};
+
+// Best-fit offset allocator over a linear range. Freed blocks are merged with their
+// neighbours straight away so the free list never holds two adjacent blocks.
+class OffsetAllocator
+{
+public:
+	/*  Functions  */
+	OffsetAllocator(unsigned int capacity = 0) : capacity(0), used(0), allocations(0)
+	{
+		Grow(capacity);
+	}
+
+	// returns false when no free block is large enough, the caller is expected to Grow and retry
+	bool Allocate(unsigned int size, Allocation &out)
+	{
+		if (size == 0)
+		{
+			out = Allocation();
+			return true;
+		}
+		std::multimap<unsigned int, unsigned int>::iterator best = freeBySize.lower_bound(size);
+		if (best == freeBySize.end())
+			return false;
+
+		unsigned int blockSize = best->first;
+		unsigned int blockOffset = best->second;
+		removeFreeBlock(blockOffset, blockSize);
+		if (blockSize > size)
+			insertFreeBlock(blockOffset + size, blockSize - size);
+
+		out.offset = blockOffset;
+		out.size = size;
+		used += size;
+		allocations++;
+		return true;
+	}
+
+	void Free(const Allocation &allocation)
+	{
+		if (allocation.size == 0)
+			return;
+		unsigned int offset = allocation.offset;
+		unsigned int size = allocation.size;
+		used -= size;
+		allocations--;
+
+		// coalesce with the free block that ends where this one starts
+		std::map<unsigned int, unsigned int>::iterator next = freeByOffset.lower_bound(offset);
+		if (next != freeByOffset.begin())
+		{
+			std::map<unsigned int, unsigned int>::iterator prev = std::prev(next);
+			if (prev->first + prev->second == offset)
+			{
+				offset = prev->first;
+				size += prev->second;
+				removeFreeBlock(prev->first, prev->second);
+			}
+		}
+		// and with the one that starts where this one ends
+		next = freeByOffset.find(offset + size);
+		if (next != freeByOffset.end())
+		{
+			size += next->second;
+			removeFreeBlock(next->first, next->second);
+		}
+		insertFreeBlock(offset, size);
+	}
+
+	// extends the managed range, the new space joins the last free block if it touches the end
+	void Grow(unsigned int newCapacity)
+	{
+		if (newCapacity <= capacity)
+			return;
+		Allocation tail;
+		tail.offset = capacity;
+		tail.size = newCapacity - capacity;
+		capacity = newCapacity;
+		// hand the tail to Free so it gets merged like any other released block
+		used += tail.size;
+		allocations++;
+		Free(tail);
+	}
+
+	unsigned int Capacity() const { return capacity; }
+
+	AllocatorStats GetStats() const
+	{
+		AllocatorStats stats;
+		stats.capacity = capacity;
+		stats.used = used;
+		stats.allocations = allocations;
+		stats.freeBlocks = (unsigned int)freeByOffset.size();
+		stats.largestFreeBlock = freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+		unsigned int freeSpace = capacity - used;
+		stats.fragmentation = freeSpace == 0 ? 0.0f : 1.0f - (float)stats.largestFreeBlock / (float)freeSpace;
+		return stats;
+	}
+
+private:
+	/*  Allocator Data  */
+	std::map<unsigned int, unsigned int> freeByOffset;		// offset -> size, ordered so neighbours can be found
+	std::multimap<unsigned int, unsigned int> freeBySize;	// size -> offset, ordered for best-fit lookups
+	unsigned int capacity;
+	unsigned int used;
+	unsigned int allocations;
+
+	void insertFreeBlock(unsigned int offset, unsigned int size)
+	{
+		freeByOffset[offset] = size;
+		freeBySize.insert(std::make_pair(size, offset));
+	}
+
+	void removeFreeBlock(unsigned int offset, unsigned int size)
+	{
+		freeByOffset.erase(offset);
+		std::pair<std::multimap<unsigned int, unsigned int>::iterator, std::multimap<unsigned int, unsigned int>::iterator> range = freeBySize.equal_range(size);
+		for (std::multimap<unsigned int, unsigned int>::iterator it = range.first; it != range.second; ++it)
+		{
+			if (it->second == offset)
+			{
+				freeBySize.erase(it);
+				break;
+			}
+		}
+	}
+};
+
+struct VertexAttribute {
+	GLuint location;
+	GLint size;
+	GLenum type;
+	size_t offset;
+	// read as integers rather than floats, or as normalised fixed point
+	bool integer = false;
+	bool normalized = false;
+};
+
+// A per-instance attribute sourced from its own buffer, e.g. the draw index used by indirect draws
+struct InstanceAttribute {
+	GLuint location;
+	GLuint buffer;
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	size_t offset;
+	bool integer;
+	GLuint divisor;
+};
+
+// Where a mesh or primitive lives inside a GeometryBuffer
+struct GeometryRange {
+	Allocation vertices;
+	Allocation indices;
+	// local space bounds of the vertices, for culling
+	AABB bounds;
+
+	GLint BaseVertex() const { return (GLint)vertices.offset; }
+	unsigned int FirstIndex() const { return indices.offset; }
+	unsigned int IndexCount() const { return indices.size; }
+};
+
+// One vertex buffer, one index buffer and one VAO for every piece of geometry that shares a
+// vertex format. Indices are stored relative to their own range and drawn with glDrawElementsBaseVertex,
+// so the VAO only needs binding once no matter how many meshes are drawn.
+class GeometryBuffer
+{
+public:
+	unsigned int VAO;
+
+	/*  Functions  */
+	GeometryBuffer(GLsizei vertexStride, const std::vector<VertexAttribute> &attributes, unsigned int vertexCapacity = 1 << 16, unsigned int indexCapacity = 1 << 18)
+		: stride(vertexStride), attributes(attributes), vertexAllocator(vertexCapacity), indexAllocator(indexCapacity)
+	{
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCapacity * stride, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		// size the index buffer through a binding point that isn't VAO state
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		setupVertexArray();
+	}
+
+	// copies the vertices and indices into free ranges of the shared buffers, growing them if needed. The
+	// bounds are worked out from the positions unless they are already known
+	GeometryRange Upload(const void *vertexData, unsigned int vertexCount, const unsigned int *indexData, unsigned int indexCount, const AABB *bounds = NULL)
+	{
+		GeometryRange range;
+		while (!vertexAllocator.Allocate(vertexCount, range.vertices))
+			growVertices(vertexAllocator.Capacity() * 2 + vertexCount);
+		while (!indexAllocator.Allocate(indexCount, range.indices))
+			growIndices(indexAllocator.Capacity() * 2 + indexCount);
+
+		// the first attribute is taken to be the float3 position
+		const unsigned char *vertexBytes = (const unsigned char*)vertexData;
+		if (bounds != NULL)
+			range.bounds = *bounds;
+		for (unsigned int i = 0; i < vertexCount && bounds == NULL; i++)
+		{
+			const float *position = (const float*)(vertexBytes + i * stride + attributes[0].offset);
+			range.bounds.Expand(glm::vec3(position[0], position[1], position[2]));
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)range.vertices.offset * stride, (GLsizeiptr)vertexCount * stride, vertexData);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// the element buffer binding is VAO state, so update it through the copy binding instead
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)range.indices.offset * sizeof(unsigned int), (GLsizeiptr)indexCount * sizeof(unsigned int), indexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		return range;
+	}
+
+	// returns the range to the allocators, the buffer contents are left as they are
+	void Free(GeometryRange &range)
+	{
+		vertexAllocator.Free(range.vertices);
+		indexAllocator.Free(range.indices);
+		range = GeometryRange();
+	}
+
+	// adds an instanced attribute to the shared VAO, replacing any earlier one at the same location
+	void SetInstanceAttribute(const InstanceAttribute &attribute)
+	{
+		for (unsigned int i = 0; i < instanceAttributes.size(); i++)
+		{
+			if (instanceAttributes[i].location == attribute.location)
+			{
+				instanceAttributes.erase(instanceAttributes.begin() + i);
+				break;
+			}
+		}
+		instanceAttributes.push_back(attribute);
+		setupVertexArray();
+	}
+
+	// points instanced attributes already added at another buffer or offset, without setting up the rest
+	// of the VAO again. Leaves the VAO bound, ready to draw from
+	void MoveInstanceAttributes(const InstanceAttribute *moved, unsigned int count)
+	{
+		glBindVertexArray(VAO);
+		for (unsigned int m = 0; m < count; m++)
+		{
+			const InstanceAttribute &attribute = moved[m];
+			for (unsigned int i = 0; i < instanceAttributes.size(); i++)
+			{
+				if (instanceAttributes[i].location == attribute.location)
+					instanceAttributes[i] = attribute;
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+			if (attribute.integer)
+				glVertexAttribIPointer(attribute.location, attribute.size, attribute.type, attribute.stride, (void*)attribute.offset);
+			else
+				glVertexAttribPointer(attribute.location, attribute.size, attribute.type, GL_FALSE, attribute.stride, (void*)attribute.offset);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void Bind()
+	{
+		glBindVertexArray(VAO);
+	}
+
+	// expects the VAO to be bound already
+	void Draw(const GeometryRange &range, GLenum mode = GL_TRIANGLES)
+	{
+		glDrawElementsBaseVertex(mode, range.IndexCount(), GL_UNSIGNED_INT, (void*)(range.FirstIndex() * sizeof(unsigned int)), range.BaseVertex());
+	}
+
+	// the range instances times over, each instance reading its own element of the instanced attributes
+	void DrawInstanced(const GeometryRange &range, unsigned int instances, GLenum mode = GL_TRIANGLES)
+	{
+		glDrawElementsInstancedBaseVertex(mode, range.IndexCount(), GL_UNSIGNED_INT, (void*)(range.FirstIndex() * sizeof(unsigned int)), instances, range.BaseVertex());
+	}
+
+	AllocatorStats VertexStats() const { return vertexAllocator.GetStats(); }
+	AllocatorStats IndexStats() const { return indexAllocator.GetStats(); }
+
+	void PrintStats() const
+	{
+		printStats("vertices", VertexStats());
+		printStats("indices", IndexStats());
+	}
+
+	void Release()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+	}
+
+private:
+	/*  Render data  */
+	unsigned int VBO, EBO;
+	GLsizei stride;
+	std::vector<VertexAttribute> attributes;
+	std::vector<InstanceAttribute> instanceAttributes;
+	OffsetAllocator vertexAllocator;
+	OffsetAllocator indexAllocator;
+
+	void setupVertexArray()
+	{
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		for (unsigned int i = 0; i < attributes.size(); i++)
+		{
+			glEnableVertexAttribArray(attributes[i].location);
+			if (attributes[i].integer)
+				glVertexAttribIPointer(attributes[i].location, attributes[i].size, attributes[i].type, stride, (void*)attributes[i].offset);
+			else
+				glVertexAttribPointer(attributes[i].location, attributes[i].size, attributes[i].type, attributes[i].normalized ? GL_TRUE : GL_FALSE, stride, (void*)attributes[i].offset);
+		}
+		for (unsigned int i = 0; i < instanceAttributes.size(); i++)
+		{
+			const InstanceAttribute &attribute = instanceAttributes[i];
+			glBindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+			glEnableVertexAttribArray(attribute.location);
+			if (attribute.integer)
+				glVertexAttribIPointer(attribute.location, attribute.size, attribute.type, attribute.stride, (void*)attribute.offset);
+			else
+				glVertexAttribPointer(attribute.location, attribute.size, attribute.type, GL_FALSE, attribute.stride, (void*)attribute.offset);
+			glVertexAttribDivisor(attribute.location, attribute.divisor);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// allocates a bigger buffer, copies the old contents across on the GPU and swaps it in
+	unsigned int resizeBuffer(unsigned int buffer, GLsizeiptr oldSize, GLsizeiptr newSize)
+	{
+		unsigned int newBuffer;
+		glGenBuffers(1, &newBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+		return newBuffer;
+	}
+
+	void growVertices(unsigned int newCapacity)
+	{
+		VBO = resizeBuffer(VBO, (GLsizeiptr)vertexAllocator.Capacity() * stride, (GLsizeiptr)newCapacity * stride);
+		vertexAllocator.Grow(newCapacity);
+		setupVertexArray();
+	}
+
+	void growIndices(unsigned int newCapacity)
+	{
+		EBO = resizeBuffer(EBO, (GLsizeiptr)indexAllocator.Capacity() * sizeof(unsigned int), (GLsizeiptr)newCapacity * sizeof(unsigned int));
+		indexAllocator.Grow(newCapacity);
+		setupVertexArray();
+	}
+
+	static void printStats(const char *name, const AllocatorStats &stats)
+	{
+		std::cout << "GEOMETRY::" << name << " used " << stats.used << "/" << stats.capacity
+			<< " in " << stats.allocations << " allocations, " << stats.freeBlocks << " free blocks (largest "
+			<< stats.largestFreeBlock << "), fragmentation " << stats.fragmentation * 100.0f << "%" << std::endl;
+	}
+};
+#endif
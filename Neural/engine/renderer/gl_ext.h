@@ -0,0 +1,142 @@
+#ifndef GL_EXT_H
+#define GL_EXT_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+// The bundled glad loader only covers GL 3.3 core, so the newer entry points the renderer can
+// take advantage of are fetched here at runtime. Every feature is optional; callers check the
+// matching flag in GLExt and keep a 3.3 path for when it is missing.
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT
+#define GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT 0x919F
+#endif
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS 0x821D
+#endif
+
+typedef void (APIENTRYP GL_MULTIDRAWELEMENTSINDIRECT) (GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP GL_MULTIDRAWELEMENTSINDIRECTCOUNT) (GLenum mode, GLenum type, const void *indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+typedef void (APIENTRYP GL_DISPATCHCOMPUTE) (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP GL_MEMORYBARRIER) (GLbitfield barriers);
+typedef void (APIENTRYP GL_BUFFERSTORAGE) (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP GL_TEXBUFFERRANGE) (GLenum target, GLenum internalformat, GLuint buffer, GLintptr offset, GLsizeiptr size);
+typedef void (APIENTRYP GL_BINDIMAGETEXTURE) (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+
+struct GLExtensions {
+	int major = 3;
+	int minor = 3;
+
+	// GL 4.3: glMultiDrawElementsIndirect plus shader storage buffers for the per-draw data
+	bool multiDrawIndirect = false;
+	// GL 4.3 compute shaders, with image load/store
+	bool compute = false;
+	// GL 4.6 or ARB_indirect_parameters: the draw count can come from a GPU buffer
+	bool indirectCount = false;
+	// GL 4.4 or ARB_buffer_storage: immutable buffers that can stay mapped while the GPU reads them
+	bool bufferStorage = false;
+	// GL 4.3 or ARB_texture_buffer_range: a buffer texture over part of a buffer
+	bool textureBufferRange = false;
+
+	GL_MULTIDRAWELEMENTSINDIRECT MultiDrawElementsIndirect = NULL;
+	GL_MULTIDRAWELEMENTSINDIRECTCOUNT MultiDrawElementsIndirectCount = NULL;
+	GL_DISPATCHCOMPUTE DispatchCompute = NULL;
+	GL_MEMORYBARRIER MemBarrier = NULL;
+	GL_BINDIMAGETEXTURE BindImageTexture = NULL;
+	GL_BUFFERSTORAGE BufferStorage = NULL;
+	GL_TEXBUFFERRANGE TexBufferRange = NULL;
+
+	bool AtLeast(int wantMajor, int wantMinor) const
+	{
+		return major > wantMajor || (major == wantMajor && minor >= wantMinor);
+	}
+};
+
+// defined once, in main.cpp
+extern GLExtensions GLExt;
+
+inline bool HasGLExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && std::strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+// call once after gladLoadGLLoader, with the same loader
+inline void LoadGLExtensions(GLADloadproc load)
+{
+	glGetIntegerv(GL_MAJOR_VERSION, &GLExt.major);
+	glGetIntegerv(GL_MINOR_VERSION, &GLExt.minor);
+
+	GLExt.MultiDrawElementsIndirect = (GL_MULTIDRAWELEMENTSINDIRECT)load("glMultiDrawElementsIndirect");
+	// the indirect shaders are #version 430, so the extensions alone on an older context aren't enough
+	GLExt.multiDrawIndirect = GLExt.AtLeast(4, 3) && GLExt.MultiDrawElementsIndirect != NULL;
+
+	GLExt.DispatchCompute = (GL_DISPATCHCOMPUTE)load("glDispatchCompute");
+	GLExt.MemBarrier = (GL_MEMORYBARRIER)load("glMemoryBarrier");
+	GLExt.BindImageTexture = (GL_BINDIMAGETEXTURE)load("glBindImageTexture");
+	GLExt.compute = GLExt.AtLeast(4, 3) && GLExt.DispatchCompute != NULL && GLExt.MemBarrier != NULL && GLExt.BindImageTexture != NULL;
+
+	if (GLExt.AtLeast(4, 6))
+		GLExt.MultiDrawElementsIndirectCount = (GL_MULTIDRAWELEMENTSINDIRECTCOUNT)load("glMultiDrawElementsIndirectCount");
+	else if (HasGLExtension("GL_ARB_indirect_parameters"))
+		GLExt.MultiDrawElementsIndirectCount = (GL_MULTIDRAWELEMENTSINDIRECTCOUNT)load("glMultiDrawElementsIndirectCountARB");
+	GLExt.indirectCount = GLExt.multiDrawIndirect && GLExt.MultiDrawElementsIndirectCount != NULL;
+
+	if (GLExt.AtLeast(4, 4) || HasGLExtension("GL_ARB_buffer_storage"))
+		GLExt.BufferStorage = (GL_BUFFERSTORAGE)load("glBufferStorage");
+	GLExt.bufferStorage = GLExt.BufferStorage != NULL;
+
+	if (GLExt.AtLeast(4, 3) || HasGLExtension("GL_ARB_texture_buffer_range"))
+		GLExt.TexBufferRange = (GL_TEXBUFFERRANGE)load("glTexBufferRange");
+	GLExt.textureBufferRange = GLExt.TexBufferRange != NULL;
+
+	std::cout << "GL::VERSION " << GLExt.major << "." << GLExt.minor
+		<< (GLExt.multiDrawIndirect ? ", multi-draw indirect" : "")
+		<< (GLExt.compute ? ", compute" : "")
+		<< (GLExt.indirectCount ? ", indirect count" : "")
+		<< (GLExt.bufferStorage ? ", buffer storage" : "")
+		<< (GLExt.textureBufferRange ? ", texture buffer range" : "") << std::endl;
+}
+#endif
@@ -0,0 +1,326 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_ext.h"
+#include "bounds.h"
+#include "compute_shader.h"
+#include "indirect_draw.h"
+#include "hiz_pyramid.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+
+// per-draw culling input, laid out to match the std430 CullBounds struct in 8.1.frustum_cull.cs
+struct CullBounds {
+	glm::vec3 boundsMin;
+	GLuint pass;
+	glm::vec3 boundsMax;
+	GLuint firstCommand;
+};
+
+// running totals of the culling passes since the last reset, draws counts every draw tested in the first pass
+struct CullingStats {
+	unsigned int frames;
+	unsigned int draws;
+	unsigned int frustumCulled;
+	// hidden by last frame's pyramid in the first pass, disoccluded is the part of those the second pass drew
+	unsigned int occlusionCulled;
+	unsigned int disoccluded;
+};
+
+// Frustum culls an IndirectDrawList on the GPU. A compute pass tests every draw's bounds and writes the
+// surviving commands, packed per pass, into a second command buffer with an atomic counter per pass; the
+// counters are then fed straight back to glMultiDrawElementsIndirectCount so the CPU never sees the
+// visible set. Without indirect count support the commands stay in place and culled ones get
+// instanceCount 0 instead. Without compute support DrawPass just forwards to the unculled list.
+//
+// With a HiZPyramid attached the first pass also drops draws hidden behind last frame's depth. Once the
+// first pass is drawn, CullDisoccluded rebuilds the pyramid from it and retests just the draws that were
+// dropped that way, so anything that came into view since last frame is drawn in a second pass instead
+// of popping in a frame late.
+class GpuCuller
+{
+public:
+	/*  Functions  */
+	GpuCuller() : list(NULL), shader(NULL), pyramid(NULL), enabled(false), compact(false), phase(0), boundsBuffer(0), stateBuffer(0), statsBuffer(0), frames(0)
+	{
+		outputBuffers[0] = outputBuffers[1] = 0;
+		countBuffers[0] = countBuffers[1] = 0;
+	}
+
+	// uploads the bounds of every draw in the list, returns false when the GPU can't cull or compute is
+	// false, in which case DrawPass draws the list as it is
+	bool Build(IndirectDrawList &drawList, bool compute = true)
+	{
+		list = &drawList;
+		if (!compute || !GLExt.compute || !GLExt.multiDrawIndirect)
+			return false;
+
+		if (shader == NULL)
+		{
+			shader = new ComputeShader("resources/shaders/8.1.frustum_cull.cs");
+			glGenBuffers(1, &boundsBuffer);
+			glGenBuffers(2, outputBuffers);
+			glGenBuffers(2, countBuffers);
+			glGenBuffers(1, &stateBuffer);
+			glGenBuffers(1, &statsBuffer);
+		}
+		compact = GLExt.indirectCount;
+
+		std::vector<CullBounds> cullBounds(list->bounds.size());
+		for (unsigned int i = 0; i < cullBounds.size(); i++)
+		{
+			cullBounds[i].boundsMin = list->bounds[i].min;
+			cullBounds[i].boundsMax = list->bounds[i].max;
+			cullBounds[i].pass = list->drawPasses[i];
+			cullBounds[i].firstCommand = list->passes[list->drawPasses[i]].firstCommand;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, cullBounds.size() * sizeof(CullBounds), cullBounds.empty() ? NULL : &cullBounds[0], GL_STATIC_DRAW);
+		// each pass gets its own output so the second one never writes commands the first is still drawing
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, outputBuffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, list->commands.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, list->passes.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, list->commands.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		zeroCounts.assign(list->passes.size(), 0);
+		ResetStats();
+
+		enabled = true;
+		return true;
+	}
+
+	bool Enabled() const { return enabled; }
+	bool Compacting() const { return compact; }
+	// true when the frame needs the second pass, see CullDisoccluded
+	bool Occluding() const { return enabled && pyramid != NULL; }
+
+	// compaction is on by default wherever indirect count is supported, turning it off keeps culled
+	// commands in place with instanceCount 0
+	void SetCompaction(bool enable)
+	{
+		compact = enable && GLExt.indirectCount;
+	}
+
+	// turns occlusion culling on against the given pyramid, or off with NULL
+	void SetOcclusion(HiZPyramid *depthPyramid)
+	{
+		pyramid = depthPyramid;
+	}
+
+	// runs the first culling pass for this frame, the draw calls after it wait on the barrier
+	void Cull(const glm::mat4 &viewProjection)
+	{
+		if (!enabled || list->commands.empty())
+			return;
+		this->viewProjection = viewProjection;
+		dispatch(0, Frustum(viewProjection), pyramid != NULL && pyramid->Valid());
+		frames++;
+	}
+
+	// call once the first pass is drawn: rebuilds the pyramid from its depth, which also serves as last
+	// frame's for the next Cull, and culls the second pass from the draws the first one hid
+	void CullDisoccluded()
+	{
+		if (!Occluding() || list->commands.empty())
+			return;
+		pyramid->Build();
+		pyramidViewProjection = viewProjection;
+		dispatch(1, Frustum(viewProjection), pyramid->Valid());
+	}
+
+	// draws whatever survived culling in one pass of the list, for the culling pass that ran last
+	void DrawPass(unsigned int pass, GLenum mode = GL_TRIANGLES)
+	{
+		if (!enabled)
+		{
+			list->DrawPass(pass, mode);
+			return;
+		}
+		const IndirectPass &p = list->passes[pass];
+		if (p.commandCount == 0)
+			return;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, outputBuffers[phase]);
+		if (compact)
+		{
+			glBindBuffer(GL_PARAMETER_BUFFER, countBuffers[phase]);
+			GLExt.MultiDrawElementsIndirectCount(mode, GL_UNSIGNED_INT, (void*)(p.firstCommand * sizeof(DrawElementsIndirectCommand)), (GLintptr)(pass * sizeof(GLuint)), p.commandCount, 0);
+		}
+		else
+			GLExt.MultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (void*)(p.firstCommand * sizeof(DrawElementsIndirectCommand)), p.commandCount, 0);
+	}
+
+	// reads the result of the last culling pass back and returns the indices of the draws that survived.
+	// Stalls on the GPU, only meant for validation.
+	std::vector<unsigned int> ReadVisible()
+	{
+		std::vector<unsigned int> visible;
+		if (!enabled || list->commands.empty())
+			return visible;
+		GLExt.MemBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		std::vector<GLuint> counts(list->passes.size());
+		std::vector<DrawElementsIndirectCommand> commands(list->commands.size());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffers[phase]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counts.size() * sizeof(GLuint), &counts[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, outputBuffers[phase]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		for (unsigned int pass = 0; pass < list->passes.size(); pass++)
+		{
+			const IndirectPass &p = list->passes[pass];
+			for (unsigned int i = 0; i < p.commandCount; i++)
+			{
+				const DrawElementsIndirectCommand &command = commands[p.firstCommand + i];
+				if (compact ? i < counts[pass] : command.instanceCount > 0)
+					visible.push_back(command.baseInstance);
+			}
+		}
+		std::sort(visible.begin(), visible.end());
+		return visible;
+	}
+
+	// frustum culls on the GPU and with the CPU reference test, returns the number of draws they disagree
+	// on. Occlusion is left out, it depends on what was rendered before.
+	unsigned int Validate(const glm::mat4 &viewProjection)
+	{
+		Frustum frustum(viewProjection);
+		if (!enabled || list->commands.empty())
+			return 0;
+		dispatch(0, frustum, false);
+		std::vector<unsigned int> gpuVisible = ReadVisible();
+
+		std::vector<unsigned int> cpuVisible;
+		for (unsigned int i = 0; i < list->bounds.size(); i++)
+		{
+			if (frustum.Intersects(list->bounds[i]))
+				cpuVisible.push_back(i);
+		}
+
+		std::vector<unsigned int> mismatches;
+		std::set_symmetric_difference(gpuVisible.begin(), gpuVisible.end(), cpuVisible.begin(), cpuVisible.end(), std::back_inserter(mismatches));
+		for (unsigned int i = 0; i < mismatches.size() && i < 8; i++)
+			std::cout << "ERROR::CULLING::draw " << mismatches[i] << " is " << (std::binary_search(cpuVisible.begin(), cpuVisible.end(), mismatches[i]) ? "visible" : "culled") << " on the CPU but not on the GPU" << std::endl;
+		return mismatches.size();
+	}
+
+	// reads the GPU counters back, which waits for the culling passes in flight
+	CullingStats Stats()
+	{
+		CullingStats stats = {};
+		stats.frames = frames;
+		if (!enabled)
+			return stats;
+		stats.draws = frames * list->commands.size();
+		GLuint counters[3];
+		GLExt.MemBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		stats.frustumCulled = counters[0];
+		stats.occlusionCulled = counters[1];
+		stats.disoccluded = counters[2];
+		return stats;
+	}
+
+	void ResetStats()
+	{
+		frames = 0;
+		if (statsBuffer == 0)
+			return;
+		GLuint counters[3] = { 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(counters), counters, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void PrintStats()
+	{
+		CullingStats stats = Stats();
+		if (stats.draws == 0)
+			return;
+		float scale = 100.0f / stats.draws;
+		std::cout << "CULLING::" << stats.frames << " frames, " << stats.draws / stats.frames << " draws: "
+			<< stats.frustumCulled * scale << "% outside the frustum, "
+			<< (stats.occlusionCulled - stats.disoccluded) * scale << "% occluded, "
+			<< stats.disoccluded * scale << "% drawn late after disocclusion" << std::endl;
+	}
+
+	void Release()
+	{
+		if (shader != NULL)
+		{
+			glDeleteProgram(shader->ID);
+			delete shader;
+			shader = NULL;
+		}
+		glDeleteBuffers(1, &boundsBuffer);
+		glDeleteBuffers(2, outputBuffers);
+		glDeleteBuffers(2, countBuffers);
+		glDeleteBuffers(1, &stateBuffer);
+		glDeleteBuffers(1, &statsBuffer);
+		boundsBuffer = stateBuffer = statsBuffer = 0;
+		outputBuffers[0] = outputBuffers[1] = 0;
+		countBuffers[0] = countBuffers[1] = 0;
+		enabled = false;
+	}
+
+private:
+	/*  Culling data  */
+	IndirectDrawList *list;
+	ComputeShader *shader;
+	HiZPyramid *pyramid;
+	bool enabled;
+	bool compact;
+	// which culling pass DrawPass draws the result of
+	int phase;
+	unsigned int boundsBuffer, stateBuffer, statsBuffer;
+	unsigned int outputBuffers[2], countBuffers[2];
+	std::vector<GLuint> zeroCounts;
+	glm::mat4 viewProjection, pyramidViewProjection;
+	unsigned int frames;
+
+	void dispatch(int cullPhase, const Frustum &frustum, bool occlusion)
+	{
+		phase = cullPhase;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffers[phase]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, zeroCounts.size() * sizeof(GLuint), &zeroCounts[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		shader->use();
+		glUniform4fv(glGetUniformLocation(shader->ID, "frustumPlanes"), 6, glm::value_ptr(frustum.planes[0]));
+		shader->setUint("commandCount", list->commands.size());
+		shader->setBool("compact", compact);
+		shader->setInt("phase", phase);
+		shader->setBool("occlusion", occlusion);
+		if (occlusion)
+		{
+			pyramid->Bind();
+			shader->setInt("depthPyramid", HIZ_TEXTURE_UNIT);
+			shader->setInt("pyramidLevels", pyramid->Levels());
+			shader->setMat4("pyramidViewProjection", pyramidViewProjection);
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, list->CommandBuffer());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, boundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, outputBuffers[phase]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, countBuffers[phase]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, stateBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, statsBuffer);
+		shader->dispatch(list->commands.size(), 64);
+		GLExt.MemBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+};
+#endif
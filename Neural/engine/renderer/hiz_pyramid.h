@@ -0,0 +1,132 @@
+#ifndef HIZ_PYRAMID_H
+#define HIZ_PYRAMID_H
+
+#include <glad/glad.h>
+
+#include "gl_ext.h"
+#include "compute_shader.h"
+
+// texture unit the culling shader reads the pyramid from, well clear of the material units
+const GLuint HIZ_TEXTURE_UNIT = 15;
+
+// Hierarchical depth buffer. Build copies the depth of whatever has been drawn to the default framebuffer
+// so far and reduces it into a mip chain of R32F levels, each texel holding the furthest depth of the
+// texels it covers. A box whose nearest depth is behind every texel under its screen rectangle is hidden.
+// Odd sized levels fold their last row and column into the last texel of the next level, so a texel
+// always covers at least its 2^level block of pixels. Needs GLExt.compute.
+class HiZPyramid
+{
+public:
+	/*  Functions  */
+	HiZPyramid() : shader(NULL), depthTexture(0), pyramidTexture(0), width(0), height(0), levels(0), valid(false)
+	{
+	}
+
+	// matches the pyramid to the framebuffer size, the contents are invalid until the next Build
+	void Resize(int newWidth, int newHeight)
+	{
+		if (newWidth == width && newHeight == height)
+			return;
+		release();
+		width = newWidth;
+		height = newHeight;
+		if (width <= 0 || height <= 0)
+			return;
+
+		if (shader == NULL)
+			shader = new ComputeShader("resources/shaders/8.2.hiz_downsample.cs");
+
+		levels = 1;
+		while ((width >> levels) > 0 || (height >> levels) > 0)
+			levels++;
+
+		glGenTextures(1, &depthTexture);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+		glGenTextures(1, &pyramidTexture);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		for (int level = 0; level < levels; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelSize(width, level), levelSize(height, level), 0, GL_RED, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// rebuilds every level from the current depth buffer of the default framebuffer
+	void Build()
+	{
+		if (pyramidTexture == 0)
+			return;
+
+		glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+		shader->use();
+		shader->setInt("source", HIZ_TEXTURE_UNIT);
+		for (int level = 0; level < levels; level++)
+		{
+			// level 0 is a straight copy of the depth texture, every other level reduces the one above it
+			if (level == 1)
+				glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+			shader->setInt("sourceLevel", level == 0 ? 0 : level - 1);
+			shader->setBool("downsample", level > 0);
+			GLExt.BindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			GLExt.DispatchCompute((levelSize(width, level) + 7) / 8, (levelSize(height, level) + 7) / 8, 1);
+			GLExt.MemBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		valid = true;
+	}
+
+	// binds the pyramid for the culling shader
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	bool Valid() const { return valid; }
+	int Levels() const { return levels; }
+
+	void Release()
+	{
+		release();
+		width = height = 0;
+		if (shader != NULL)
+		{
+			glDeleteProgram(shader->ID);
+			delete shader;
+			shader = NULL;
+		}
+	}
+
+private:
+	/*  Pyramid data  */
+	ComputeShader *shader;
+	unsigned int depthTexture, pyramidTexture;
+	int width, height, levels;
+	bool valid;
+
+	static int levelSize(int size, int level)
+	{
+		return (size >> level) > 0 ? size >> level : 1;
+	}
+
+	void release()
+	{
+		glDeleteTextures(1, &depthTexture);
+		glDeleteTextures(1, &pyramidTexture);
+		depthTexture = pyramidTexture = 0;
+		levels = 0;
+		valid = false;
+	}
+};
+#endif
@@ -0,0 +1,218 @@
+#ifndef INDIRECT_DRAW_H
+#define INDIRECT_DRAW_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gl_ext.h"
+#include "geometry_buffer.h"
+#include "bounds.h"
+#include "transform.h"
+#include "ring_buffer.h"
+
+#include <vector>
+#include <cstring>
+
+// attribute location the indirect shaders read their draw index from
+const GLuint DRAW_ID_LOCATION = 5;
+// shader storage binding of the per-draw data
+const GLuint DRAW_DATA_BINDING = 0;
+
+// layout fixed by the GL spec for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// per-draw data, laid out to match the std430 DrawData struct in the indirect shaders
+struct DrawData {
+	glm::mat4 model;
+	// the normal matrix, std430 pads each mat3 column out to a vec4
+	glm::vec4 normal[3];
+	GLuint material;
+	GLuint padding[3];
+};
+
+// a run of commands that is submitted together with one glMultiDrawElementsIndirect
+struct IndirectPass {
+	unsigned int firstCommand;
+	unsigned int commandCount;
+};
+
+// Collects draws of ranges from the shared GeometryBuffer into indirect commands plus a shader storage
+// buffer of per-draw data. Every command's baseInstance is its own draw index, which reaches the shader
+// through an instanced attribute, so this needs neither gl_DrawID nor ARB_shader_draw_parameters.
+class IndirectDrawList
+{
+public:
+	/*  Draw Data  */
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawData> draws;
+	std::vector<IndirectPass> passes;
+	// world space bounds and owning pass of every draw, for culling
+	std::vector<AABB> bounds;
+	std::vector<unsigned int> drawPasses;
+
+	/*  Functions  */
+	IndirectDrawList() : commandBuffer(0), drawDataBuffer(0), drawIdBuffer(0), drawIdCapacity(0), drawBuffer(0), drawOffset(0)
+	{
+	}
+
+	void Clear()
+	{
+		commands.clear();
+		draws.clear();
+		passes.clear();
+		bounds.clear();
+		drawPasses.clear();
+	}
+
+	// starts a new pass, every draw added until the next BeginPass is part of it
+	unsigned int BeginPass()
+	{
+		IndirectPass pass;
+		pass.firstCommand = commands.size();
+		pass.commandCount = 0;
+		passes.push_back(pass);
+		return passes.size() - 1;
+	}
+
+	void Add(const GeometryRange &range, const glm::mat4 &model, unsigned int material)
+	{
+		add(range, model, glm::transpose(glm::inverse(glm::mat3(model))), material);
+	}
+
+	// an object's cached matrices, so nothing is inverted here or per vertex
+	void Add(const GeometryRange &range, const Transform &transform, unsigned int material)
+	{
+		add(range, transform.World(), transform.Normal(), material);
+	}
+
+	// copies the commands and per-draw data to the GPU and hooks the draw index up to the geometry VAO
+	void Upload(GeometryBuffer &geometry)
+	{
+		if (commandBuffer == 0)
+		{
+			glGenBuffers(1, &commandBuffer);
+			glGenBuffers(1, &drawDataBuffer);
+			glGenBuffers(1, &drawIdBuffer);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.empty() ? NULL : &commands[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		drawBuffer = commandBuffer;
+		drawOffset = 0;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(DrawData), draws.empty() ? NULL : &draws[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// the draw index buffer is just 0..n-1, only rebuilt when the list outgrows it
+		if (draws.size() > drawIdCapacity)
+		{
+			drawIdCapacity = draws.size();
+			std::vector<GLuint> ids(drawIdCapacity);
+			for (unsigned int i = 0; i < drawIdCapacity; i++)
+				ids[i] = i;
+			glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+			glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), &ids[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			InstanceAttribute drawId;
+			drawId.location = DRAW_ID_LOCATION;
+			drawId.buffer = drawIdBuffer;
+			drawId.size = 1;
+			drawId.type = GL_UNSIGNED_INT;
+			drawId.stride = sizeof(GLuint);
+			drawId.offset = 0;
+			drawId.integer = true;
+			drawId.divisor = 1;
+			geometry.SetInstanceAttribute(drawId);
+		}
+	}
+
+	// culls on the CPU instead: gives every draw an instanceCount of 1 or 0 and uploads the commands again.
+	// With a ring buffer they are written into this frame's region of it and drawn from there
+	void UploadVisibility(const std::vector<unsigned char> &visible, RingBuffer *ring = NULL)
+	{
+		for (unsigned int i = 0; i < commands.size() && i < visible.size(); i++)
+			commands[i].instanceCount = visible[i] ? 1 : 0;
+		GLsizeiptr size = commands.size() * sizeof(DrawElementsIndirectCommand);
+		RingAllocation allocation;
+		if (ring != NULL && size > 0 && ring->Allocate(size, sizeof(GLuint), allocation))
+		{
+			memcpy(allocation.data, &commands[0], size);
+			drawBuffer = ring->Buffer();
+			drawOffset = allocation.offset;
+			return;
+		}
+		drawBuffer = commandBuffer;
+		drawOffset = 0;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, commands.empty() ? NULL : &commands[0]);
+	}
+
+	unsigned int CommandBuffer() const { return commandBuffer; }
+
+	// binds the command and per-draw buffers, expects the geometry VAO to be bound as well
+	void Bind()
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+	}
+
+	void DrawPass(unsigned int pass, GLenum mode = GL_TRIANGLES)
+	{
+		const IndirectPass &p = passes[pass];
+		if (p.commandCount == 0)
+			return;
+		GLExt.MultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (void*)(drawOffset + p.firstCommand * sizeof(DrawElementsIndirectCommand)), p.commandCount, 0);
+	}
+
+	void Release()
+	{
+		glDeleteBuffers(1, &commandBuffer);
+		glDeleteBuffers(1, &drawDataBuffer);
+		glDeleteBuffers(1, &drawIdBuffer);
+		commandBuffer = drawDataBuffer = drawIdBuffer = 0;
+		drawIdCapacity = 0;
+		drawBuffer = 0;
+		drawOffset = 0;
+	}
+
+private:
+	/*  Render data  */
+	unsigned int commandBuffer, drawDataBuffer, drawIdBuffer;
+	unsigned int drawIdCapacity;
+	// where DrawPass reads the commands from: commandBuffer, or a ring buffer the visibility went into
+	unsigned int drawBuffer;
+	GLintptr drawOffset;
+
+	void add(const GeometryRange &range, const glm::mat4 &model, const glm::mat3 &normal, unsigned int material)
+	{
+		DrawElementsIndirectCommand command;
+		command.count = range.IndexCount();
+		command.instanceCount = 1;
+		command.firstIndex = range.FirstIndex();
+		command.baseVertex = range.BaseVertex();
+		command.baseInstance = draws.size();
+		commands.push_back(command);
+
+		DrawData draw;
+		draw.model = model;
+		for (int i = 0; i < 3; i++)
+			draw.normal[i] = glm::vec4(normal[i], 0.0f);
+		draw.material = material;
+		draw.padding[0] = draw.padding[1] = draw.padding[2] = 0;
+		draws.push_back(draw);
+
+		bounds.push_back(TransformAABB(range.bounds, model));
+		drawPasses.push_back(passes.size() - 1);
+		passes.back().commandCount++;
+	}
+};
+#endif
@@ -0,0 +1,137 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "geometry_buffer.h"
+#include "ring_buffer.h"
+
+#include <cstddef>
+#include <vector>
+
+// the first of the seven attribute locations instanced draws read their per instance data from
+const GLuint INSTANCE_ATTRIBUTE_LOCATION = 7;
+
+// What an instanced draw reads per instance: the instance's transform at locations 7 to 10 and its
+// normal matrix at 11 to 13, the columns of the latter padded to vec4s
+struct InstanceData {
+	glm::mat4 model;
+	glm::vec4 normal[3];
+};
+
+// instances uploaded once into a buffer of their own, for ones that never move
+struct StaticInstances {
+	unsigned int buffer = 0;
+	unsigned int count = 0;
+};
+
+// The per instance data of instanced draws out of a GeometryBuffer, read through divisor 1 attributes
+// of its VAO. Write puts each draw's instances in the frame's region of a RingBuffer and points the
+// attributes at where they landed, so nothing is allocated or respecified per draw and the GPU never
+// has to finish with one draw's instances before the next are written. Instances that never move are
+// uploaded once instead and Use points the attributes back at them whenever they are drawn.
+class InstanceBuffer
+{
+public:
+	/*  Functions  */
+	InstanceBuffer(GeometryBuffer &geometry) : geometry(geometry), ring(NULL), added(false)
+	{
+	}
+
+	// bytes count instances take in a ring, alignment included
+	static GLsizeiptr RingBytes(unsigned int count)
+	{
+		return (GLsizeiptr)count * sizeof(InstanceData) + sizeof(glm::vec4);
+	}
+
+	// writes go to ring from now on. Adds the attributes to the VAO the first time, which unbinds it, so
+	// that's best done before drawing starts
+	void Stream(RingBuffer &ring)
+	{
+		this->ring = &ring;
+		point(ring.Buffer(), 0);
+	}
+
+	// writes a transform per instance along with its normal matrix, false when there's no ring or the
+	// frame's region is full. Leaves the VAO bound
+	bool Write(const glm::mat4 *transforms, unsigned int count)
+	{
+		RingAllocation allocation;
+		if (ring == NULL || !ring->Allocate((GLsizeiptr)count * sizeof(InstanceData), sizeof(glm::vec4), allocation))
+			return false;
+		fill((InstanceData*)allocation.data, transforms, count);
+		ring->Flush();
+		point(ring->Buffer(), allocation.offset);
+		return true;
+	}
+
+	// the same data as Write in a static buffer, written this once
+	static StaticInstances Upload(const glm::mat4 *transforms, unsigned int count)
+	{
+		std::vector<InstanceData> instances(count);
+		if (count > 0)
+			fill(&instances[0], transforms, count);
+		StaticInstances uploaded;
+		uploaded.count = count;
+		glGenBuffers(1, &uploaded.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, uploaded.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)count * sizeof(InstanceData), count > 0 ? &instances[0] : NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return uploaded;
+	}
+
+	// points the attributes at instances uploaded before, leaves the VAO bound
+	void Use(const StaticInstances &instances)
+	{
+		point(instances.buffer, 0);
+	}
+
+	static void Release(StaticInstances &instances)
+	{
+		glDeleteBuffers(1, &instances.buffer);
+		instances = StaticInstances();
+	}
+
+	void Release()
+	{
+		ring = NULL;
+	}
+
+private:
+	/*  Instance data  */
+	GeometryBuffer &geometry;
+	RingBuffer *ring;
+	// whether the VAO has the attributes yet
+	bool added;
+
+	static void fill(InstanceData *instances, const glm::mat4 *transforms, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(transforms[i])));
+			InstanceData instance;
+			instance.model = transforms[i];
+			for (unsigned int c = 0; c < 3; c++)
+				instance.normal[c] = glm::vec4(normal[c], 0.0f);
+			instances[i] = instance;
+		}
+	}
+
+	void point(unsigned int buffer, GLintptr offset)
+	{
+		InstanceAttribute attributes[7];
+		for (GLuint i = 0; i < 7; i++)
+		{
+			size_t column = i < 4 ? offsetof(InstanceData, model) + i * sizeof(glm::vec4) : offsetof(InstanceData, normal) + (i - 4) * sizeof(glm::vec4);
+			attributes[i] = { INSTANCE_ATTRIBUTE_LOCATION + i, buffer, i < 4 ? 4 : 3, GL_FLOAT, sizeof(InstanceData), (size_t)offset + column, false, 1 };
+			if (!added)
+				geometry.SetInstanceAttribute(attributes[i]);
+		}
+		if (added)
+			geometry.MoveInstanceAttributes(attributes, 7);
+		added = true;
+	}
+};
+#endif
@@ -0,0 +1,326 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+typedef std::function<void()> JobFunction;
+
+class JobSystem;
+
+// Counts the jobs Run against it that haven't finished yet. Wait on it to join them, or pass it as the
+// dependency of later jobs, which are held back until it drops to zero. A counter has to outlive its
+// jobs and shouldn't have more added once something depends on it.
+class JobCounter
+{
+public:
+	JobCounter() : pending(0)
+	{
+	}
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter &operator=(const JobCounter&) = delete;
+
+	// takes the lock so a counter can be destroyed as soon as this says it's done, the last job may still
+	// be inside finishing it otherwise
+	bool Done() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return pending.load() == 0;
+	}
+
+private:
+	friend class JobSystem;
+	struct Held {
+		JobFunction function;
+		JobCounter *counter;
+	};
+
+	std::atomic<int> pending;
+	// jobs waiting for this counter, guarded by mutex
+	mutable std::mutex mutex;
+	std::vector<Held> held;
+};
+
+struct JobSystemStats {
+	unsigned int jobs;
+	// jobs a worker took from another worker's deque
+	unsigned int stolen;
+};
+
+// Work-stealing job scheduler. Every worker thread, and the thread that created the system as worker 0,
+// owns a deque: it pushes and pops its own jobs at the back, and once that's empty it steals from the
+// front of the others', so the oldest and usually largest pieces of work are the ones that move.
+// Threads that aren't workers hand jobs to the workers in turn. A thread waiting on a counter runs jobs
+// instead of blocking, idle workers sleep until a job is pushed.
+class JobSystem
+{
+public:
+	/*  Functions  */
+	// threads includes the creating thread, 0 uses every hardware thread
+	JobSystem(unsigned int threads = 0) : stopping(false), queued(0), sleeping(0), nextQueue(0)
+	{
+		if (threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		queues.resize(threads);
+		for (unsigned int i = 0; i < threads; i++)
+			queues[i] = new Queue();
+		ResetStats();
+		previousSlot = CurrentWorker();
+		CurrentWorker() = WorkerSlot(this, 0);
+		for (unsigned int i = 1; i < threads; i++)
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		for (unsigned int i = 0; i < queues.size(); i++)
+			delete queues[i];
+		if (CurrentWorker().system == this)
+			CurrentWorker() = previousSlot;
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem &operator=(const JobSystem&) = delete;
+
+	unsigned int Threads() const { return queues.size(); }
+
+	// queues a job, counted on counter when there is one. With after it is held until after reaches zero
+	void Run(const JobFunction &function, JobCounter *counter = NULL, JobCounter *after = NULL)
+	{
+		if (counter)
+			counter->pending++;
+		if (after)
+		{
+			std::lock_guard<std::mutex> lock(after->mutex);
+			if (after->pending.load() > 0)
+			{
+				JobCounter::Held held = { function, counter };
+				after->held.push_back(held);
+				return;
+			}
+		}
+		push(Job(function, counter));
+	}
+
+	// runs other jobs until every job counted on counter has finished
+	void Wait(JobCounter &counter)
+	{
+		while (!counter.Done())
+		{
+			if (!runOne())
+				std::this_thread::yield();
+		}
+	}
+
+	// runs one queued job on the calling thread, false when there was none, for threads waiting on
+	// something other than a counter
+	bool RunOne()
+	{
+		return runOne();
+	}
+
+	// calls body(begin, end) over [0, count) in batches of at most grain and waits for all of them.
+	// A grain of 0 splits the range into four batches per thread
+	void ParallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)> &body)
+	{
+		if (count == 0)
+			return;
+		if (grain == 0)
+			grain = std::max(count / (Threads() * 4), 1u);
+		if (count <= grain)
+		{
+			body(0, count);
+			return;
+		}
+		JobCounter counter;
+		// the calling thread takes the first batch itself
+		for (unsigned int begin = grain; begin < count; begin += grain)
+		{
+			unsigned int end = std::min(begin + grain, count);
+			Run([&body, begin, end]() { body(begin, end); }, &counter);
+		}
+		body(0, grain);
+		Wait(counter);
+	}
+
+	JobSystemStats Stats() const
+	{
+		JobSystemStats stats;
+		stats.jobs = jobsRun.load();
+		stats.stolen = jobsStolen.load();
+		return stats;
+	}
+
+	void ResetStats()
+	{
+		jobsRun = 0;
+		jobsStolen = 0;
+	}
+
+private:
+	struct Job {
+		JobFunction function;
+		JobCounter *counter;
+
+		Job() : counter(NULL) {}
+		Job(const JobFunction &function, JobCounter *counter) : function(function), counter(counter) {}
+	};
+
+	// a lock per deque keeps stealing simple; jobs are coarse enough that it is never contended for long
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// which system and worker the calling thread is, set for the creating thread and every worker
+	struct WorkerSlot {
+		JobSystem *system;
+		unsigned int index;
+
+		WorkerSlot(JobSystem *system = NULL, unsigned int index = 0) : system(system), index(index) {}
+	};
+
+	static WorkerSlot &CurrentWorker()
+	{
+		static thread_local WorkerSlot slot;
+		return slot;
+	}
+
+	/*  Job data  */
+	std::vector<Queue*> queues;
+	// what the creating thread was before, a short lived system inside another one gives it back
+	WorkerSlot previousSlot;
+	std::vector<std::thread> workers;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping;
+	// jobs sitting in any deque, so a worker knows whether it is worth going back to sleep
+	std::atomic<int> queued;
+	std::atomic<int> sleeping;
+	std::atomic<unsigned int> nextQueue;
+	std::atomic<unsigned int> jobsRun;
+	std::atomic<unsigned int> jobsStolen;
+
+	void push(const Job &job)
+	{
+		const WorkerSlot &slot = CurrentWorker();
+		unsigned int index = slot.system == this ? slot.index : nextQueue++ % queues.size();
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->mutex);
+			queues[index]->jobs.push_back(job);
+		}
+		queued++;
+		if (sleeping.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wake.notify_one();
+		}
+	}
+
+	// pops from the calling worker's own deque, or steals from the others starting at its neighbour
+	bool pop(Job &job)
+	{
+		const WorkerSlot &slot = CurrentWorker();
+		unsigned int self = slot.system == this ? slot.index : 0;
+		if (slot.system == this)
+		{
+			std::lock_guard<std::mutex> lock(queues[self]->mutex);
+			if (!queues[self]->jobs.empty())
+			{
+				job = queues[self]->jobs.back();
+				queues[self]->jobs.pop_back();
+				queued--;
+				return true;
+			}
+		}
+		for (unsigned int i = 1; i <= queues.size(); i++)
+		{
+			unsigned int victim = (self + i) % queues.size();
+			if (victim == self && slot.system == this)
+				continue;
+			std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+			if (queues[victim]->jobs.empty())
+				continue;
+			job = queues[victim]->jobs.front();
+			queues[victim]->jobs.pop_front();
+			queued--;
+			jobsStolen++;
+			return true;
+		}
+		return false;
+	}
+
+	bool runOne()
+	{
+		if (queued.load() == 0)
+			return false;
+		Job job;
+		if (!pop(job))
+			return false;
+		job.function();
+		jobsRun++;
+		if (job.counter)
+			finish(*job.counter);
+		return true;
+	}
+
+	// the last job of a counter releases whatever was held back on it
+	void finish(JobCounter &counter)
+	{
+		std::vector<JobCounter::Held> released;
+		{
+			std::lock_guard<std::mutex> lock(counter.mutex);
+			if (--counter.pending == 0)
+				released.swap(counter.held);
+		}
+		for (unsigned int i = 0; i < released.size(); i++)
+			push(Job(released[i].function, released[i].counter));
+	}
+
+	void workerLoop(unsigned int index)
+	{
+		CurrentWorker() = WorkerSlot(this, index);
+		for (;;)
+		{
+			// spin a little before sleeping, frames hand out work in quick bursts
+			bool ran = false;
+			for (int spin = 0; spin < 64 && !ran; spin++)
+			{
+				ran = runOne();
+				if (!ran)
+					std::this_thread::yield();
+			}
+			if (ran)
+				continue;
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleeping++;
+			wake.wait(lock, [&]() { return stopping || queued.load() > 0; });
+			sleeping--;
+			if (stopping)
+				return;
+		}
+	}
+};
+
+// the engine's job system, created with every hardware thread the first time it's used
+inline JobSystem &Jobs()
+{
+	static JobSystem jobs;
+	return jobs;
+}
+#endif
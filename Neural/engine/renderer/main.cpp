@@ -1,35 +1,76 @@
 ﻿#include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-
-
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Shader.h"
 #include "camera.h"
-#include "object.h"
 #include "model.h"
+#include "gl_ext.h"
+#include "indirect_draw.h"
+#include "gpu_culling.h"
+#include "software_occlusion.h"
+#include "occlusion_queries.h"
+#include "entity_store.h"
+#include "job_system.h"
+#include "frustum_culler.h"
+#include "frame_packet.h"
+#include "command_buffer.h"
+#include "ring_buffer.h"
+#include "frame_pacer.h"
+#include "bone_buffer.h"
+#include "baked_animation.h"
+#include "map.h"
+#include "command_line.h"
 
 #include <iostream>
 #include <fstream>
+#include <climits>
 #include <string>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-void AddWall(int x, int y, int z, float rot =0, int sx = 1, int sy = 1, int sz = 1);
-void AddDoor(int x, int y, int z, float rot = 0, int sx = 1, int sy = 1, int sz = 1);
-void AddFloor(int x, int y, int z, float rot = 0, int sx = 1, int sy = 1, int sz = 1);
-void AddLight(int x, int y, int z, float rot = 0, int sx = 1, int sy = 1, int sz = 1);
-void AddModel(int x, int y, int z, float rot = 0, int sx = 1, int sy = 1, int sz = 1);
 
-
-void ReadMap();
-unsigned int loadTexture(const char *path);
-unsigned int loadCubemap(std::vector<std::string> faces);
+void RecordMesh(CommandBuffer &commands, unsigned int mesh, const Transform &transform);
+
+// programs recorded command buffers can use, in the order the replayer is given them
+const unsigned int PROGRAM_LIGHTING = 0;
+const unsigned int PROGRAM_LAMP = 1;
+
+// the LightBlock uniform block of the lighting shader, laid out std140 with every vec3 padded to a vec4
+const unsigned int MAX_LIGHTS = 128;
+const GLuint LIGHT_BLOCK_BINDING = 0;
+struct LightBlock {
+	GLint amountOfLights;
+	GLint padding[3];
+	// position, ambient, diffuse, specular
+	glm::vec4 lights[MAX_LIGHTS][4];
+};
+void BindLightBlock(Shader &shader);
+bool WriteLights(RingBuffer &ring, GLint alignment, const std::vector<FrameLight> &lights);
+
+bool SoftwareVisible(SoftwareOcclusion *occlusion, const AABB &bounds, const glm::mat4 &model);
+std::vector<glm::mat4> BuildCrowd(unsigned int size, float scale, unsigned int clips, std::vector<CrowdInstance> &crowd);
+
+// the map has no room markup, so it is split into square chunks of this many cells that stand in for rooms
+const int ROOM_SIZE = 8;
+// the renderable entities of one chunk, which the legacy path draws under the chunk's occlusion query
+struct MapRoom {
+	AABB bounds;
+	// by material, every mesh of the model counts as MATERIAL_MESH
+	std::vector<Entity> entities[MATERIAL_MESH + 1];
+};
+std::vector<MapRoom> BuildRooms();
+void RecordRooms(const std::vector<MapRoom> &rooms, const std::vector<unsigned char> &visible, bool conditional, std::vector<CommandBuffer> &commands,
+	std::vector<std::vector<glm::mat4>> *instances);
+void ReplayRooms(CommandReplayer &replayer, const std::vector<CommandBuffer> &commands, unsigned int material, unsigned int roomCount);
+void DumpRoomCommands(const std::vector<CommandBuffer> &commands, unsigned int roomCount, const char *path);
+glm::mat4 RoomBoxMatrix(const AABB &bounds);
+bool NearRoom(const AABB &bounds, const glm::vec3 &position);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -47,23 +88,31 @@ float lastFrame = 0.0f;
 
 int texturePack = 1;
 
+// what the context supports, filled in by LoadGLExtensions
+GLExtensions GLExt;
 
-///list of everything
-std::vector<Object> walls;
-std::vector<Object> doors;
-std::vector<Object> floors;
-std::vector<Object> lights;
-std::vector<Object> nanoSuits;
-
-// lighting
-glm::vec3 lightPos(1.2f, 20.0f, 2.0f);
+// the map, declared in map.h
+EntityStore scene;
+GeometryRange meshRanges[MESH_TYPES];
+AABB meshBounds[MESH_TYPES];
+Model *nanoSuitModel = NULL;
 
-int main()
+int main(int argc, char **argv)
 {
+	// --software-occlusion culls on the CPU against the walls instead of with compute shaders
+	bool softwareCulling = HasArgument(argc, argv, "--software-occlusion");
+	// --occlusion-queries draws the map room by room with conditional rendering, which only needs GL 3.3,
+	// so the static geometry takes the legacy path even where multi-draw indirect is available
+	bool occlusionQueries = HasArgument(argc, argv, "--occlusion-queries");
+	// --no-avx2 keeps the SIMD kernels on their SSE2 paths even where the CPU has AVX2
+	if (HasArgument(argc, argv, "--no-avx2"))
+		UseAVX2() = false;
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	// ask for 4.3 so multi-draw indirect is available, 3.3 is still enough for everything else
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -75,6 +124,12 @@ int main()
 	// --------------------
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Gandalfs Engine", NULL, NULL);
 	if (window == NULL)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Gandalfs Engine", NULL, NULL);
+	}
+	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
 		glfwTerminate();
@@ -95,6 +150,76 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
+
+	// the nanosuit is read, and cooked the first time, on the job system while the shaders compile, only
+	// its upload waits for this thread. --import-assimp reads it through Assimp even though ObjLoader
+	// could, when it isn't cooked yet. Its meshes are merged into a single draw unless --separate-materials
+	ImportedModel importedSuit;
+	JobCounter suitImported;
+	ModelImporter suitImporter = HasArgument(argc, argv, "--import-assimp") ? MODEL_IMPORT_ASSIMP : MODEL_IMPORT_AUTO;
+	ModelMaterials suitMaterials = HasArgument(argc, argv, "--separate-materials") ? MODEL_SEPARATE_MATERIALS : MODEL_MERGE_MATERIALS;
+	Jobs().Run([&]() { Model::Import("resources/model/nanosuit/nanosuit.obj", importedSuit, suitImporter, suitMaterials); }, &suitImported);
+	// the map's textures decode on the job system too while the shaders compile and the models go up, the
+	// GL names are handed out now and the images uploaded into them further down. --serial-textures decodes
+	// every texture, the models' as well, one after another on this thread as it uploads them instead
+	if (HasArgument(argc, argv, "--serial-textures"))
+		TextureDecodeJobs() = NULL;
+	TextureBatch mapTextures;
+	unsigned int wallTexture = mapTextures.Add("resources/textures/awesomeface.png");
+	unsigned int wallSPec = mapTextures.Add("resources/textures/awesomeface.png");
+
+	unsigned int wallD1 = mapTextures.Add("resources/textures/wall1/diff.png");
+	unsigned int wallS1 = mapTextures.Add("resources/textures/wall1/spec.png");
+
+	unsigned int wallD2 = mapTextures.Add("resources/textures/wall2/diff.png");
+	unsigned int wallS2 = mapTextures.Add("resources/textures/wall2/spec.png");
+
+	unsigned int floorTexD = mapTextures.Add("resources/textures/floor/diff.jpg");
+	unsigned int floorTexS = mapTextures.Add("resources/textures/floor/spec.jpg");
+
+	unsigned int floorTexD2 = mapTextures.Add("resources/textures/floor2/diff.jpg");
+	unsigned int floorTexS2 = mapTextures.Add("resources/textures/floor2/spec.jpg");
+
+	unsigned int floorTexD3 = mapTextures.Add("resources/textures/floor3/diff.jpg");
+	unsigned int floorTexS3 = mapTextures.Add("resources/textures/floor3/spec.jpg");
+
+	unsigned int wallD3 = mapTextures.Add("resources/textures/wall3/diff.png");
+	unsigned int wallS3 = mapTextures.Add("resources/textures/wall3/spec.png");
+	std::vector<std::string> faces
+	{
+		"resources/textures/skyboxnn/right.jpg",
+		"resources/textures/skyboxnn/right.jpg",
+		"resources/textures/skyboxnn/top.jpg",
+		"resources/textures/skyboxnn/bottom.jpg",
+		"resources/textures/skyboxnn/front.jpg",
+		"resources/textures/skyboxnn/front.jpg"
+	};
+	unsigned int cubemapTexture = mapTextures.AddCubemap(faces);
+	// --crowd file fills the map with instances of an animated model, 1024 or --crowd-size of them scaled by
+	// 0.05 or --crowd-scale, all posed on the GPU from frames of its clips baked on the job system as well
+	const char *crowdPath = ArgumentValue(argc, argv, "--crowd");
+	ImportedModel importedCrowd;
+	BakedAnimation crowdAnimation;
+	float crowdBakeMs = 0.0f;
+	JobCounter crowdImported;
+	if (crowdPath != NULL)
+	{
+		Jobs().Run([&]() {
+			if (!Model::Import(crowdPath, importedCrowd))
+				return;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			crowdAnimation.Bake(importedCrowd.hierarchy, importedCrowd.animation, &Jobs());
+			crowdBakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}, &crowdImported);
+	}
+	// --animated file fills the map with 256 or --animated-size instances of an animated model scaled by 0.05
+	// or --animated-scale, posed every frame on the job system and skinned by the vertex shader
+	const char *animatedPath = ArgumentValue(argc, argv, "--animated");
+	ImportedModel importedAnimated;
+	JobCounter animatedImported;
+	if (animatedPath != NULL)
+		Jobs().Run([&]() { Model::Import(animatedPath, importedAnimated); }, &animatedImported);
 
 	// configure global opengl state
 	// -----------------------------
@@ -107,613 +232,661 @@ int main()
 	Shader skyboxShader("resources/shaders/6.1.skybox.vs", "resources/shaders/6.1.skybox.fs");
 
 	Shader lightingShader("resources/shaders/2.2.basic_lighting.vs", "resources/shaders/2.2.basic_lighting.fs");
+	BindLightBlock(lightingShader);
 	Shader lampShader("resources/shaders/2.2.lamp.vs", "resources/shaders/2.2.lamp.fs");
+	// the legacy path draws all nanosuits of a room at once, the shader reads each one's transform from
+	// the instance attributes
+	Shader instancedShader("resources/shaders/2.3.instanced_lighting.vs", "resources/shaders/2.2.basic_lighting.fs");
+	BindLightBlock(instancedShader);
+	// the crowd is instanced too, its shader also finds each instance's frame in the baked animation
+	Shader *crowdShader = NULL;
+	if (crowdPath != NULL)
+	{
+		crowdShader = new Shader("resources/shaders/2.5.baked_crowd.vs", "resources/shaders/2.2.basic_lighting.fs");
+		BindLightBlock(*crowdShader);
+	}
+	// so are the animated instances, whose shader reads their bones from the bone buffer
+	Shader *skinnedShader = NULL;
+	if (animatedPath != NULL)
+	{
+		skinnedShader = new Shader("resources/shaders/2.4.skinned_lighting.vs", "resources/shaders/2.2.basic_lighting.fs");
+		BindLightBlock(*skinnedShader);
+	}
 
-	Model ourModel("resources/model/nanosuit/nanosuit.obj");
-
-	// set up vertex data (and buffer(s)) and configure vertex attributes
-	// ------------------------------------------------------------------
-	float vertices[] = {
-		 -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-		 
-
-		//left
-		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-		-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-
-		//right
-		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-
-		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f	
-	};
-
-
-	float floor_vertices[] = {
-	 
-		-0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-		 0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-		-0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-				  
-		-0.5f, -0.6f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-		 0.5f, -0.6f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-
-
-		//left
-		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-		-0.5f, -0.6f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.6f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.6f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-
-		//right
-		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f, -0.6f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		 0.5f, -0.6f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-		 0.5f, -0.6f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-
-		-0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f,
-		 0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  1.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
-		 0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
-		-0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
-		-0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f
-
-	};
-
-
-	float door_vertices[] = {
-		///left pillar
-		//front face??
-	 -0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-	 -0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-	 -0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	 -0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	-0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-	-0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-
-	// back face?
-	-0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-	 -0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
-	 -0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	 -0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	-0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
-	-0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-
-	// left face?
-	-0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	-0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	-0.5f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	-0.5f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	-0.5f, -0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	-0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-
-	//right face?
-	 -0.25f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	 -0.25f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	 -0.25f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.25f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.25f, -0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	 -0.25f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	 ///right pillar
-	 //front face??
-	 0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-	 0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	 0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-	 0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-	
-	// back face?
-	0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-	 0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
-	 0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	 0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
-	0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-	
-	// left face?
-	0.25f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	0.25f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	0.25f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	0.25f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	0.25f, -0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	0.25f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	
-	//right face?
-	 -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	 -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	 -0.5f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.5f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.5f, -0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	 -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-
-	 ///top pillar
-	  //front face??
-	 -0.5f, 0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-	 0.5f,  0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	 0.5f,  0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-	 -0.5f, 0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-	 -0.5f, 0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-
-	 // back face?
-	 -0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-	  0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
-	  0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	  0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
-	 -0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
-	 -0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
-
-	 // left face?
-	 -0.5f,  0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	 -0.5f,  0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	 -0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	 -0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	 -0.5f,  0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-
-	 //right face?
-	  -0.5f,  0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-	  -0.5f,  0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
-	  -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	  -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
-	  -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
-	  -0.5f,  0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
-
-	  //bottom face
-	  -0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-     	 0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
-     	 0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-     	 0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
-     	-0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
-     	-0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
-
-		//top face
-		-0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,
-		 0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f,
-		 0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
-		 0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
-		-0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
-		-0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f
-	};
+	// the indirect shaders read their model matrix from the per-draw storage buffer, they need GL 4.3
+	Shader *indirectShader = NULL;
+	Shader *indirectLampShader = NULL;
+	if (GLExt.multiDrawIndirect)
+	{
+		indirectShader = new Shader("resources/shaders/7.1.indirect_lighting.vs", "resources/shaders/2.2.basic_lighting.fs");
+		BindLightBlock(*indirectShader);
+		indirectLampShader = new Shader("resources/shaders/7.1.indirect_lamp.vs", "resources/shaders/2.2.lamp.fs");
+	}
 
+	// nothing reads the nanosuit's geometry back once it is uploaded, so its CPU copy is freed unless
+	// --keep-mesh-data asks to keep it
+	Jobs().Wait(suitImported);
+	Model ourModel(std::move(importedSuit), false, HasArgument(argc, argv, "--keep-mesh-data") ? MODEL_KEEP_CPU_DATA : MODEL_RELEASE_CPU_DATA);
+	// the crowd's model goes up the same way, its baked frames with it; the crowd never moves, so where each
+	// member stands and what it plays is worked out and uploaded once here
+	Model *crowdModel = NULL;
+	StaticInstances crowdInstances;
+	if (crowdPath != NULL)
+	{
+		Jobs().Wait(crowdImported);
+		if (importedCrowd.animation.skeleton.Empty() || crowdAnimation.Frames() == 0)
+			std::cout << "CROWD::" << crowdPath << " has no skeleton or no clips to bake" << std::endl;
+		else if (crowdAnimation.Upload())
+		{
+			crowdModel = new Model(std::move(importedCrowd), false, MODEL_RELEASE_CPU_DATA);
+			const char *crowdSize = ArgumentValue(argc, argv, "--crowd-size");
+			const char *crowdScale = ArgumentValue(argc, argv, "--crowd-scale");
+			std::vector<CrowdInstance> crowd;
+			std::vector<glm::mat4> crowdTransforms = BuildCrowd(crowdSize ? std::max(1, atoi(crowdSize)) : 1024,
+				crowdScale ? (float)atof(crowdScale) : 0.05f, crowdAnimation.Clips().size(), crowd);
+			crowdInstances = InstanceBuffer::Upload(&crowdTransforms[0], crowdTransforms.size());
+			crowdAnimation.SetInstances(crowd);
+			std::cout << "CROWD::" << crowd.size() << " instances of " << crowdPath << ", " << crowdAnimation.Clips().size() << " clips of "
+				<< crowdAnimation.BoneCount() << " bones baked into " << crowdAnimation.Frames() << " frames, " << crowdAnimation.Bytes() / 1024
+				<< "KB, in " << crowdBakeMs << "ms" << std::endl;
+		}
+	}
+	// the animated instances stand on a grid from the map's first cell, each playing one of the clips from its
+	// own point; only their bones change, where they stand is uploaded once too
+	Model *animatedModel = NULL;
+	Animator *animator = NULL;
+	BoneBuffer boneBuffer;
+	StaticInstances animatedInstances;
+	if (animatedPath != NULL)
+	{
+		Jobs().Wait(animatedImported);
+		if (importedAnimated.animation.skeleton.Empty() || importedAnimated.animation.clips.empty())
+			std::cout << "ANIMATION::" << animatedPath << " has no skeleton or no clips to play" << std::endl;
+		else
+		{
+			animatedModel = new Model(std::move(importedAnimated), false, MODEL_RELEASE_CPU_DATA);
+			const char *animatedSize = ArgumentValue(argc, argv, "--animated-size");
+			const char *animatedScale = ArgumentValue(argc, argv, "--animated-scale");
+			unsigned int size = animatedSize ? std::max(1, atoi(animatedSize)) : 256;
+			unsigned int boneCount = animatedModel->animation.skeleton.Size();
+			// every instance's bones go up in one buffer texture, so there can't be more than it holds
+			boneBuffer.Create(size * boneCount);
+			if (boneBuffer.Capacity() < size * boneCount)
+			{
+				std::cout << "ANIMATION::a bone buffer holds " << boneBuffer.Capacity() / boneCount << " instances of " << boneCount
+					<< " bones, not " << size << std::endl;
+				size = boneBuffer.Capacity() / boneCount;
+			}
+			std::vector<CrowdInstance> instances;
+			std::vector<glm::mat4> animatedTransforms = BuildCrowd(size, animatedScale ? (float)atof(animatedScale) : 0.05f,
+				animatedModel->animation.clips.size(), instances);
+			animatedInstances = InstanceBuffer::Upload(&animatedTransforms[0], animatedTransforms.size());
+			animator = new Animator(animatedModel->hierarchy, animatedModel->animation);
+			for (unsigned int i = 0; i < instances.size(); i++)
+				animator->Add(instances[i].clip, instances[i].offset, instances[i].speed);
+		}
+	}
 
-	float skyboxVertices[] = {
-		// positions          
-		-1.0f,  1.0f, -1.0f,
-		-1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		-1.0f,  1.0f, -1.0f,
-		 1.0f,  1.0f, -1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		 1.0f, -1.0f,  1.0f
-	};
+	// upload every primitive into the shared geometry buffer, the skybox cube doubles as the lamp
+	GeometryBuffer &geometry = SharedGeometry();
+	LoadMapMeshes(ourModel);
+	GeometryRange skyboxRange = meshRanges[MESH_LAMP];
 
-	// first, configure the cube's VAO (and VBO)
-	unsigned int VBO, cubeVAO, doorVBO, doorVAO, floorVBO, floorVAO;
-	glGenVertexArrays(1, &cubeVAO);
-	glGenBuffers(1, &VBO);
-	glGenVertexArrays(1, &doorVAO);
-	glGenBuffers(1, &doorVBO);
-	glGenVertexArrays(1, &floorVAO);
-	glGenBuffers(1, &floorVBO);
-
-	
-
-	glBindVertexArray(cubeVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// normal attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	//tex co-ordinate attrubute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(floorVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, floorVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor_vertices), floor_vertices, GL_STATIC_DRAW);
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// normal attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	//tex co-ordinate attrubute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(doorVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, doorVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(door_vertices), door_vertices, GL_STATIC_DRAW);
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// normal attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	//tex co-ordinate attrubute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-
-
-	// skybox VAO
-	unsigned int skyboxVAO, skyboxVBO;
-	glGenVertexArrays(1, &skyboxVAO);
-	glGenBuffers(1, &skyboxVBO);
-	glBindVertexArray(skyboxVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-
-	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
-	unsigned int lightVAO, lightVBO;
-	glGenVertexArrays(1, &lightVAO);
-	glGenBuffers(1, &lightVBO);
-	glBindVertexArray(lightVAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, lightVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-
-
-	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	unsigned int wallTexture = loadTexture("resources/textures/awesomeface.png");
-	unsigned int wallSPec = loadTexture("resources/textures/awesomeface.png");
-
-	unsigned int wallD1 = loadTexture("resources/textures/wall1/diff.png");
-	unsigned int wallS1 = loadTexture("resources/textures/wall1/spec.png");
-
-	unsigned int wallD2 = loadTexture("resources/textures/wall2/diff.png");
-	unsigned int wallS2 = loadTexture("resources/textures/wall2/spec.png");
-
-	unsigned int floorTexD = loadTexture("resources/textures/floor/diff.jpg");
-	unsigned int floorTexS = loadTexture("resources/textures/floor/spec.jpg");
-
-	unsigned int floorTexD2 = loadTexture("resources/textures/floor2/diff.jpg");
-	unsigned int floorTexS2 = loadTexture("resources/textures/floor2/spec.jpg");
-
-	unsigned int floorTexD3 = loadTexture("resources/textures/floor3/diff.jpg");
-	unsigned int floorTexS3 = loadTexture("resources/textures/floor3/spec.jpg");
-
-
-	unsigned int wallD3 = loadTexture("resources/textures/wall3/diff.png");
-	unsigned int wallS3 = loadTexture("resources/textures/wall3/spec.png");
-	std::vector<std::string> faces
-	{
-		"resources/textures/skyboxnn/right.jpg",
-		"resources/textures/skyboxnn/right.jpg",
-		"resources/textures/skyboxnn/top.jpg",
-		"resources/textures/skyboxnn/bottom.jpg",
-		"resources/textures/skyboxnn/front.jpg",
-		"resources/textures/skyboxnn/front.jpg"
-	};
-	  unsigned int cubemapTexture = loadCubemap(faces);
+	// by now the map's textures have long been decoding, only their uploads are left
+	mapTextures.Upload();
+	mapTextures.PrintStats("TEXTURES::map");
 
+	// samplers of different types can't share a unit, so the material arrays get units of their own
 	lightingShader.use();
 	lightingShader.setInt("material.diffuse", 0);
 	lightingShader.setInt("material.specular", 1);
+	lightingShader.setInt("diffuseArray", MODEL_DIFFUSE_ARRAY_UNIT);
+	lightingShader.setInt("specularArray", MODEL_SPECULAR_ARRAY_UNIT);
+	instancedShader.use();
+	instancedShader.setInt("material.diffuse", 0);
+	instancedShader.setInt("material.specular", 1);
+	instancedShader.setInt("diffuseArray", MODEL_DIFFUSE_ARRAY_UNIT);
+	instancedShader.setInt("specularArray", MODEL_SPECULAR_ARRAY_UNIT);
+	if (crowdShader)
+	{
+		crowdShader->use();
+		crowdShader->setInt("material.diffuse", 0);
+		crowdShader->setInt("material.specular", 1);
+		crowdShader->setInt("diffuseArray", MODEL_DIFFUSE_ARRAY_UNIT);
+		crowdShader->setInt("specularArray", MODEL_SPECULAR_ARRAY_UNIT);
+		crowdShader->setInt("bakedBones", BAKED_ANIMATION_TEXTURE_UNIT);
+		crowdShader->setInt("crowd", CROWD_TEXTURE_UNIT);
+		crowdShader->setInt("firstInstance", 0);
+	}
+	if (animator != NULL)
+	{
+		skinnedShader->use();
+		skinnedShader->setInt("material.diffuse", 0);
+		skinnedShader->setInt("material.specular", 1);
+		skinnedShader->setInt("diffuseArray", MODEL_DIFFUSE_ARRAY_UNIT);
+		skinnedShader->setInt("specularArray", MODEL_SPECULAR_ARRAY_UNIT);
+		skinnedShader->setInt("bones", BONE_TEXTURE_UNIT);
+		skinnedShader->setInt("boneCount", animator->BoneCount());
+		skinnedShader->setInt("firstInstance", 0);
+	}
+	if (indirectShader)
+	{
+		indirectShader->use();
+		indirectShader->setInt("material.diffuse", 0);
+		indirectShader->setInt("material.specular", 1);
+		indirectShader->setInt("diffuseArray", MODEL_DIFFUSE_ARRAY_UNIT);
+		indirectShader->setInt("specularArray", MODEL_SPECULAR_ARRAY_UNIT);
+	}
 
 	skyboxShader.use();
 	skyboxShader.setInt("skybox", 0);
 
-
 	///list of shit
 	//AddWall(0, 0, 0);
 	//AddWall(1, 1, 1);
 	//AddWall(2, 2, 2, 45);
 	//
 	ReadMap();
-	// render loop
-	// -----------
-	while (!glfwWindowShouldClose(window))
+
+	// with multi-draw indirect all static geometry goes out with one call per pass
+	bool indirect = GLExt.multiDrawIndirect && !occlusionQueries;
+
+	// the map never changes after loading, so its indirect draws are built once up front
+	IndirectDrawList staticDraws;
+	StaticPasses staticPasses;
+	if (indirect)
+		staticPasses = BuildStaticDraws(staticDraws, ourModel);
+	// and frustum culled on the GPU every frame where compute shaders are available, as well as occlusion
+	// culled against a depth pyramid of the previous frame
+	GpuCuller staticCuller;
+	HiZPyramid depthPyramid;
+	if (staticCuller.Build(staticDraws, indirect && !softwareCulling))
+		staticCuller.SetOcclusion(&depthPyramid);
+	// everywhere the GPU doesn't cull, the CPU does against a low resolution depth buffer of the walls,
+	// unless the rooms are culled with occlusion queries instead
+	SoftwareOcclusion *softwareOcclusion = NULL;
+	if (!staticCuller.Enabled() && !occlusionQueries)
 	{
-		// per-frame time logic
-		// --------------------
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
+		softwareOcclusion = new SoftwareOcclusion();
+		softwareOcclusion->SetOccluders(BuildWallOccluders());
+	}
+	// the legacy path draws room by room, each room conditional on its query from the frame before
+	std::vector<MapRoom> rooms = BuildRooms();
+	OcclusionQueries roomQueries;
+	if (occlusionQueries)
+		roomQueries.Create(rooms.size());
+	// whatever the GPU doesn't cull is frustum culled on the CPU first, over the static draws on the indirect
+	// path and over every renderable entity, by entity id, on the legacy one
+	FrustumCuller staticFrustum;
+	std::vector<unsigned int> frustumVisible;
+	std::vector<unsigned char> entityVisible;
+	// the legacy path's draws are recorded on the job system's threads and replayed on the render thread
+	std::vector<Shader*> programs;
+	programs.push_back(&lightingShader);
+	programs.push_back(&lampShader);
+	CommandReplayer roomReplayer(programs, &roomQueries);
+	// --dump-commands writes the first frame's room command buffers to commands.txt
+	bool dumpCommands = HasArgument(argc, argv, "--dump-commands");
+	// the nanosuits are gathered per room and drawn instanced instead, unless --no-instancing asks for a
+	// draw per nanosuit and mesh; with no room queries to honour all rooms' nanosuits go out together
+	bool instancing = !HasArgument(argc, argv, "--no-instancing");
+	std::vector<glm::mat4> suitInstances;
+	bool instancedDraws = (!indirect && instancing) || crowdModel != NULL || animatedModel != NULL;
+	if (indirect)
+	{
+		for (unsigned int i = 0; i < staticDraws.bounds.size(); i++)
+			staticFrustum.Add(staticDraws.bounds[i]);
+	}
+	else
+		BuildEntityBounds(staticFrustum);
+	geometry.PrintStats();
+	float lastCullingStats = glfwGetTime();
+	// what changes every frame goes through a ring buffer: the lights, the CPU culled indirect commands, the
+	// instances of the instanced nanosuits, at most every one on the map once a frame, and the animated bones
+	GLint uniformAlignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	// --frames-in-flight 1..3 sets how far the render thread may get ahead of the GPU, fewer for less
+	// input latency, more for throughput
+	FramePacer framePacer;
+	const char *framesInFlight = ArgumentValue(argc, argv, "--frames-in-flight");
+	framePacer.Create(framesInFlight ? atoi(framesInFlight) : FRAME_PACER_DEFAULT_FRAMES);
+	unsigned int frameInstances = 0;
+	if (!indirect && instancing)
+	{
+		std::vector<EntityChunk*> chunks = scene.Query(HAS_RENDERABLE);
+		for (unsigned int c = 0; c < chunks.size(); c++)
+		{
+			for (unsigned int j = 0; j < chunks[c]->count; j++)
+				frameInstances += chunks[c]->renderables[j].mesh == MESH_NANOSUIT ? 1 : 0;
+		}
+	}
+	// a region per frame in flight, so the pacer's wait already frees the region a frame writes
+	RingBuffer frameRing;
+	frameRing.Create(sizeof(LightBlock) + uniformAlignment + staticDraws.commands.size() * sizeof(DrawElementsIndirectCommand) + sizeof(GLuint)
+		+ (frameInstances > 0 ? InstanceBuffer::RingBytes(frameInstances) : 0) + boneBuffer.RingBytes(), framePacer.FramesInFlight());
+	if (instancedDraws)
+		SharedInstances().Stream(frameRing);
+	boneBuffer.Stream(frameRing);
+
+	// the render thread owns the GL context from here on and draws whatever frame packets it is handed
+	// -------------------------------------------------------------------------------------------------
+	FrameQueue frameQueue;
+	int viewportWidth = 0, viewportHeight = 0;
+	auto renderFrame = [&](const FramePacket &frame) {
+		framePacer.BeginFrame();
+
+		// print the culling rates every few seconds
+		if (frame.time - lastCullingStats > 5.0f)
+		{
+			frameQueue.PrintStats();
+			frameQueue.ResetStats();
+			framePacer.PrintStats();
+			framePacer.ResetStats();
+			frameRing.PrintStats();
+			frameRing.ResetStats();
+			if (staticCuller.Enabled())
+			{
+				staticCuller.PrintStats();
+				staticCuller.ResetStats();
+			}
+			if (roomQueries.Enabled())
+			{
+				roomQueries.PrintStats();
+				roomQueries.ResetStats();
+			}
+			lastCullingStats = frame.time;
+		}
 
-		// input
-		// -----
-		processInput(window);
+		if (frame.framebufferWidth != viewportWidth || frame.framebufferHeight != viewportHeight)
+		{
+			// make sure the viewport matches the new window dimensions; note that width and
+			// height will be significantly larger than specified on retina displays.
+			viewportWidth = frame.framebufferWidth;
+			viewportHeight = frame.framebufferHeight;
+			glViewport(0, 0, viewportWidth, viewportHeight);
+		}
+		frameRing.BeginFrame();
 
 		// render
 		// ------
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		lightingShader.use();
-		lightingShader.setInt("amountOfLights", lights.size());
-		for (int i = 0; i < lights.size(); i++)
-		{
-			std::stringstream ss;
-			ss << i;
-			std::string str = ss.str();
-
-			lightingShader.setVec3("lights[" + str + "].position", lights[i].position);
-
-			// light properties
-			lightingShader.setVec3("lights[" + str + "].ambient", 0.2f, 0.2f, 0.2f);
-			lightingShader.setVec3("lights[" + str + "].diffuse", 0.5f, 0.5f, 0.5f);
-			lightingShader.setVec3("lights[" + str + "].specular", 1.0f, 1.0f, 1.0f);
-		}
-		lightingShader.setVec3("light.position", lightPos);
-		lightingShader.setVec3("viewPos", camera.Position);
-
-		// light properties
-		lightingShader.setVec3("light.ambient", 0.04f, 0.04f, 0.04f);
-		lightingShader.setVec3("light.diffuse", 0.1f, 0.1f, 0.1f);
-		lightingShader.setVec3("light.specular", 0.2f, 0.2f, 0.2f);
+		// every draw below comes out of the shared geometry buffer
+		geometry.Bind();
 
-		// material properties
-		lightingShader.setFloat("material.shininess", 64.0f);
+		roomQueries.NextFrame();
+		Shader &sceneShader = indirect ? *indirectShader : lightingShader;
 
 		// view/projection transformations
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 view = camera.GetViewMatrix();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
-
-		// world transformation
-		
-
-		// render the cube
+		glm::mat4 projection = frame.projection;
+		glm::mat4 view = frame.view;
 
-
-				// render the floor
-		if (texturePack == 1)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, floorTexD);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, floorTexS);
-		}
-		else if(texturePack == 2)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, floorTexD2);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, floorTexS2);
-		}
-		else if (texturePack == 3)
+		if (indirect)
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, floorTexD3);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, floorTexS3);
-		}
-
-		glm::mat4 model = glm::mat4(1.0f);
-		lightingShader.setMat4("model", model);
-		glBindVertexArray(floorVAO);
-		for (unsigned int i = 0; i < floors.size(); i++) {
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, floors[i].position);
-			model = glm::rotate(model, glm::radians(floors[i].rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-			lightingShader.setMat4("model", model);
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			depthPyramid.Resize(frame.framebufferWidth, frame.framebufferHeight);
+			staticCuller.Cull(projection * view);
 		}
+		// the CPU culled the static draws while building the packet
+		if (indirect && !staticCuller.Enabled())
+			staticDraws.UploadVisibility(frame.staticVisible, &frameRing);
+		WriteLights(frameRing, uniformAlignment, frame.lights);
+		frameRing.Flush();
 
+		auto setSceneUniforms = [&](Shader &shader) {
+			shader.use();
+			shader.setVec3("light.position", lightPos);
+			shader.setVec3("viewPos", frame.cameraPosition);
 
-		// render the cube
-		if (texturePack == 1)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, wallD1);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, wallS1);
-		}
-		else if (texturePack == 2)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, wallD2);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, wallS2);
-		}
-		else if (texturePack == 3)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, wallD3);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, wallS3);
-		}
-		glBindVertexArray(cubeVAO);
-		for (unsigned int i = 0; i < walls.size(); i++)
+			// light properties
+			shader.setVec3("light.ambient", 0.04f, 0.04f, 0.04f);
+			shader.setVec3("light.diffuse", 0.1f, 0.1f, 0.1f);
+			shader.setVec3("light.specular", 0.2f, 0.2f, 0.2f);
+
+			// material properties
+			shader.setFloat("material.shininess", 64.0f);
+
+			shader.setMat4("projection", projection);
+			shader.setMat4("view", view);
+		};
+		if (!indirect && instancing)
+			setSceneUniforms(instancedShader);
+		if (crowdModel != NULL)
+			setSceneUniforms(*crowdShader);
+		if (animatedModel != NULL)
+			setSceneUniforms(*skinnedShader);
+		setSceneUniforms(sceneShader);
+
+		if (indirect)
+			staticDraws.Bind();
+
+		// with occlusion culling the static geometry goes out twice: first what last frame's depth didn't hide,
+		// then whatever the depth of that first pass shows was hidden no longer
+		int staticPhases = indirect && staticCuller.Occluding() ? 2 : 1;
+		for (int phase = 0; phase < staticPhases; phase++)
 		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, walls[i].position);
-			model = glm::rotate(model, glm::radians(walls[i].rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-			lightingShader.setMat4("model", model);
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		}
-
+			if (phase == 1)
+			{
+				staticCuller.CullDisoccluded();
+				sceneShader.use();
+			}
 
+			// render the floor
+			if (frame.texturePack == 1)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, floorTexD);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, floorTexS);
+			}
+			else if (frame.texturePack == 2)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, floorTexD2);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, floorTexS2);
+			}
+			else if (frame.texturePack == 3)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, floorTexD3);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, floorTexS3);
+			}
 
+			if (indirect)
+				staticCuller.DrawPass(staticPasses.floors);
+			else
+				ReplayRooms(roomReplayer, frame.roomCommands, MATERIAL_FLOOR, rooms.size());
 
-		glBindVertexArray(doorVAO);
-		for (unsigned int i = 0; i < doors.size(); i++)
-		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, doors[i].position);
-			model = glm::rotate(model, glm::radians(doors[i].rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-			lightingShader.setMat4("model", model);
+			// render the walls and doors
+			if (frame.texturePack == 1)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, wallD1);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, wallS1);
+			}
+			else if (frame.texturePack == 2)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, wallD2);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, wallS2);
+			}
+			else if (frame.texturePack == 3)
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, wallD3);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, wallS3);
+			}
 
-			glDrawArrays(GL_TRIANGLES, 0, 72+6+6);
+			if (indirect)
+				staticCuller.DrawPass(staticPasses.walls);
+			else
+				ReplayRooms(roomReplayer, frame.roomCommands, MATERIAL_WALL, rooms.size());
 
-		}
+			// render the loaded model
+			if (indirect)
+			{
+				// one pass per mesh, so each mesh's textures are bound once for every nanosuit. Merged, that's
+				// one pass with the material arrays bound
+				ourModel.BindMaterialArrays(sceneShader);
+				for (unsigned int i = 0; i < ourModel.meshes.size(); i++)
+				{
+					ourModel.meshes[i].BindTextures(sceneShader);
+					staticCuller.DrawPass(staticPasses.meshes[i]);
+				}
+				glActiveTexture(GL_TEXTURE0);
+				sceneShader.setBool("mergedMaterials", false);
+			}
+			else
+			{
+				// with instancing all that's left in these is what isn't a nanosuit
+				ReplayRooms(roomReplayer, frame.roomCommands, MATERIAL_MESH, rooms.size());
+			}
+			if (!indirect && instancing && roomQueries.Enabled())
+			{
+				// a draw per mesh for each room's nanosuits, conditional on the room's query
+				instancedShader.use();
+				for (unsigned int r = 0; r < rooms.size() && r < frame.roomInstances.size(); r++)
+				{
+					if (frame.roomInstances[r].empty())
+						continue;
+					bool conditional = roomQueries.BeginConditional(r);
+					ourModel.DrawInstanced(instancedShader, frame.roomInstances[r]);
+					roomQueries.EndConditional(conditional);
+				}
+			}
+			else if (!indirect && instancing)
+			{
+				// and just a draw per mesh for every nanosuit on the map
+				suitInstances.clear();
+				for (unsigned int r = 0; r < frame.roomInstances.size(); r++)
+					suitInstances.insert(suitInstances.end(), frame.roomInstances[r].begin(), frame.roomInstances[r].end());
+				instancedShader.use();
+				ourModel.DrawInstanced(instancedShader, suitInstances);
+			}
+			// the whole crowd in a draw per mesh, posed by the vertex shader from the frame time alone
+			if (crowdModel != NULL && phase == 0)
+			{
+				crowdShader->use();
+				crowdShader->setFloat("time", frame.time);
+				crowdAnimation.Bind();
+				crowdModel->DrawInstanced(*crowdShader, crowdInstances);
+			}
+			// and the animated instances, with the bones the main thread posed them in
+			if (animatedModel != NULL && phase == 0 && boneBuffer.Upload(frame.bones.empty() ? NULL : &frame.bones[0], frame.bones.size()))
+			{
+				skinnedShader->use();
+				boneBuffer.Bind();
+				animatedModel->DrawInstanced(*skinnedShader, animatedInstances);
+			}
 
-		for (unsigned int i = 0; i < nanoSuits.size(); i++) {
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, glm::vec3(nanoSuits[i].position.x, -0.5, nanoSuits[i].position.z)); // translate it down so it's at the center of the scene
-			model = glm::scale(model, glm::vec3(0.05f));	// it's a bit too big for our scene, so scale it down
-			lightingShader.setMat4("model", model);
-			ourModel.Draw(lightingShader);
+			// also draw the lamp objects
+			Shader &sceneLampShader = indirect ? *indirectLampShader : lampShader;
+			sceneLampShader.use();
+			sceneLampShader.setMat4("projection", projection);
+			sceneLampShader.setMat4("view", view);
+			if (indirect)
+				staticCuller.DrawPass(staticPasses.lamps);
+			else
+			{
+				lampShader.setMat4("model", LampMatrix(lightPos, 0.2f)); // a smaller cube
+				geometry.Draw(skyboxRange);
 
+				ReplayRooms(roomReplayer, frame.roomCommands, MATERIAL_LAMP, rooms.size());
+			}
 		}
 
-
-		//ourShader.use();
-		//// view/projection transformations
-		//
-		//ourShader.setMat4("projection", projection);
-		//ourShader.setMat4("view", view);
-
-
-		// render the loaded model
-	
-
-
-
-		//glDrawArrays(GL_TRIANGLES, 0, 36);
-
-
-		// also draw the lamp object
-		lampShader.use();
-		lampShader.setMat4("projection", projection);
-		lampShader.setMat4("view", view);
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, lightPos);
-		model = glm::scale(model, glm::vec3(0.2f)); // a smaller cube
-		lampShader.setMat4("model", model);
-
-		glBindVertexArray(lightVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		for (unsigned int i = 0; i < lights.size(); i++)
+		// test every room's box against this frame's depth, the results decide what is drawn next frame
+		if (roomQueries.Enabled())
 		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, lights[i].position);
-			model = glm::scale(model, glm::vec3(0.05f)); // a smaller cube
-			model = glm::rotate(model, glm::radians(lights[i].rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-			lampShader.setMat4("model", model);
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-
+			Frustum frustum(projection * view);
+			lampShader.use();
+			lampShader.setMat4("projection", projection);
+			lampShader.setMat4("view", view);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glDepthMask(GL_FALSE);
+			for (unsigned int r = 0; r < rooms.size(); r++)
+			{
+				// a room off screen or around the camera gets no query and so is drawn regardless next frame,
+				// the frustum or the near plane would clip its box away without that saying the room is hidden
+				if (!frustum.Intersects(rooms[r].bounds) || NearRoom(rooms[r].bounds, frame.cameraPosition))
+					continue;
+				lampShader.setMat4("model", RoomBoxMatrix(rooms[r].bounds));
+				roomQueries.BeginQuery(r);
+				geometry.Draw(skyboxRange);
+				roomQueries.EndQuery();
+			}
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthMask(GL_TRUE);
 		}
 
 		// draw skybox as last
 		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
 		skyboxShader.use();
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
+		view = glm::mat4(glm::mat3(frame.view)); // remove translation from the view matrix
 		skyboxShader.setMat4("view", view);
 		skyboxShader.setMat4("projection", projection);
 		// skybox cube
-		glBindVertexArray(skyboxVAO);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		geometry.Draw(skyboxRange);
 		glBindVertexArray(0);
 		glDepthFunc(GL_LESS); // set depth function back to default
+		frameRing.EndFrame();
+		framePacer.EndSubmit();
 
+		// glfw: swap buffers, the driver may block in here while the main thread carries on with input
+		// ---------------------------------------------------------------------------------------------
+		glfwSwapBuffers(window);
+		framePacer.EndFrame();
+	};
 
+	// --single-threaded draws each packet on the main thread as soon as it's built, for comparison
+	bool singleThreaded = HasArgument(argc, argv, "--single-threaded");
+	std::thread renderThread;
+	if (!singleThreaded)
+	{
+		glfwMakeContextCurrent(NULL);
+		renderThread = std::thread([&]() {
+			glfwMakeContextCurrent(window);
+			FramePacket frame;
+			for (;;)
+			{
+				frameQueue.Acquire(frame);
+				if (frame.quit)
+					break;
+				renderFrame(frame);
+			}
+			glfwMakeContextCurrent(NULL);
+		});
+	}
 
+	// main loop: input, camera and culling, then the packet goes to the render thread, which swaps buffers
+	// while this thread is already polling input for the next frame
+	// -----------------------------------------------------------------------------------------------------
+	// everything is loaded by now, glfw's clock started with glfwInit
+	std::cout << "STARTUP::ready to draw after " << glfwGetTime() * 1000.0 << "ms, textures decoded "
+		<< (TextureDecodeJobs() != NULL ? "on the job system" : "one after another") << std::endl;
+	FramePacket packet;
+	float lastOcclusionStats = glfwGetTime();
+	float lastAnimationStats = lastOcclusionStats;
+	std::vector<EntityChunk*> lightChunks = scene.Query(HAS_TRANSFORM | HAS_LIGHT);
+	while (!glfwWindowShouldClose(window))
+	{
+		// per-frame time logic
+		// --------------------
+		float currentFrame = glfwGetTime();
+		deltaTime = currentFrame - lastFrame;
+		lastFrame = currentFrame;
 
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
+		// glfw: poll IO events (keys pressed/released, mouse moved etc.), then handle input
+		// ----------------------------------------------------------------------------------
 		glfwPollEvents();
+		processInput(window);
+
+		packet.frame++;
+		packet.time = currentFrame;
+		packet.projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		packet.view = camera.GetViewMatrix();
+		packet.cameraPosition = camera.Position;
+		glfwGetFramebufferSize(window, &packet.framebufferWidth, &packet.framebufferHeight);
+		packet.texturePack = texturePack;
+		if (animator != NULL)
+		{
+			animator->Update(deltaTime, &Jobs());
+			packet.bones.assign(animator->Bones().begin(), animator->Bones().end());
+		}
+		packet.lights.clear();
+		for (unsigned int c = 0; c < lightChunks.size(); c++)
+		{
+			const EntityChunk &chunk = *lightChunks[c];
+			for (unsigned int i = 0; i < chunk.count; i++)
+			{
+				FrameLight light = { chunk.transforms[i].Position(), chunk.lights[i].ambient, chunk.lights[i].diffuse, chunk.lights[i].specular };
+				packet.lights.push_back(light);
+			}
+		}
+		// all the CPU culling happens here, the render thread only gets what survived it
+		if (!staticCuller.Enabled())
+		{
+			glm::mat4 viewProjection = packet.projection * packet.view;
+			// the occluders are drawn before anything is tested against them
+			if (softwareOcclusion)
+				softwareOcclusion->Render(viewProjection);
+			staticFrustum.Cull(Frustum(viewProjection), frustumVisible, &Jobs());
+			if (indirect)
+			{
+				// only what is in the frustum is worth testing against the occluders
+				packet.staticVisible.assign(staticDraws.bounds.size(), 0);
+				for (unsigned int i = 0; i < frustumVisible.size(); i++)
+					packet.staticVisible[frustumVisible[i]] = softwareOcclusion->Visible(staticDraws.bounds[frustumVisible[i]]);
+			}
+			else
+			{
+				entityVisible.assign(staticFrustum.Size(), 0);
+				for (unsigned int i = 0; i < frustumVisible.size(); i++)
+				{
+					Entity entity = frustumVisible[i];
+					entityVisible[entity] = SoftwareVisible(softwareOcclusion, meshBounds[scene.GetRenderable(entity).mesh], scene.GetTransform(entity).World());
+				}
+				RecordRooms(rooms, entityVisible, roomQueries.Enabled(), packet.roomCommands, instancing ? &packet.roomInstances : NULL);
+				if (dumpCommands && packet.frame == 1)
+					DumpRoomCommands(packet.roomCommands, rooms.size(), "commands.txt");
+			}
+		}
+		if (softwareOcclusion && currentFrame - lastOcclusionStats > 5.0f)
+		{
+			softwareOcclusion->PrintStats();
+			softwareOcclusion->ResetStats();
+			lastOcclusionStats = currentFrame;
+		}
+		if (animator != NULL && currentFrame - lastAnimationStats > 5.0f)
+		{
+			animator->PrintStats();
+			animator->ResetStats();
+			lastAnimationStats = currentFrame;
+		}
+
+		if (singleThreaded)
+			renderFrame(packet);
+		else
+			frameQueue.Submit(packet);
+	}
+	if (!singleThreaded)
+	{
+		packet.quit = true;
+		frameQueue.Submit(packet);
+		renderThread.join();
+		glfwMakeContextCurrent(window);
 	}
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
-	glDeleteVertexArrays(1, &cubeVAO);
-	glDeleteVertexArrays(1, &lightVAO);
-	glDeleteBuffers(1, &VBO);
+	staticCuller.Release();
+	depthPyramid.Release();
+	frameRing.Release();
+	framePacer.Release();
+	delete softwareOcclusion;
+	roomQueries.Release();
+	staticDraws.Release();
+	geometry.Release();
+	if (instancedDraws)
+		SharedInstances().Release();
+	InstanceBuffer::Release(crowdInstances);
+	crowdAnimation.Release();
+	delete crowdModel;
+	delete crowdShader;
+	InstanceBuffer::Release(animatedInstances);
+	boneBuffer.Release();
+	delete animator;
+	delete animatedModel;
+	delete skinnedShader;
+	delete indirectShader;
+	delete indirectLampShader;
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
@@ -721,6 +894,35 @@ int main()
 	return 0;
 }
 
+// points the shader's LightBlock at the binding the lights are written to every frame
+void BindLightBlock(Shader &shader)
+{
+	GLuint block = glGetUniformBlockIndex(shader.ID, "LightBlock");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader.ID, block, LIGHT_BLOCK_BINDING);
+}
+
+// writes the lights into a LightBlock in the ring and binds it, false when the ring had no room for it
+bool WriteLights(RingBuffer &ring, GLint alignment, const std::vector<FrameLight> &lights)
+{
+	RingAllocation allocation;
+	if (!ring.Allocate(sizeof(LightBlock), alignment, allocation))
+		return false;
+	// straight into the mapped buffer, only as much as there are lights
+	LightBlock *block = (LightBlock*)allocation.data;
+	unsigned int count = std::min((unsigned int)lights.size(), MAX_LIGHTS);
+	block->amountOfLights = count;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		block->lights[i][0] = glm::vec4(lights[i].position, 1.0f);
+		block->lights[i][1] = glm::vec4(lights[i].ambient, 0.0f);
+		block->lights[i][2] = glm::vec4(lights[i].diffuse, 0.0f);
+		block->lights[i][3] = glm::vec4(lights[i].specular, 0.0f);
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, ring.Buffer(), allocation.offset, sizeof(LightBlock));
+	return true;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window)
@@ -748,12 +950,10 @@ void processInput(GLFWwindow *window)
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-	// make sure the viewport matches the new window dimensions; note that width and 
-	// height will be significantly larger than specified on retina displays.
-	glViewport(0, 0, width, height);
+	// nothing to do here, GL belongs to the render thread: the main thread puts the framebuffer size in
+	// every frame packet and the render thread sets the viewport when it changes
 }
 
-
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -780,166 +980,175 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	camera.ProcessMouseScroll(yoffset);
 }
-//
-void ReadMap()
+// records the mesh's draw with its model and normal matrices, the nanosuit's as one draw per node mesh
+// placed by the node's transform
+void RecordMesh(CommandBuffer &commands, unsigned int mesh, const Transform &transform)
 {
-	std::ifstream file("resources/map.txt");
-	std::string str;
-	int x, y = 0;
-	while (std::getline(file, str)) {
-		for (int i = 0; i < str.length(); i++) {
-			if (str[i] == 'W') {
-				AddWall(i,0,y);
-			
-			}
-			if (str[i] == 'D')
-			{
-				AddDoor(i, 0, y);
-				AddFloor(i, 0, y);
-			}
-			if (str[i] == 'd')
-			{
-				AddDoor(i, 0, y, 90.0f);
-				AddFloor(i, 0, y);
-			}
-			if (str[i] == 'O') {
-				AddFloor(i, 0, y);
-			}
-			if (str[i] == 'l') {
-				AddLight(i, 0, y);
-				AddFloor(i, 0, y);
-			}
-			if (str[i] == 'M') {
-			
-				AddModel(i, 0, y);
-				AddFloor(i, 0, y);
-			}
-			
-		}
-		y++;
+	if (mesh != MESH_NANOSUIT)
+	{
+		commands.SetMat4("model", transform.World());
+		commands.SetMat3("normalMatrix", transform.Normal());
+		commands.Draw(meshRanges[mesh]);
+		return;
 	}
+	const NodeHierarchy &hierarchy = nanoSuitModel->hierarchy;
+	nanoSuitModel->RecordMaterialArrays(commands);
+	for (unsigned int i = 0; i < hierarchy.nodes.size(); i++)
+	{
+		const HierarchyNode &node = hierarchy.nodes[i];
+		if (node.meshCount == 0)
+			continue;
+		glm::mat4 world = transform.World() * nanoSuitModel->nodeTransforms.World(i);
+		commands.SetMat4("model", world);
+		commands.SetMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(world))));
+		for (unsigned int j = 0; j < node.meshCount; j++)
+			nanoSuitModel->meshes[hierarchy.meshes[node.firstMesh + j]].Record(commands);
+	}
+	if (nanoSuitModel->MergedMaterials())
+		commands.SetInt("mergedMaterials", 0);
 }
-//
-void AddWall(int x, int y, int z, float rot , int sx , int sy , int sz )
-{
-	Object newObject = {};
-	glm::vec3 pos = glm::vec3(x, y, z);
-	glm::vec3 scale = glm::vec3(sx, sy, sz);
-	newObject.position = pos;
-	newObject.rotation = rot;
-	newObject.scale = scale;
-	walls.push_back(newObject);
 
-}
+// sorts every static object into the ROOM_SIZE chunk of the grid its cell falls in and bounds each chunk by
+// its draws as the render loop places them, padded a little so the box never ties with the room's own walls
+std::vector<MapRoom> BuildRooms()
+{
+	std::vector<EntityChunk*> chunks = scene.Query(HAS_TRANSFORM | HAS_RENDERABLE);
+	glm::ivec2 gridMin(INT_MAX, INT_MAX), gridMax(INT_MIN, INT_MIN);
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		for (unsigned int i = 0; i < chunks[c]->count; i++)
+		{
+			glm::ivec2 cell((int)chunks[c]->transforms[i].Position().x, (int)chunks[c]->transforms[i].Position().z);
+			gridMin = glm::min(gridMin, cell);
+			gridMax = glm::max(gridMax, cell);
+		}
+	}
+	std::vector<MapRoom> rooms;
+	if (gridMin.x > gridMax.x)
+		return rooms;
+
+	int roomsX = (gridMax.x - gridMin.x) / ROOM_SIZE + 1;
+	int roomsZ = (gridMax.y - gridMin.y) / ROOM_SIZE + 1;
+	std::vector<MapRoom> grid(roomsX * roomsZ);
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		const EntityChunk &chunk = *chunks[c];
+		for (unsigned int i = 0; i < chunk.count; i++)
+		{
+			const Transform &transform = chunk.transforms[i];
+			const Renderable &renderable = chunk.renderables[i];
+			MapRoom &room = grid[((int)transform.Position().z - gridMin.y) / ROOM_SIZE * roomsX + ((int)transform.Position().x - gridMin.x) / ROOM_SIZE];
+			room.entities[std::min(renderable.material, MATERIAL_MESH)].push_back(chunk.entities[i]);
+			AABB bounds = TransformAABB(meshBounds[renderable.mesh], transform.World());
+			room.bounds.Expand(bounds.min);
+			room.bounds.Expand(bounds.max);
+		}
+	}
 
-void AddFloor(int x, int y, int z, float rot, int sx, int sy, int sz) {
-	Object newObject = {};
-	glm::vec3 pos = glm::vec3(x, y, z);
-	glm::vec3 scale = glm::vec3(sx, sy, sz);
-	newObject.position = pos;
-	newObject.rotation = rot;
-	newObject.scale = scale;
-	floors.push_back(newObject);
+	for (unsigned int i = 0; i < grid.size(); i++)
+	{
+		if (!grid[i].bounds.Valid())
+			continue;
+		grid[i].bounds.min -= glm::vec3(0.01f);
+		grid[i].bounds.max += glm::vec3(0.01f);
+		rooms.push_back(grid[i]);
+	}
+	return rooms;
 }
 
-void AddModel(int x, int y, int z, float rot, int sx, int sy, int sz)
+// records the draws of every room and material into a buffer of its own, commands[material * rooms + room],
+// spread over the job system's threads; visible is indexed by entity. With conditional each room's draws
+// are wrapped in its occlusion query from the frame before. Given instances, the visible nanosuits aren't
+// recorded but their transforms gathered into (*instances)[room], to be drawn instanced
+void RecordRooms(const std::vector<MapRoom> &rooms, const std::vector<unsigned char> &visible, bool conditional, std::vector<CommandBuffer> &commands,
+	std::vector<std::vector<glm::mat4>> *instances)
 {
-	Object newObject = {};
-	glm::vec3 pos = glm::vec3(x, y, z);
-	glm::vec3 scale = glm::vec3(sx, sy, sz);
-	newObject.position = pos;
-	newObject.rotation = rot;
-	newObject.scale = scale;
-	nanoSuits.push_back(newObject);
-
+	commands.resize(rooms.size() * (MATERIAL_MESH + 1));
+	if (instances)
+	{
+		instances->resize(rooms.size());
+		for (unsigned int r = 0; r < rooms.size(); r++)
+			(*instances)[r].clear();
+	}
+	Jobs().ParallelFor(commands.size(), 4, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int b = begin; b < end; b++)
+		{
+			unsigned int material = b / rooms.size();
+			unsigned int room = b % rooms.size();
+			const std::vector<Entity> &entities = rooms[room].entities[material];
+			CommandBuffer &buffer = commands[b];
+			buffer.Clear();
+			if (entities.empty())
+				continue;
+			buffer.UseProgram(material == MATERIAL_LAMP ? PROGRAM_LAMP : PROGRAM_LIGHTING);
+			if (conditional)
+				buffer.BeginConditional(room);
+			for (unsigned int j = 0; j < entities.size(); j++)
+			{
+				if (!visible[entities[j]])
+					continue;
+				const Transform &transform = scene.GetTransform(entities[j]);
+				if (instances && scene.GetRenderable(entities[j]).mesh == MESH_NANOSUIT)
+				{
+					(*instances)[room].push_back(transform.World());
+					continue;
+				}
+				RecordMesh(buffer, scene.GetRenderable(entities[j]).mesh, transform);
+			}
+			if (conditional)
+				buffer.EndConditional();
+		}
+	});
 }
-void AddLight(int x, int y, int z, float rot, int sx, int sy, int sz)
-{
-	Object newObject = {};
-	glm::vec3 pos = glm::vec3(x, y, z);
-	glm::vec3 scale = glm::vec3(sx, sy, sz);
-	newObject.position = pos;
-	newObject.rotation = rot;
-	newObject.scale = scale;
-	lights.push_back(newObject);
 
-}
-//
-void AddDoor(int x, int y, int z, float rot, int sx, int sy, int sz)
+// replays what RecordRooms recorded for one material, room by room
+void ReplayRooms(CommandReplayer &replayer, const std::vector<CommandBuffer> &commands, unsigned int material, unsigned int roomCount)
 {
-	Object newObject = {};
-	glm::vec3 pos = glm::vec3(x, y, z);
-	glm::vec3 scale = glm::vec3(sx, sy, sz);
-	newObject.position = pos;
-	newObject.rotation = rot;
-	newObject.scale = scale;
-	doors.push_back(newObject);
-
+	for (unsigned int r = 0; r < roomCount && material * roomCount + r < commands.size(); r++)
+		replayer.Replay(commands[material * roomCount + r]);
 }
-unsigned int loadTexture(char const * path)
-{
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
+// writes every room buffer out as text, to see what a frame drew
+void DumpRoomCommands(const std::vector<CommandBuffer> &commands, unsigned int roomCount, const char *path)
+{
+	std::ofstream out(path);
+	for (unsigned int i = 0; i < commands.size(); i++)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		out << "# material " << i / roomCount << ", room " << i % roomCount << ": " << commands[i].Draws() << " draws\n";
+		commands[i].Dump(out);
 	}
-
-	return textureID;
+	std::cout << "RENDER::wrote the room command buffers to " << path << std::endl;
 }
 
-
-unsigned int loadCubemap(std:: vector<std::string> faces)
+// true unless the software occlusion buffer rules the draw out, always true without one
+bool SoftwareVisible(SoftwareOcclusion *occlusion, const AABB &bounds, const glm::mat4 &model)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	return occlusion == NULL || occlusion->Visible(TransformAABB(bounds, model));
+}
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+// size members of a crowd a step apart on a square grid from the map's first cell, scaled by scale, each
+// turned its own way and playing one of the clips from its own point at a slightly different speed
+std::vector<glm::mat4> BuildCrowd(unsigned int size, float scale, unsigned int clips, std::vector<CrowdInstance> &crowd)
+{
+	const float spacing = 0.5f;
+	unsigned int side = (unsigned int)std::ceil(std::sqrt((float)size));
+	std::vector<glm::mat4> transforms;
+	crowd.clear();
+	unsigned int seed = 1;
+	for (unsigned int i = 0; i < size; i++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
+		float random[3];
+		for (int j = 0; j < 3; j++)
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
+			seed = seed * 1664525u + 1013904223u;
+			random[j] = (seed >> 8) / 16777216.0f;
 		}
+		// standing on the floor, like the nanosuits
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3((i % side) * spacing, -0.5f, (i / side) * spacing));
+		transform = glm::rotate(transform, random[0] * 6.2831853f, glm::vec3(0.0f, 1.0f, 0.0f));
+		transforms.push_back(glm::scale(transform, glm::vec3(scale)));
+		CrowdInstance instance = { i % std::max(1u, clips), random[1] * 10.0f, 0.8f + random[2] * 0.4f };
+		crowd.push_back(instance);
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	return textureID;
+	return transforms;
 }
\ No newline at end of file
@@ -0,0 +1,587 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "model.h"
+#include "geometry_buffer.h"
+#include "indirect_draw.h"
+#include "entity_store.h"
+#include "bounds.h"
+#include "frustum_culler.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// The map read from resources/map.txt and the meshes it is built from, everything the renderer and the
+// bench executable both load the same way. The map's globals are defined once by each program's main.
+
+// material indices stored with every indirect draw
+const unsigned int MATERIAL_FLOOR = 0;
+const unsigned int MATERIAL_WALL = 1;
+const unsigned int MATERIAL_LAMP = 2;
+const unsigned int MATERIAL_MESH = 3; // first mesh of the model, the others follow in order
+
+// meshes a Renderable can name: primitives in the shared geometry buffer, and the nanosuit model
+const unsigned int MESH_CUBE = 0;
+const unsigned int MESH_FLOOR = 1;
+const unsigned int MESH_DOOR = 2;
+const unsigned int MESH_LAMP = 3;
+const unsigned int MESH_NANOSUIT = 4;
+const unsigned int MESH_TYPES = 5;
+
+// where each group of static geometry ended up in the indirect draw list
+struct StaticPasses {
+	unsigned int floors;
+	unsigned int walls;
+	unsigned int lamps;
+	std::vector<unsigned int> meshes;
+};
+
+///everything in the map
+extern EntityStore scene;
+// what each mesh id draws and its local bounds, filled in by LoadMapMeshes; the nanosuit draws through its
+// Model instead of a range
+extern GeometryRange meshRanges[MESH_TYPES];
+extern AABB meshBounds[MESH_TYPES];
+extern Model *nanoSuitModel;
+
+// lighting
+const glm::vec3 lightPos(1.2f, 20.0f, 2.0f);
+
+// turns one of the non-indexed primitive arrays of LoadMapMeshes (position, then optionally normal and
+// texture coordinates) into indexed Vertex data inside the shared geometry buffer
+inline GeometryRange AddPrimitive(const float *data, unsigned int vertexCount, unsigned int floatsPerVertex)
+{
+	std::vector<Vertex> primitiveVertices;
+	std::vector<unsigned int> primitiveIndices;
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		const float *v = data + i * floatsPerVertex;
+		Vertex vertex;
+		vertex.Position = glm::vec3(v[0], v[1], v[2]);
+		vertex.Normal = floatsPerVertex >= 6 ? glm::vec3(v[3], v[4], v[5]) : glm::vec3(0.0f);
+		vertex.TexCoords = floatsPerVertex >= 8 ? glm::vec2(v[6], v[7]) : glm::vec2(0.0f);
+		vertex.Tangent = glm::vec3(0.0f);
+		vertex.Bitangent = glm::vec3(0.0f);
+		vertex.Layer = 0.0f;
+		ClearBones(vertex);
+
+		// the arrays repeat the shared corners of every quad, so reuse a matching vertex if there is one
+		unsigned int index = primitiveVertices.size();
+		for (unsigned int j = 0; j < primitiveVertices.size(); j++)
+		{
+			if (primitiveVertices[j].Position == vertex.Position && primitiveVertices[j].Normal == vertex.Normal && primitiveVertices[j].TexCoords == vertex.TexCoords)
+			{
+				index = j;
+				break;
+			}
+		}
+		if (index == primitiveVertices.size())
+			primitiveVertices.push_back(vertex);
+		primitiveIndices.push_back(index);
+	}
+	return SharedGeometry().Upload(&primitiveVertices[0], primitiveVertices.size(), &primitiveIndices[0], primitiveIndices.size());
+}
+
+// uploads every primitive into the shared geometry buffer, the skybox cube doubles as the lamp, and bounds
+// the nanosuit by all of its node meshes placed by their nodes
+inline void LoadMapMeshes(Model &suit)
+{
+	float vertices[] = {
+		 -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+		 0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+		-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
+		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+		 0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+		-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+		 
+
+		//left
+		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+		-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+
+		//right
+		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+
+		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f	
+	};
+
+	float floor_vertices[] = {
+	 
+		-0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+		 0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+		-0.5f, -0.6f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+				  
+		-0.5f, -0.6f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+		 0.5f, -0.6f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+
+		//left
+		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+		-0.5f, -0.6f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.6f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.6f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+
+		//right
+		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f, -0.6f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		 0.5f, -0.6f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+		 0.5f, -0.6f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+
+		-0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f,
+		 0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  1.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
+		 0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f
+
+	};
+
+	float door_vertices[] = {
+		///left pillar
+		//front face??
+	 -0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+	 -0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+	 -0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	 -0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	-0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+	-0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+
+	// back face?
+	-0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+	 -0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
+	 -0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	 -0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	-0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
+	-0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+
+	// left face?
+	-0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	-0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	-0.5f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	-0.5f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	-0.5f, -0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	-0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+
+	//right face?
+	 -0.25f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	 -0.25f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	 -0.25f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.25f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.25f, -0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	 -0.25f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	 ///right pillar
+	 //front face??
+	 0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+	 0.5f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	 0.25f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+	 0.25f, -0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+	
+	// back face?
+	0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+	 0.5f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
+	 0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	 0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	0.25f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
+	0.25f, -0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+	
+	// left face?
+	0.25f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	0.25f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	0.25f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	0.25f, -0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	0.25f, -0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	0.25f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	
+	//right face?
+	 -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	 -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	 -0.5f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.5f, -0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.5f, -0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	 -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+
+	 ///top pillar
+	  //front face??
+	 -0.5f, 0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+	 0.5f,  0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+	 0.5f,  0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	 0.5f,  0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+	 -0.5f, 0.5f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+	 -0.5f, 0.4f, -0.17f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+
+	 // back face?
+	 -0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+	  0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  0.0f,
+	  0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	  0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  1.0f,  1.0f,
+	 -0.5f,  0.5f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  1.0f,
+	 -0.5f,  0.4f,  0.17f,  0.0f,  0.0f,  1.0f,  0.0f,  0.0f,
+
+	 // left face?
+	 -0.5f,  0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	 -0.5f,  0.5f, -0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	 -0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.5f,  0.4f, -0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	 -0.5f,  0.4f,  0.17f, -1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	 -0.5f,  0.5f,  0.17f, -1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+
+	 //right face?
+	  -0.5f,  0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+	  -0.5f,  0.5f, -0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  1.0f,
+	  -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	  -0.5f,  0.4f, -0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  1.0f,
+	  -0.5f,  0.4f,  0.17f,  1.0f,  0.0f,  0.0f,  0.0f,  0.0f,
+	  -0.5f,  0.5f,  0.17f,  1.0f,  0.0f,  0.0f,  1.0f,  0.0f,
+
+	  //bottom face
+	  -0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+     	 0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  1.0f,
+     	 0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+     	 0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  1.0f,  0.0f,
+     	-0.5f, 0.4f,  0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  0.0f,
+     	-0.5f, 0.4f, -0.17f,  0.0f, -1.0f,  0.0f,  0.0f,  1.0f,
+
+		//top face
+		-0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+		 0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+		 0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
+		 0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
+		-0.5f, 0.5f,  0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+		-0.5f, 0.5f, -0.17f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f
+	};
+
+	float skyboxVertices[] = {
+		// positions          
+		-1.0f,  1.0f, -1.0f,
+		-1.0f, -1.0f, -1.0f,
+		 1.0f, -1.0f, -1.0f,
+		 1.0f, -1.0f, -1.0f,
+		 1.0f,  1.0f, -1.0f,
+		-1.0f,  1.0f, -1.0f,
+
+		-1.0f, -1.0f,  1.0f,
+		-1.0f, -1.0f, -1.0f,
+		-1.0f,  1.0f, -1.0f,
+		-1.0f,  1.0f, -1.0f,
+		-1.0f,  1.0f,  1.0f,
+		-1.0f, -1.0f,  1.0f,
+
+		 1.0f, -1.0f, -1.0f,
+		 1.0f, -1.0f,  1.0f,
+		 1.0f,  1.0f,  1.0f,
+		 1.0f,  1.0f,  1.0f,
+		 1.0f,  1.0f, -1.0f,
+		 1.0f, -1.0f, -1.0f,
+
+		-1.0f, -1.0f,  1.0f,
+		-1.0f,  1.0f,  1.0f,
+		 1.0f,  1.0f,  1.0f,
+		 1.0f,  1.0f,  1.0f,
+		 1.0f, -1.0f,  1.0f,
+		-1.0f, -1.0f,  1.0f,
+
+		-1.0f,  1.0f, -1.0f,
+		 1.0f,  1.0f, -1.0f,
+		 1.0f,  1.0f,  1.0f,
+		 1.0f,  1.0f,  1.0f,
+		-1.0f,  1.0f,  1.0f,
+		-1.0f,  1.0f, -1.0f,
+
+		-1.0f, -1.0f, -1.0f,
+		-1.0f, -1.0f,  1.0f,
+		 1.0f, -1.0f, -1.0f,
+		 1.0f, -1.0f, -1.0f,
+		-1.0f, -1.0f,  1.0f,
+		 1.0f, -1.0f,  1.0f
+	};
+
+	meshRanges[MESH_CUBE] = AddPrimitive(vertices, sizeof(vertices) / (8 * sizeof(float)), 8);
+	meshRanges[MESH_FLOOR] = AddPrimitive(floor_vertices, sizeof(floor_vertices) / (8 * sizeof(float)), 8);
+	meshRanges[MESH_DOOR] = AddPrimitive(door_vertices, sizeof(door_vertices) / (8 * sizeof(float)), 8);
+	meshRanges[MESH_LAMP] = AddPrimitive(skyboxVertices, sizeof(skyboxVertices) / (3 * sizeof(float)), 3);
+	for (unsigned int i = 0; i < MESH_NANOSUIT; i++)
+		meshBounds[i] = meshRanges[i].bounds;
+	for (unsigned int i = 0; i < suit.hierarchy.nodes.size(); i++)
+	{
+		const HierarchyNode &node = suit.hierarchy.nodes[i];
+		for (unsigned int j = 0; j < node.meshCount; j++)
+		{
+			AABB bounds = TransformAABB(suit.meshes[suit.hierarchy.meshes[node.firstMesh + j]].range.bounds, suit.nodeTransforms.World(i));
+			meshBounds[MESH_NANOSUIT].Expand(bounds.min);
+			meshBounds[MESH_NANOSUIT].Expand(bounds.max);
+		}
+	}
+	nanoSuitModel = &suit;
+}
+
+// an entity standing on map cell (x, z) that draws mesh with material, with a collider filling the cell,
+// and with any other components asked for left for the caller to set up
+inline Entity AddMapObject(int x, int z, unsigned int mesh, unsigned int material, float rotation = 0.0f, ComponentMask components = 0)
+{
+	Entity entity = scene.Create(HAS_TRANSFORM | HAS_RENDERABLE | HAS_COLLIDER | components);
+	Transform &transform = scene.GetTransform(entity);
+	transform.SetPosition(glm::vec3(x, 0.0f, z));
+	transform.SetRotation(rotation);
+
+	Renderable &renderable = scene.GetRenderable(entity);
+	renderable.mesh = mesh;
+	renderable.material = material;
+
+	Collider &collider = scene.GetCollider(entity);
+	collider.bounds.min = glm::vec3(x - 0.5f, -0.5f, z - 0.5f);
+	collider.bounds.max = glm::vec3(x + 0.5f, 0.5f, z + 0.5f);
+	collider.occluder = false;
+	return entity;
+}
+
+// fills scene with an entity per marked cell of resources/map.txt, and a floor under every one that isn't a wall
+inline void ReadMap()
+{
+	std::ifstream file("resources/map.txt");
+	std::string str;
+	int y = 0;
+	while (std::getline(file, str)) {
+		for (int i = 0; i < str.length(); i++) {
+			if (str[i] == 'W') {
+				// walls are what the occlusion culling draws as occluders
+				scene.GetCollider(AddMapObject(i, y, MESH_CUBE, MATERIAL_WALL)).occluder = true;
+			}
+			if (str[i] == 'D' || str[i] == 'd')
+			{
+				// doors use the wall textures
+				AddMapObject(i, y, MESH_DOOR, MATERIAL_WALL, str[i] == 'd' ? 90.0f : 0.0f);
+				AddMapObject(i, y, MESH_FLOOR, MATERIAL_FLOOR);
+			}
+			if (str[i] == 'O') {
+				AddMapObject(i, y, MESH_FLOOR, MATERIAL_FLOOR);
+			}
+			if (str[i] == 'l') {
+				Entity light = AddMapObject(i, y, MESH_LAMP, MATERIAL_LAMP, 0.0f, HAS_LIGHT);
+				scene.GetTransform(light).SetScale(glm::vec3(0.05f)); // a small cube marks the light
+				scene.GetLight(light).ambient = glm::vec3(0.2f);
+				scene.GetLight(light).diffuse = glm::vec3(0.5f);
+				scene.GetLight(light).specular = glm::vec3(1.0f);
+				AddMapObject(i, y, MESH_FLOOR, MATERIAL_FLOOR);
+			}
+			if (str[i] == 'M') {
+				// translated down so it stands on the floor, and it's a bit too big for our scene, so scaled down
+				Transform &transform = scene.GetTransform(AddMapObject(i, y, MESH_NANOSUIT, MATERIAL_MESH));
+				transform.SetPosition(glm::vec3(i, -0.5f, y));
+				transform.SetScale(glm::vec3(0.05f));
+				AddMapObject(i, y, MESH_FLOOR, MATERIAL_FLOOR);
+			}
+			
+		}
+		y++;
+	}
+}
+
+inline glm::mat4 LampMatrix(const glm::vec3 &position, float scale)
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, position);
+	model = glm::scale(model, glm::vec3(scale)); // a smaller cube
+	return model;
+}
+
+// adds a draw for every renderable in the chunks with the given material, to the current pass
+inline void AddMaterialDraws(IndirectDrawList &list, const std::vector<EntityChunk*> &chunks, unsigned int material)
+{
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		const EntityChunk &chunk = *chunks[c];
+		for (unsigned int i = 0; i < chunk.count; i++)
+		{
+			if (chunk.renderables[i].material == material)
+				list.Add(meshRanges[chunk.renderables[i].mesh], chunk.transforms[i], material);
+		}
+	}
+}
+
+// records every map object and nanosuit mesh into the indirect draw list, grouped into one
+// pass per set of textures, and uploads the result
+inline StaticPasses BuildStaticDraws(IndirectDrawList &list, Model &model)
+{
+	StaticPasses passes;
+	list.Clear();
+	std::vector<EntityChunk*> chunks = scene.Query(HAS_TRANSFORM | HAS_RENDERABLE);
+
+	passes.floors = list.BeginPass();
+	AddMaterialDraws(list, chunks, MATERIAL_FLOOR);
+
+	// doors use the wall textures, so they share the pass
+	passes.walls = list.BeginPass();
+	AddMaterialDraws(list, chunks, MATERIAL_WALL);
+
+	// a draw for every node that holds the mesh, placed by the node's transform within the nanosuit
+	for (unsigned int i = 0; i < model.meshes.size(); i++)
+	{
+		passes.meshes.push_back(list.BeginPass());
+		for (unsigned int n = 0; n < model.hierarchy.nodes.size(); n++)
+		{
+			const HierarchyNode &node = model.hierarchy.nodes[n];
+			for (unsigned int m = 0; m < node.meshCount; m++)
+			{
+				if (model.hierarchy.meshes[node.firstMesh + m] != i)
+					continue;
+				const glm::mat4 &nodeWorld = model.nodeTransforms.World(n);
+				for (unsigned int c = 0; c < chunks.size(); c++)
+				{
+					for (unsigned int j = 0; j < chunks[c]->count; j++)
+					{
+						if (chunks[c]->renderables[j].mesh == MESH_NANOSUIT)
+							list.Add(model.meshes[i].range, chunks[c]->transforms[j].World() * nodeWorld, MATERIAL_MESH + i);
+					}
+				}
+			}
+		}
+	}
+
+	passes.lamps = list.BeginPass();
+	list.Add(meshRanges[MESH_LAMP], LampMatrix(lightPos, 0.2f), MATERIAL_LAMP);
+	AddMaterialDraws(list, chunks, MATERIAL_LAMP);
+
+	list.Upload(SharedGeometry());
+	std::cout << "RENDER::static geometry: " << list.commands.size() << " draws in " << list.passes.size() << " passes" << std::endl;
+	return passes;
+}
+
+
+// merges the W cells of the map into as few boxes as possible, greedily growing each unclaimed cell
+// into the widest run along x and then as many rows along z as that run fits
+inline std::vector<AABB> BuildWallOccluders()
+{
+	std::vector<AABB> occluders;
+	// the map cell of every collider that occludes
+	std::vector<glm::ivec2> cells;
+	std::vector<EntityChunk*> chunks = scene.Query(HAS_COLLIDER);
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		for (unsigned int i = 0; i < chunks[c]->count; i++)
+		{
+			const Collider &collider = chunks[c]->colliders[i];
+			if (!collider.occluder)
+				continue;
+			glm::vec3 center = (collider.bounds.min + collider.bounds.max) * 0.5f;
+			cells.push_back(glm::ivec2((int)floor(center.x + 0.5f), (int)floor(center.z + 0.5f)));
+		}
+	}
+	if (cells.empty())
+		return occluders;
+
+	glm::ivec2 gridMin = cells[0];
+	glm::ivec2 gridMax = gridMin;
+	for (unsigned int i = 0; i < cells.size(); i++)
+	{
+		gridMin = glm::min(gridMin, cells[i]);
+		gridMax = glm::max(gridMax, cells[i]);
+	}
+	int gridWidth = gridMax.x - gridMin.x + 1;
+	int gridDepth = gridMax.y - gridMin.y + 1;
+	// 1 for a wall nothing has claimed yet
+	std::vector<unsigned char> open(gridWidth * gridDepth, 0);
+	for (unsigned int i = 0; i < cells.size(); i++)
+		open[(cells[i].y - gridMin.y) * gridWidth + cells[i].x - gridMin.x] = 1;
+
+	for (int z = 0; z < gridDepth; z++)
+	{
+		for (int x = 0; x < gridWidth; x++)
+		{
+			if (!open[z * gridWidth + x])
+				continue;
+			int x1 = x;
+			while (x1 + 1 < gridWidth && open[z * gridWidth + x1 + 1])
+				x1++;
+			int z1 = z;
+			for (bool fits = true; fits && z1 + 1 < gridDepth; )
+			{
+				for (int i = x; i <= x1 && fits; i++)
+					fits = open[(z1 + 1) * gridWidth + i] != 0;
+				if (fits)
+					z1++;
+			}
+			for (int j = z; j <= z1; j++)
+			{
+				for (int i = x; i <= x1; i++)
+					open[j * gridWidth + i] = 0;
+			}
+
+			// the wall cube spans half a unit either side of its cell
+			AABB box;
+			box.min = glm::vec3(gridMin.x + x - 0.5f, -0.5f, gridMin.y + z - 0.5f);
+			box.max = glm::vec3(gridMin.x + x1 + 0.5f, 0.5f, gridMin.y + z1 + 0.5f);
+			occluders.push_back(box);
+		}
+	}
+	return occluders;
+}
+
+// world bounds of every renderable entity, at the entity's id
+inline void BuildEntityBounds(FrustumCuller &culler)
+{
+	culler.Clear();
+	std::vector<EntityChunk*> chunks = scene.Query(HAS_TRANSFORM | HAS_RENDERABLE);
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		const EntityChunk &chunk = *chunks[c];
+		for (unsigned int i = 0; i < chunk.count; i++)
+		{
+			if (chunk.entities[i] >= culler.Size())
+				culler.Resize(chunk.entities[i] + 1);
+			culler.Set(chunk.entities[i], TransformAABB(meshBounds[chunk.renderables[i].mesh], chunk.transforms[i].World()));
+		}
+	}
+}
+#endif
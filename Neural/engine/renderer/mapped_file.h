@@ -0,0 +1,141 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A whole file mapped read only into memory, so it can be read or uploaded in place without being
+// copied into a buffer first. Pages are only read from disk as they are touched.
+class MappedFile
+{
+public:
+	/*  Functions  */
+	MappedFile() : data(NULL), size(0)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+	// false if the file can't be opened or is empty
+	bool Open(const char *path)
+	{
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)fileSize.QuadPart;
+#else
+		int file = open(path, O_RDONLY);
+		if (file < 0)
+			return false;
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			void *mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = (const unsigned char*)mapped;
+				size = status.st_size;
+			}
+		}
+		// the mapping keeps the file alive on its own
+		close(file);
+#endif
+		if (data == NULL)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != NULL)
+			munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	bool IsOpen() const { return data != NULL; }
+	const unsigned char *Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	/*  File data  */
+	const unsigned char *data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+// FNV-1a over 64 bit words rather than bytes, with the high half folded back down after every word since
+// multiplying only carries changes upwards. Cheap enough to hash a whole source file at startup to see
+// whether what was cooked from it is still current
+inline uint64_t HashBytes(const void *bytes, size_t size)
+{
+	const uint64_t prime = 1099511628211ull;
+	uint64_t hash = 14695981039346656037ull;
+	const unsigned char *data = (const unsigned char*)bytes;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ data[i]) * prime;
+	return hash;
+}
+#endif
@@ -7,12 +7,18 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Shader.h"
+#include "geometry_buffer.h"
+#include "instance_buffer.h"
+#include "animation.h"
+#include "command_buffer.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <utility>
+#include <cstring>
 using namespace std;
 
 struct Vertex {
@@ -26,45 +32,190 @@ struct Vertex {
 	glm::vec3 Tangent;
 	// bitangent
 	glm::vec3 Bitangent;
+	// layer of the model's material texture arrays, only used once its materials are merged
+	float Layer;
+	// the bones that move a skinned vertex and their weights out of 255, all 0 for one that isn't skinned
+	unsigned char BoneIds[MAX_BONE_INFLUENCES];
+	unsigned char BoneWeights[MAX_BONE_INFLUENCES];
 };
 
+inline void ClearBones(Vertex &vertex)
+{
+	memset(vertex.BoneIds, 0, sizeof(vertex.BoneIds));
+	memset(vertex.BoneWeights, 0, sizeof(vertex.BoneWeights));
+}
+
+// every mesh and map primitive lives in this one buffer, so they can all be drawn from the same VAO
+inline GeometryBuffer &SharedGeometry()
+{
+	static GeometryBuffer geometry(sizeof(Vertex), {
+		{ 0, 3, GL_FLOAT, offsetof(Vertex, Position) },
+		{ 1, 3, GL_FLOAT, offsetof(Vertex, Normal) },
+		{ 2, 2, GL_FLOAT, offsetof(Vertex, TexCoords) },
+		{ 3, 3, GL_FLOAT, offsetof(Vertex, Tangent) },
+		{ 4, 3, GL_FLOAT, offsetof(Vertex, Bitangent) },
+		{ 6, 1, GL_FLOAT, offsetof(Vertex, Layer) },
+		{ 14, 4, GL_UNSIGNED_BYTE, offsetof(Vertex, BoneIds), true },
+		{ 15, 4, GL_UNSIGNED_BYTE, offsetof(Vertex, BoneWeights), false, true }
+	});
+	return geometry;
+}
+
+// the per instance transforms of every instanced draw out of the shared geometry
+inline InstanceBuffer &SharedInstances()
+{
+	static InstanceBuffer instances(SharedGeometry());
+	return instances;
+}
+
 struct Texture {
 	unsigned int id;
 	string type;
 	string path;
 };
 
+// a mesh as an importer hands it over, before anything is uploaded or any texture is loaded
+struct ImportedTexture {
+	string type;
+	string path;
+};
+
+struct ImportedMesh {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	// diffuse, then specular, normal and height maps
+	vector<ImportedTexture> textures;
+};
+
 class Mesh {
 public:
 	/*  Mesh Data  */
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
-	unsigned int VAO;
+	GeometryRange range;
 
 	/*  Functions  */
-	// constructor
+	// constructor, the arrays are moved in: pass them with std::move and nothing is copied
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), cpuData(true), samplerProgram(0)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
+		samplers = samplerNames();
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
 	}
 
+	// from data that is already laid out as it is drawn, like a cooked model's mapping, which is uploaded
+	// from directly and copied into the mesh in one go rather than vertex by vertex, or not at all without keepCPUData
+	Mesh(const Vertex *vertexData, unsigned int vertexCount, const unsigned int *indexData, unsigned int indexCount, const vector<Texture> &textures, const AABB &bounds,
+		bool keepCPUData = true) : textures(textures), cpuData(keepCPUData), samplerProgram(0)
+	{
+		samplers = samplerNames();
+		if (keepCPUData)
+		{
+			vertices.assign(vertexData, vertexData + vertexCount);
+			indices.assign(indexData, indexData + indexCount);
+		}
+		range = SharedGeometry().Upload(vertexData, vertexCount, indexData, indexCount, &bounds);
+	}
+
+	// vertices and indices are only a copy of what is in the shared geometry buffer once uploaded. Without
+	// them the mesh still draws and range keeps its bounds, they can be handed back with RestoreCPUData
+	bool HasCPUData() const { return cpuData; }
+
+	// bytes the vertices and indices take on the CPU, and what they take in the shared geometry buffer
+	size_t CPUBytes() const { return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int); }
+	size_t GPUBytes() const { return (size_t)range.vertices.size * sizeof(Vertex) + (size_t)range.indices.size * sizeof(unsigned int); }
+
+	void ReleaseCPUData()
+	{
+		// swapped out rather than cleared, clear keeps the memory
+		vector<Vertex>().swap(vertices);
+		vector<unsigned int>().swap(indices);
+		cpuData = false;
+	}
+
+	// false, leaving the mesh alone, when the arrays aren't the ones that were uploaded
+	bool RestoreCPUData(vector<Vertex> &&vertexData, vector<unsigned int> &&indexData)
+	{
+		if (vertexData.size() != range.vertices.size || indexData.size() != range.indices.size)
+			return false;
+		vertices = std::move(vertexData);
+		indices = std::move(indexData);
+		cpuData = true;
+		return true;
+	}
+
 	// render the mesh
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
+	{
+		BindTextures(shader);
+
+		// draw mesh, the shared geometry VAO is expected to be bound already
+		SharedGeometry().Draw(range);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// render the mesh once per instance written to SharedInstances, with the textures bound only once
+	void DrawInstanced(Shader &shader, unsigned int instances)
+	{
+		BindTextures(shader);
+		SharedGeometry().DrawInstanced(range, instances);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// binds the mesh's textures to consecutive units and points the shader's samplers at them
+	void BindTextures(Shader &shader)
+	{
+		// the sampler locations are only looked up again when the program changes
+		if (samplerProgram != shader.ID)
+		{
+			samplerLocations.resize(samplers.size());
+			for (unsigned int i = 0; i < samplers.size(); i++)
+				samplerLocations[i] = glGetUniformLocation(shader.ID, samplers[i].c_str());
+			samplerProgram = shader.ID;
+		}
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+			// now set the sampler to the correct texture unit
+			glUniform1i(samplerLocations[i], i);
+			// and finally bind the texture
+			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		}
+	}
+
+	// records what BindTextures and Draw would do, for replaying on the render thread later
+	void Record(CommandBuffer &commands) const
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			commands.SetInt(samplers[i].c_str(), i);
+			commands.BindTexture(i, textures[i].id);
+		}
+		commands.Draw(range);
+	}
+
+private:
+	bool cpuData;
+	// the sampler every texture is bound to, and their locations in the program last bound for
+	vector<string> samplers;
+	GLuint samplerProgram;
+	vector<GLint> samplerLocations;
+
+	/*  Functions    */
+	// the sampler each texture goes to, the N in texture_diffuseN counts up per type
+	vector<string> samplerNames() const
 	{
-		// bind appropriate textures
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
 		unsigned int normalNr = 1;
 		unsigned int heightNr = 1;
+		vector<string> names;
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
 			// retrieve texture number (the N in diffuse_textureN)
 			string number;
 			string name = textures[i].type;
@@ -76,64 +227,15 @@ public:
 				number = std::to_string(normalNr++); // transfer unsigned int to stream
 			else if (name == "texture_height")
 				number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			names.push_back(name + number);
 		}
-
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+		return names;
 	}
 
-private:
-	/*  Render data  */
-	unsigned int VBO, EBO;
-
-	/*  Functions    */
-	// initializes all the buffer objects/arrays
+	// copies the vertex and index data into the shared geometry buffer
 	void setupMesh()
 	{
-		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
-		glBindVertexArray(VAO);
-		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-		glBindVertexArray(0);
+		range = SharedGeometry().Upload(&vertices[0], vertices.size(), &indices[0], indices.size());
 	}
 };
 #endif
\ No newline at end of file
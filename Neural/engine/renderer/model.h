@@ -13,6 +13,13 @@
 
 #include "mesh.h"
 #include "Shader.h"
+#include "model_cache.h"
+#include "node_hierarchy.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "job_system.h"
+#include "animation.h"
+#include "texture_batch.h"
 
 
 #include <string>
@@ -21,9 +28,72 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <chrono>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory);
+unsigned int TextureArrayFromFiles(const vector<string> &paths, const string &directory, const unsigned char fill[4]);
+
+enum ModelImporter {
+	MODEL_IMPORT_AUTO,   // ObjLoader for .obj files, Assimp for the rest
+	MODEL_IMPORT_ASSIMP,
+	MODEL_IMPORT_OBJ
+};
+
+// what a model does with its meshes' vertices and indices once they are in the shared geometry buffer
+enum ModelResidency {
+	MODEL_KEEP_CPU_DATA,     // keeps them, for anything that reads the geometry back
+	MODEL_RELEASE_CPU_DATA   // frees them, only the ranges and bounds stay. EnsureCPUData reads them again
+};
+
+// whether each mesh keeps its own textures, or the meshes are merged into one draw that picks its
+// material from texture arrays
+enum ModelMaterials {
+	MODEL_SEPARATE_MATERIALS,
+	MODEL_MERGE_MATERIALS
+};
+
+// texture units the merged material arrays are bound to, clear of the units the meshes' own textures use
+const unsigned int MODEL_DIFFUSE_ARRAY_UNIT = 2;
+const unsigned int MODEL_SPECULAR_ARRAY_UNIT = 3;
+
+// one layer of the merged material arrays, an empty path when the material has no such map
+struct MaterialLayer {
+	string diffuse;
+	string specular;
+};
+
+struct ModelMemoryStats {
+	// geometry held on the CPU, held in the shared geometry buffer, and not held on the CPU since it was released
+	size_t cpuBytes;
+	size_t gpuBytes;
+	size_t releasedBytes;
+	unsigned int releasedMeshes;
+};
+
+// a model read from disk by Model::Import, which touches no GL and can run on any thread, waiting to be
+// turned into a Model on the thread that owns the GL context
+struct ImportedModel {
+	string path;
+	string directory;
+	ModelImporter importer = MODEL_IMPORT_AUTO;
+	ModelMaterials materials = MODEL_SEPARATE_MATERIALS;
+	// where the meshes came from, for the log
+	string source;
+	vector<ImportedMesh> meshes;
+	NodeHierarchy hierarchy;
+	// the skeleton and clips of an animated model
+	ModelAnimation animation;
+	// with merged materials, what goes into each layer of the texture arrays
+	vector<MaterialLayer> materialLayers;
+	// set instead of meshes when the source was cooked, the meshes are uploaded straight out of its mapping
+	unique_ptr<CookedModel> cooked;
+	float importMs = 0.0f;
+};
 
 class Model
 {
@@ -31,74 +101,615 @@ public:
 	/*  Model Data */
 	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh> meshes;
+	// the nodes the meshes hang from, and their transforms for drawing the model on its own. Instances
+	// that pose the model differently keep a NodeTransforms of the hierarchy each
+	NodeHierarchy hierarchy;
+	NodeTransforms nodeTransforms;
+	// the skeleton its meshes are skinned to and the clips that move it, empty unless it is animated
+	ModelAnimation animation;
 	string directory;
 	bool gammaCorrection;
+	// where the model was read from, to read it again for EnsureCPUData
+	string path;
+	ModelImporter importer;
+	ModelResidency residency;
+	ModelMaterials materials;
+	// with merged materials, every material's diffuse and specular map as a layer of these, 0 otherwise
+	unsigned int diffuseArray;
+	unsigned int specularArray;
+	unsigned int materialLayers;
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const &path, bool gamma = false, ModelImporter importer = MODEL_IMPORT_AUTO, ModelResidency residency = MODEL_KEEP_CPU_DATA,
+		ModelMaterials materials = MODEL_SEPARATE_MATERIALS)
+		: gammaCorrection(gamma), path(path), importer(importer), residency(residency), materials(materials), diffuseArray(0), specularArray(0), materialLayers(0)
+	{
+		ImportedModel imported;
+		if (Import(path, imported, importer, materials))
+			upload(imported);
+	}
+
+	// uploads a model imported elsewhere, moving its meshes' arrays in. Needs the GL context
+	Model(ImportedModel &&imported, bool gamma = false, ModelResidency residency = MODEL_KEEP_CPU_DATA)
+		: gammaCorrection(gamma), path(imported.path), importer(imported.importer), residency(residency), materials(imported.materials),
+		diffuseArray(0), specularArray(0), materialLayers(0)
+	{
+		upload(imported);
+	}
+
+	bool MergedMaterials() const { return diffuseArray != 0; }
+	bool Skinned() const { return !animation.skeleton.Empty(); }
+
+	// binds the merged material arrays and has the shader sample them instead of material.diffuse and
+	// material.specular until mergedMaterials is set back to false. Nothing without merged materials
+	void BindMaterialArrays(Shader &shader)
+	{
+		if (!MergedMaterials())
+			return;
+		glActiveTexture(GL_TEXTURE0 + MODEL_DIFFUSE_ARRAY_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, diffuseArray);
+		glActiveTexture(GL_TEXTURE0 + MODEL_SPECULAR_ARRAY_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, specularArray);
+		glActiveTexture(GL_TEXTURE0);
+		shader.setBool("mergedMaterials", true);
+	}
+
+	// what BindMaterialArrays does, as commands
+	void RecordMaterialArrays(CommandBuffer &commands) const
 	{
-		loadModel(path);
+		if (!MergedMaterials())
+			return;
+		commands.BindTextureArray(MODEL_DIFFUSE_ARRAY_UNIT, diffuseArray);
+		commands.BindTextureArray(MODEL_SPECULAR_ARRAY_UNIT, specularArray);
+		commands.SetInt("mergedMaterials", 1);
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	// frees every mesh's vertices and indices, they stay drawable
+	void ReleaseCPUData()
 	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].ReleaseCPUData();
+	}
+
+	// gives every mesh its vertices and indices back, reading the model again if any were released. Usually
+	// that maps the cooked copy. False when it can't be read or no longer matches what was uploaded
+	bool EnsureCPUData()
+	{
+		bool released = false;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			released = released || !meshes[i].HasCPUData();
+		if (!released)
+			return true;
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		ImportedModel imported;
+		if (!Import(path, imported, importer, materials))
+			return false;
+		unsigned int count = imported.cooked ? imported.cooked->MeshCount() : imported.meshes.size();
+		bool restored = count == meshes.size();
+		for (unsigned int i = 0; i < meshes.size() && restored; i++)
+		{
+			if (meshes[i].HasCPUData())
+				continue;
+			if (imported.cooked)
+			{
+				const CookedMesh &mesh = imported.cooked->GetMesh(i);
+				const Vertex *vertexData = imported.cooked->Vertices(mesh);
+				const unsigned int *indexData = imported.cooked->Indices(mesh);
+				restored = meshes[i].RestoreCPUData(vector<Vertex>(vertexData, vertexData + mesh.vertexCount),
+					vector<unsigned int>(indexData, indexData + mesh.indexCount));
+			}
+			else
+				restored = meshes[i].RestoreCPUData(std::move(imported.meshes[i].vertices), std::move(imported.meshes[i].indices));
+		}
+		if (!restored)
+		{
+			cout << "ERROR::MODEL::" << path << " changed since it was uploaded, its meshes' data can't be restored" << endl;
+			return false;
+		}
+		cout << "MODEL::" << path << ": restored the meshes' data from " << imported.source << " in "
+			<< chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count() << "ms" << endl;
+		return true;
+	}
+
+	ModelMemoryStats MemoryStats() const
+	{
+		ModelMemoryStats stats = {};
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			stats.cpuBytes += meshes[i].CPUBytes();
+			stats.gpuBytes += meshes[i].GPUBytes();
+			if (!meshes[i].HasCPUData())
+			{
+				stats.releasedBytes += meshes[i].GPUBytes();
+				stats.releasedMeshes++;
+			}
+		}
+		return stats;
+	}
+
+	void PrintMemoryStats() const
+	{
+		ModelMemoryStats stats = MemoryStats();
+		cout << "MODEL::" << path << ": geometry " << stats.gpuBytes / 1024 << "KB on the GPU, " << stats.cpuBytes / 1024 << "KB on the CPU, "
+			<< stats.releasedBytes / 1024 << "KB saved by releasing " << stats.releasedMeshes << " of " << meshes.size() << " meshes" << endl;
+	}
+
+	Model(const Model&) = delete;
+	Model &operator=(const Model&) = delete;
+
+	// draws the model, and thus all its meshes, ignoring the node transforms
+	void Draw(Shader &shader)
+	{
+		BindMaterialArrays(shader);
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
+		if (MergedMaterials())
+			shader.setBool("mergedMaterials", false);
 	}
 
-private:
-	/*  Functions   */
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const &path)
+	// draws every node's meshes with the shader's model and normal matrices set to transform * the node's
+	// transform, with the model's own node transforms or an instance's
+	void Draw(Shader &shader, const glm::mat4 &transform)
+	{
+		Draw(shader, transform, nodeTransforms);
+	}
+
+	void Draw(Shader &shader, const glm::mat4 &transform, const NodeTransforms &instance)
+	{
+		BindMaterialArrays(shader);
+		for (unsigned int i = 0; i < hierarchy.nodes.size(); i++)
+		{
+			const HierarchyNode &node = hierarchy.nodes[i];
+			if (node.meshCount == 0)
+				continue;
+			glm::mat4 world = transform * instance.World(i);
+			shader.setMat4("model", world);
+			shader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(world))));
+			for (unsigned int j = 0; j < node.meshCount; j++)
+				meshes[hierarchy.meshes[node.firstMesh + j]].Draw(shader);
+		}
+		if (MergedMaterials())
+			shader.setBool("mergedMaterials", false);
+	}
+
+	// draws every instance in one draw per mesh rather than one per mesh and instance: each transform takes
+	// the place of Draw's, is written to SharedInstances and read by the shader per instance, see
+	// 2.3.instanced_lighting.vs. The model and normalMatrix uniforms are left the node's own transforms,
+	// which every instance shares. SharedInstances needs a ring to stream through first
+	void DrawInstanced(Shader &shader, const glm::mat4 *transforms, unsigned int count)
 	{
-		// read file via ASSIMP
+		if (count == 0 || !SharedInstances().Write(transforms, count))
+			return;
+		drawInstances(shader, count);
+	}
+
+	void DrawInstanced(Shader &shader, const vector<glm::mat4> &transforms)
+	{
+		if (!transforms.empty())
+			DrawInstanced(shader, &transforms[0], transforms.size());
+	}
+
+	// the same from instances uploaded once, nothing is written per draw
+	void DrawInstanced(Shader &shader, const StaticInstances &instances)
+	{
+		if (instances.count == 0)
+			return;
+		SharedInstances().Use(instances);
+		drawInstances(shader, instances.count);
+	}
+
+	// reads a model with supported ASSIMP extensions into imported without touching GL, so it can run on
+	// any thread. The first import cooks it into path.cooked, later ones map that instead for as long as
+	// the source is unchanged. Materials are merged after either
+	static bool Import(string const &path, ImportedModel &imported, ModelImporter importer = MODEL_IMPORT_AUTO,
+		ModelMaterials materials = MODEL_SEPARATE_MATERIALS)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		imported.path = path;
+		imported.importer = importer;
+		imported.materials = materials;
+		imported.materialLayers.clear();
+		// retrieve the directory path of the filepath
+		imported.directory = path.substr(0, path.find_last_of('/'));
+		imported.meshes.clear();
+		imported.hierarchy.Clear();
+		imported.animation = ModelAnimation();
+		imported.cooked.reset();
+
+		uint64_t sourceHash = 0, sourceSize = 0;
+		{
+			MappedFile source;
+			if (source.Open(path.c_str()))
+			{
+				sourceHash = HashBytes(source.Data(), source.Size());
+				sourceSize = source.Size();
+			}
+		}
+		string cookedPath = path + ".cooked";
+		unique_ptr<CookedModel> cooked(new CookedModel());
+		if (sourceSize > 0 && cooked->Open(cookedPath, sourceHash, sourceSize))
+		{
+			cooked->ReadHierarchy(imported.hierarchy);
+			imported.source = "the cooked copy";
+			// merging rewrites every vertex, so there's nothing to upload from the mapping
+			if (materials == MODEL_MERGE_MATERIALS)
+			{
+				cooked->ReadMeshes(imported.meshes);
+				mergeMaterials(imported);
+			}
+			else
+				imported.cooked = std::move(cooked);
+			imported.importMs = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+			return true;
+		}
+
+		// OBJ files go through ObjLoader, and through Assimp after all if it can't read them
+		bool obj = UsesObjLoader(path, importer);
+		if (obj && !ObjLoader().Load(path, imported.meshes, &Jobs()))
+			obj = false;
+		if (!obj && !ImportAssimp(path, imported.meshes, &Jobs(), &imported.hierarchy, &imported.animation))
+			return false;
+		// OBJ has no hierarchy, its objects and groups are already in model space
+		if (obj)
+			imported.hierarchy.MakeFlat(path.substr(path.find_last_of('/') + 1), imported.meshes.size());
+		imported.source = obj ? "ObjLoader" : "Assimp";
+		imported.importMs = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+		// the cooked format has no place for skeletons or clips, so animated models are always imported
+		if (!imported.animation.Empty())
+			cout << "MODEL::" << path << ": " << imported.animation.skeleton.Size() << " bones and " << imported.animation.clips.size()
+				<< " clips, not cooked" << endl;
+		else if (sourceSize > 0 && !WriteCookedModel(cookedPath, sourceHash, sourceSize, imported.meshes, imported.hierarchy))
+			cout << "ERROR::MODEL::Couldn't write " << cookedPath << endl;
+		if (materials == MODEL_MERGE_MATERIALS)
+		{
+			mergeMaterials(imported);
+			imported.importMs = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+		}
+		return true;
+	}
+
+	// reads a model through Assimp into meshes, and its node tree into hierarchy when given one, without
+	// touching GL. With jobs the meshes are converted side by side, each into its own slot of meshes.
+	// Given animation, the bones the meshes are skinned to and the scene's clips are read into it
+	static bool ImportAssimp(string const &path, vector<ImportedMesh> &meshes, JobSystem *jobs = NULL, NodeHierarchy *hierarchy = NULL,
+		ModelAnimation *animation = NULL)
+	{
+		// read file via ASSIMP, no vertex keeps more than the 4 strongest of its bone weights
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			return false;
+		}
+
+		// process ASSIMP's root node recursively, collecting the meshes in the order they are drawn, then
+		// convert them. The scene is only read from here on, so the conversions can't interfere
+		vector<const aiMesh*> nodeMeshes;
+		vector<int> meshIndices(scene->mNumMeshes, -1);
+		NodeHierarchy nodes;
+		NodeHierarchy &tree = hierarchy != NULL ? *hierarchy : nodes;
+		processNode(scene->mRootNode, -1, scene, nodeMeshes, meshIndices, tree);
+		// the skeleton is gathered up front, so the conversions only look up which bone each mesh's bones are
+		vector<vector<int>> meshBones(nodeMeshes.size());
+		if (animation != NULL)
+		{
+			processBones(nodeMeshes, tree, animation->skeleton, meshBones);
+			processAnimations(scene, tree, animation->clips);
+		}
+		meshes.clear();
+		meshes.resize(nodeMeshes.size());
+		auto convert = [&](unsigned int begin, unsigned int end) {
+			for (unsigned int i = begin; i < end; i++)
+				processMesh(nodeMeshes[i], scene, meshes[i], meshBones[i]);
+		};
+		if (jobs != NULL)
+			jobs->ParallelFor(nodeMeshes.size(), 1, convert);
+		else
+			convert(0, nodeMeshes.size());
+		return true;
+	}
+
+	static bool UsesObjLoader(string const &path, ModelImporter importer)
+	{
+		if (importer != MODEL_IMPORT_AUTO)
+			return importer == MODEL_IMPORT_OBJ;
+		string extension = path.substr(path.find_last_of('.') + 1);
+		for (unsigned int i = 0; i < extension.size(); i++)
+			extension[i] = tolower(extension[i]);
+		return extension == "obj";
+	}
+
+private:
+	/*  Functions   */
+	// a draw per mesh for count instances the attributes already point at
+	void drawInstances(Shader &shader, unsigned int count)
+	{
+		BindMaterialArrays(shader);
+		for (unsigned int i = 0; i < hierarchy.nodes.size(); i++)
+		{
+			const HierarchyNode &node = hierarchy.nodes[i];
+			if (node.meshCount == 0)
+				continue;
+			const glm::mat4 &world = nodeTransforms.World(i);
+			shader.setMat4("model", world);
+			shader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(world))));
+			for (unsigned int j = 0; j < node.meshCount; j++)
+				meshes[hierarchy.meshes[node.firstMesh + j]].DrawInstanced(shader, count);
+		}
+		if (MergedMaterials())
+			shader.setBool("mergedMaterials", false);
+	}
+
+	// creates the meshes and loads their textures from what Import read. Imported meshes are moved into
+	// place, cooked ones are uploaded from the mapping, which is closed once they are all in. With
+	// MODEL_RELEASE_CPU_DATA cooked meshes are never copied out of the mapping, imported ones are freed.
+	// The textures are all queued first and decode on the job system while the meshes go up
+	void upload(ImportedModel &imported)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		directory = imported.directory;
+		TextureBatch textures;
+		if (!imported.materialLayers.empty())
+		{
+			vector<string> diffuse, specular;
+			for (unsigned int i = 0; i < imported.materialLayers.size(); i++)
+			{
+				diffuse.push_back(texturePath(imported.materialLayers[i].diffuse));
+				specular.push_back(texturePath(imported.materialLayers[i].specular));
+			}
+			// a material without a map reads white diffuse and no specular, like the defaults of a sampler
+			const unsigned char white[4] = { 255, 255, 255, 255 };
+			const unsigned char black[4] = { 0, 0, 0, 255 };
+			diffuseArray = textures.AddArray(diffuse, white);
+			specularArray = textures.AddArray(specular, black);
+			materialLayers = imported.materialLayers.size();
+		}
+		if (imported.cooked)
+		{
+			const CookedModel &cooked = *imported.cooked;
+			meshes.reserve(cooked.MeshCount());
+			for (unsigned int i = 0; i < cooked.MeshCount(); i++)
+			{
+				const CookedMesh &mesh = cooked.GetMesh(i);
+				vector<Texture> meshTextures;
+				for (unsigned int j = 0; j < mesh.textureCount; j++)
+				{
+					const CookedTexture &texture = cooked.GetTexture(mesh.firstTexture + j);
+					meshTextures.push_back(loadTexture(textures, cooked.TexturePath(texture), cooked.TextureType(texture)));
+				}
+				AABB bounds;
+				bounds.min = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+				bounds.max = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+				meshes.push_back(Mesh(cooked.Vertices(mesh), mesh.vertexCount, cooked.Indices(mesh), mesh.indexCount, meshTextures, bounds,
+					residency == MODEL_KEEP_CPU_DATA));
+			}
+			imported.cooked.reset();
+		}
+		else
+		{
+			meshes.reserve(imported.meshes.size());
+			for (unsigned int i = 0; i < imported.meshes.size(); i++)
+			{
+				ImportedMesh &mesh = imported.meshes[i];
+				vector<Texture> meshTextures;
+				for (unsigned int j = 0; j < mesh.textures.size(); j++)
+					meshTextures.push_back(loadTexture(textures, mesh.textures[j].path, mesh.textures[j].type));
+				meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), std::move(meshTextures)));
+				if (residency == MODEL_RELEASE_CPU_DATA)
+					meshes.back().ReleaseCPUData();
+			}
+			imported.meshes.clear();
+		}
+		textures.Upload();
+		textures.PrintStats("MODEL::" + imported.path + " textures");
+		hierarchy = std::move(imported.hierarchy);
+		animation = std::move(imported.animation);
+		if (hierarchy.Size() == 0 || !hierarchy.Valid(meshes.size()))
+		{
+			// the bones and clips point at nodes of the hierarchy that was thrown away
+			hierarchy.MakeFlat(imported.path.substr(imported.path.find_last_of('/') + 1), meshes.size());
+			animation = ModelAnimation();
+		}
+		nodeTransforms.Reset(hierarchy);
+		cout << "MODEL::" << imported.path << ": " << meshes.size() << " meshes in " << hierarchy.Size() << " nodes from " << imported.source
+			<< ", read in " << imported.importMs << "ms, uploaded in " << chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count() << "ms" << endl;
+		PrintMemoryStats();
+	}
+
+	// Merges every mesh into one, placed by its node's transform, so the whole model is a single draw.
+	// Each distinct pair of diffuse and specular maps becomes a layer of the material texture arrays and
+	// every vertex is given the layer of its mesh; normal and height maps are dropped, the scene shaders
+	// don't sample them. The hierarchy collapses to one node, so a merged model can't move its parts.
+	static void mergeMaterials(ImportedModel &imported)
+	{
+		if (imported.meshes.empty())
+			return;
+		// the skeleton and clips move nodes that would no longer be there
+		if (!imported.animation.Empty())
+		{
+			cout << "MODEL::" << imported.path << ": animated, its materials are left separate" << endl;
 			return;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
+		if (imported.hierarchy.Size() == 0 || !imported.hierarchy.Valid(imported.meshes.size()))
+			imported.hierarchy.MakeFlat("", imported.meshes.size());
+		NodeTransforms transforms(imported.hierarchy);
+		const NodeHierarchy &nodes = imported.hierarchy;
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		ImportedMesh merged;
+		size_t vertexCount = 0, indexCount = 0;
+		for (unsigned int i = 0; i < nodes.meshes.size(); i++)
+		{
+			vertexCount += imported.meshes[nodes.meshes[i]].vertices.size();
+			indexCount += imported.meshes[nodes.meshes[i]].indices.size();
+		}
+		merged.vertices.reserve(vertexCount);
+		merged.indices.reserve(indexCount);
+
+		vector<MaterialLayer> &layers = imported.materialLayers;
+		layers.clear();
+		for (unsigned int n = 0; n < nodes.nodes.size(); n++)
+		{
+			const glm::mat4 &world = transforms.World(n);
+			glm::mat3 basis = glm::mat3(world);
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(basis));
+			bool identity = world == glm::mat4(1.0f);
+			for (unsigned int m = 0; m < nodes.nodes[n].meshCount; m++)
+			{
+				const ImportedMesh &mesh = imported.meshes[nodes.meshes[nodes.nodes[n].firstMesh + m]];
+				MaterialLayer material;
+				for (unsigned int t = 0; t < mesh.textures.size(); t++)
+				{
+					// the first map of each type
+					if (mesh.textures[t].type == "texture_diffuse" && material.diffuse.empty())
+						material.diffuse = mesh.textures[t].path;
+					else if (mesh.textures[t].type == "texture_specular" && material.specular.empty())
+						material.specular = mesh.textures[t].path;
+				}
+				unsigned int layer = 0;
+				while (layer < layers.size() && (layers[layer].diffuse != material.diffuse || layers[layer].specular != material.specular))
+					layer++;
+				if (layer == layers.size())
+					layers.push_back(material);
+
+				unsigned int base = merged.vertices.size();
+				for (unsigned int v = 0; v < mesh.vertices.size(); v++)
+				{
+					Vertex vertex = mesh.vertices[v];
+					if (!identity)
+					{
+						vertex.Position = glm::vec3(world * glm::vec4(vertex.Position, 1.0f));
+						vertex.Normal = normalMatrix * vertex.Normal;
+						vertex.Tangent = basis * vertex.Tangent;
+						vertex.Bitangent = basis * vertex.Bitangent;
+					}
+					vertex.Layer = (float)layer;
+					merged.vertices.push_back(vertex);
+				}
+				for (unsigned int i = 0; i < mesh.indices.size(); i++)
+					merged.indices.push_back(base + mesh.indices[i]);
+			}
+		}
+		cout << "MODEL::" << imported.path << ": merged " << imported.meshes.size() << " meshes into one draw with " << layers.size() << " material layers" << endl;
+		imported.meshes.resize(1);
+		imported.meshes[0] = std::move(merged);
+		imported.hierarchy.MakeFlat(imported.path.substr(imported.path.find_last_of('/') + 1), 1);
 	}
 
-	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	// processes a node in a recursive fashion. Adds the node with its transform to the hierarchy, collects the meshes located at
+	// the node and repeats this process on its children nodes (if any), so parents always come before their children.
+	static void processNode(const aiNode *node, int parent, const aiScene *scene, vector<const aiMesh*> &meshes, vector<int> &meshIndices,
+		NodeHierarchy &hierarchy)
 	{
+		unsigned int index = hierarchy.AddNode(parent, node->mName.C_Str(), convertMatrix(node->mTransformation));
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			// A mesh several nodes use is only converted the first time.
+			unsigned int sceneMesh = node->mMeshes[i];
+			if (meshIndices[sceneMesh] < 0)
+			{
+				meshIndices[sceneMesh] = meshes.size();
+				meshes.push_back(scene->mMeshes[sceneMesh]);
+			}
+			hierarchy.AddMesh(meshIndices[sceneMesh]);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], index, scene, meshes, meshIndices, hierarchy);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// assimp's matrices are row major, glm's column major
+	static glm::mat4 convertMatrix(const aiMatrix4x4 &m)
+	{
+		return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2), glm::vec4(m.a3, m.b3, m.c3, m.d3), glm::vec4(m.a4, m.b4, m.c4, m.d4));
+	}
+
+	// adds every bone of the meshes to the skeleton once, by name, and records for each mesh which skeleton
+	// bone each of its bones became, -1 for a bone whose node can't be found or that doesn't fit in a byte
+	static void processBones(const vector<const aiMesh*> &meshes, const NodeHierarchy &hierarchy, Skeleton &skeleton, vector<vector<int>> &meshBones)
+	{
+		for (unsigned int m = 0; m < meshes.size(); m++)
+		{
+			meshBones[m].assign(meshes[m]->mNumBones, -1);
+			for (unsigned int b = 0; b < meshes[m]->mNumBones; b++)
+			{
+				const aiBone *bone = meshes[m]->mBones[b];
+				string name = bone->mName.C_Str();
+				int index = skeleton.Find(name);
+				int node = hierarchy.Find(name);
+				if (index < 0 && node >= 0 && skeleton.Size() < MAX_BONES)
+					index = skeleton.Add(name, node, convertMatrix(bone->mOffsetMatrix));
+				else if (index < 0)
+					cout << "ERROR::ASSIMP::Bone " << name << (node < 0 ? " has no node" : " is one too many") << ", its weights are dropped" << endl;
+				meshBones[m][b] = index;
+			}
+		}
+	}
+
+	// converts every animation of the scene into a clip, its keys reduced and its rotations quantized
+	static void processAnimations(const aiScene *scene, const NodeHierarchy &hierarchy, vector<AnimationClip> &clips)
+	{
+		for (unsigned int a = 0; a < scene->mNumAnimations; a++)
+		{
+			const aiAnimation *animation = scene->mAnimations[a];
+			// assimp counts in ticks, leaving the rate 0 where the file doesn't say
+			float secondsPerTick = 1.0f / (float)(animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0);
+			RawClip raw;
+			raw.name = animation->mName.C_Str();
+			raw.duration = (float)animation->mDuration * secondsPerTick;
+			for (unsigned int c = 0; c < animation->mNumChannels; c++)
+			{
+				const aiNodeAnim *source = animation->mChannels[c];
+				int node = hierarchy.Find(source->mNodeName.C_Str());
+				if (node < 0)
+					continue;
+				RawChannel channel;
+				channel.node = node;
+				for (unsigned int k = 0; k < source->mNumPositionKeys; k++)
+				{
+					const aiVectorKey &key = source->mPositionKeys[k];
+					channel.positions.push_back({ (float)key.mTime * secondsPerTick, glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
+				}
+				for (unsigned int k = 0; k < source->mNumRotationKeys; k++)
+				{
+					const aiQuatKey &key = source->mRotationKeys[k];
+					channel.rotations.push_back({ (float)key.mTime * secondsPerTick, glm::vec4(key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w) });
+				}
+				for (unsigned int k = 0; k < source->mNumScalingKeys; k++)
+				{
+					const aiVectorKey &key = source->mScalingKeys[k];
+					channel.scales.push_back({ (float)key.mTime * secondsPerTick, glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
+				}
+				raw.channels.push_back(channel);
+			}
+			clips.push_back(AnimationClip::Compress(raw));
+			cout << "ASSIMP::Clip " << raw.name << ": " << raw.channels.size() << " channels, " << raw.duration << "s, keys reduced from "
+				<< raw.Bytes() / 1024 << "KB to " << clips.back().Bytes() / 1024 << "KB" << endl;
+		}
+	}
+
+	// converts one mesh into imported, whose arrays are sized up front and filled in place. bones maps the
+	// mesh's bones to the skeleton's
+	static void processMesh(const aiMesh *mesh, const aiScene *scene, ImportedMesh &imported, const vector<int> &bones)
 	{
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		vector<Vertex> &vertices = imported.vertices;
+		vector<unsigned int> &indices = imported.indices;
+		vector<ImportedTexture> &textures = imported.textures;
 
 		// Walk through each of the mesh's vertices
+		vertices.resize(mesh->mNumVertices);
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
+			Vertex &vertex = vertices[i];
 			glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
 			// positions
 			vector.x = mesh->mVertices[i].x;
@@ -132,12 +743,56 @@ private:
 			vector.y = mesh->mBitangents[i].y;
 			vector.z = mesh->mBitangents[i].z;
 			vertex.Bitangent = vector;
-			vertices.push_back(vertex);
+			vertex.Layer = 0.0f;
+			ClearBones(vertex);
+		}
+		// each vertex keeps the weights of up to MAX_BONE_INFLUENCES bones, packed into bytes
+		if (!bones.empty())
+		{
+			vector<float> weights(vertices.size() * MAX_BONE_INFLUENCES, 0.0f);
+			vector<unsigned char> ids(vertices.size() * MAX_BONE_INFLUENCES, 0);
+			for (unsigned int b = 0; b < mesh->mNumBones; b++)
+			{
+				if (bones[b] < 0)
+					continue;
+				const aiBone *bone = mesh->mBones[b];
+				for (unsigned int w = 0; w < bone->mNumWeights; w++)
+				{
+					const aiVertexWeight &weight = bone->mWeights[w];
+					if (weight.mVertexId >= vertices.size())
+						continue;
+					// into the weakest slot, if this one is stronger
+					float *slots = &weights[weight.mVertexId * MAX_BONE_INFLUENCES];
+					unsigned int weakest = 0;
+					for (unsigned int i = 1; i < MAX_BONE_INFLUENCES; i++)
+					{
+						if (slots[i] < slots[weakest])
+							weakest = i;
+					}
+					if (weight.mWeight > slots[weakest])
+					{
+						slots[weakest] = weight.mWeight;
+						ids[weight.mVertexId * MAX_BONE_INFLUENCES + weakest] = (unsigned char)bones[b];
+					}
+				}
+			}
+			for (unsigned int i = 0; i < vertices.size(); i++)
+			{
+				PackBoneWeights(&weights[i * MAX_BONE_INFLUENCES], vertices[i].BoneWeights);
+				for (unsigned int j = 0; j < MAX_BONE_INFLUENCES; j++)
+					vertices[i].BoneIds[j] = vertices[i].BoneWeights[j] > 0 ? ids[i * MAX_BONE_INFLUENCES + j] : 0;
+			}
 		}
 		// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+		// Faces are triangles after aiProcess_Triangulate, apart from any stray points or lines
+		unsigned int indexCount = 0;
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+			indexCount += mesh->mFaces[i].mNumIndices;
+		indices.reserve(indexCount);
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			// by reference, copying an aiFace copies its index array
+			const aiFace &face = mesh->mFaces[i];
 			// retrieve all indices of the face and store them in the indices vector
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
@@ -152,94 +807,74 @@ private:
 		// normal: texture_normalN
 
 		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+		loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
 		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+		loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
 		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+		loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
 		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+		loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// the textures are loaded once the mesh is uploaded
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// appends the material's textures of a given type, by path and the sampler type they're bound as
+	static void loadMaterialTextures(const aiMaterial *mat, aiTextureType type, string typeName, vector<ImportedTexture> &textures)
 	{
-		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			ImportedTexture texture;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+			textures.push_back(texture);
 		}
-		return textures;
 	}
-};
-
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-	string filename = string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+	// a texture's path relative to the model as one to open, empty stays empty
+	string texturePath(const string &path) const
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+		return path.empty() ? path : directory + '/' + path;
 	}
-	else
+
+	// queues a texture by its path relative to the model, unless it was loaded before
+	Texture loadTexture(TextureBatch &batch, const string &path, const string &typeName)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		// check if texture was loaded before and if so, skip loading a new texture
+		for (unsigned int j = 0; j < textures_loaded.size(); j++)
+		{
+			if (textures_loaded[j].path == path)
+				return textures_loaded[j]; // a texture with the same filepath has already been loaded. (optimization)
+		}
+		// if texture hasn't been loaded already, load it
+		Texture texture;
+		texture.id = batch.Add(texturePath(path));
+		texture.type = typeName;
+		texture.path = path;
+		textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		return texture;
 	}
+};
+
+
+unsigned int TextureFromFile(const char *path, const string &directory)
+{
+	TextureBatch batch;
+	unsigned int texture = batch.Add(directory + '/' + path);
+	batch.Upload();
+	return texture;
+}
 
-	return textureID;
+// loads the images as the layers of one RGBA texture array, see TextureBatch::AddArray
+unsigned int TextureArrayFromFiles(const vector<string> &paths, const string &directory, const unsigned char fill[4])
+{
+	TextureBatch batch;
+	vector<string> files;
+	for (unsigned int i = 0; i < paths.size(); i++)
+		files.push_back(paths[i].empty() ? paths[i] : directory + '/' + paths[i]);
+	unsigned int texture = batch.AddArray(files, fill);
+	batch.Upload();
+	return texture;
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,322 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include "mesh.h"
+#include "mapped_file.h"
+#include "node_hierarchy.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+
+// Models imported through Assimp are written out once in a binary form that loads by mapping the file
+// and uploading the vertex and index blobs straight out of the mapping. A cooked file sits next to its
+// source as <source>.cooked and remembers the hash and size of the source it was made from, so editing
+// the source makes it cook again.
+//
+// Layout, every section starting on a COOKED_MODEL_ALIGNMENT boundary:
+//   CookedModelHeader
+//   CookedMesh[meshCount]
+//   CookedTexture[textureCount], the textures of each mesh in a run
+//   CookedNode[nodeCount], the node hierarchy with parents before children
+//   uint32_t[nodeMeshCount], the mesh indices of each node in a run
+//   strings, the texture types and paths and the node names, not null terminated
+//   per mesh, its Vertex array and then its unsigned int indices
+
+// "NMDL"
+const uint32_t COOKED_MODEL_MAGIC = 0x4c444d4e;
+// bump whenever the layout, Vertex or the import flags change, older files are cooked again
+const uint32_t COOKED_MODEL_VERSION = 4;
+const uint32_t COOKED_MODEL_ALIGNMENT = 16;
+
+struct CookedModelHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint64_t fileSize;
+	uint32_t vertexStride;
+	uint32_t meshCount;
+	uint32_t textureCount;
+	uint32_t stringBytes;
+	uint64_t meshOffset;
+	uint64_t textureOffset;
+	uint64_t stringOffset;
+	uint32_t nodeCount;
+	uint32_t nodeMeshCount;
+	uint64_t nodeOffset;
+	uint64_t nodeMeshOffset;
+};
+
+struct CookedMesh {
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct CookedTexture {
+	uint32_t typeOffset;
+	uint32_t typeLength;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+struct CookedNode {
+	int32_t parent;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t firstMesh;
+	uint32_t meshCount;
+	// column major, like glm
+	float local[16];
+};
+
+// a cooked file mapped into memory, everything it hands out points into the mapping
+class CookedModel
+{
+public:
+	/*  Functions  */
+	CookedModel() : header(NULL)
+	{
+	}
+
+	// false if the file is missing, from another version or source, or doesn't hold together
+	bool Open(const std::string &path, uint64_t sourceHash, uint64_t sourceSize)
+	{
+		Close();
+		if (!file.Open(path.c_str()) || file.Size() < sizeof(CookedModelHeader))
+			return fail();
+		header = (const CookedModelHeader*)file.Data();
+		if (header->magic != COOKED_MODEL_MAGIC || header->version != COOKED_MODEL_VERSION || header->vertexStride != sizeof(Vertex)
+			|| header->sourceHash != sourceHash || header->sourceSize != sourceSize || header->fileSize != file.Size())
+			return fail();
+		if (!fits(header->meshOffset, (uint64_t)header->meshCount * sizeof(CookedMesh))
+			|| !fits(header->textureOffset, (uint64_t)header->textureCount * sizeof(CookedTexture))
+			|| !fits(header->stringOffset, header->stringBytes)
+			|| !fits(header->nodeOffset, (uint64_t)header->nodeCount * sizeof(CookedNode))
+			|| !fits(header->nodeMeshOffset, (uint64_t)header->nodeMeshCount * sizeof(uint32_t)))
+			return fail();
+		for (unsigned int i = 0; i < header->meshCount; i++)
+		{
+			const CookedMesh &mesh = GetMesh(i);
+			if (!fits(mesh.vertexOffset, (uint64_t)mesh.vertexCount * sizeof(Vertex)) || !fits(mesh.indexOffset, (uint64_t)mesh.indexCount * sizeof(unsigned int))
+				|| mesh.vertexOffset % COOKED_MODEL_ALIGNMENT != 0 || mesh.indexOffset % COOKED_MODEL_ALIGNMENT != 0
+				|| (uint64_t)mesh.firstTexture + mesh.textureCount > header->textureCount)
+				return fail();
+		}
+		for (unsigned int i = 0; i < header->textureCount; i++)
+		{
+			const CookedTexture &texture = GetTexture(i);
+			if ((uint64_t)texture.typeOffset + texture.typeLength > header->stringBytes || (uint64_t)texture.pathOffset + texture.pathLength > header->stringBytes)
+				return fail();
+		}
+		for (unsigned int i = 0; i < header->nodeCount; i++)
+		{
+			const CookedNode &node = nodes()[i];
+			if (node.parent >= (int32_t)i || (uint64_t)node.firstMesh + node.meshCount > header->nodeMeshCount
+				|| (uint64_t)node.nameOffset + node.nameLength > header->stringBytes)
+				return fail();
+		}
+		for (unsigned int i = 0; i < header->nodeMeshCount; i++)
+		{
+			if (nodeMeshes()[i] >= header->meshCount)
+				return fail();
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		file.Close();
+		header = NULL;
+	}
+
+	unsigned int MeshCount() const { return header->meshCount; }
+	const CookedMesh &GetMesh(unsigned int index) const { return ((const CookedMesh*)(file.Data() + header->meshOffset))[index]; }
+	const CookedTexture &GetTexture(unsigned int index) const { return ((const CookedTexture*)(file.Data() + header->textureOffset))[index]; }
+
+	const Vertex *Vertices(const CookedMesh &mesh) const { return (const Vertex*)(file.Data() + mesh.vertexOffset); }
+	const unsigned int *Indices(const CookedMesh &mesh) const { return (const unsigned int*)(file.Data() + mesh.indexOffset); }
+
+	std::string TextureType(const CookedTexture &texture) const { return std::string(strings() + texture.typeOffset, texture.typeLength); }
+	std::string TexturePath(const CookedTexture &texture) const { return std::string(strings() + texture.pathOffset, texture.pathLength); }
+
+	// copies every mesh out of the mapping, for changing them before they are uploaded
+	void ReadMeshes(std::vector<ImportedMesh> &meshes) const
+	{
+		meshes.resize(header->meshCount);
+		for (unsigned int i = 0; i < header->meshCount; i++)
+		{
+			const CookedMesh &mesh = GetMesh(i);
+			meshes[i].vertices.assign(Vertices(mesh), Vertices(mesh) + mesh.vertexCount);
+			meshes[i].indices.assign(Indices(mesh), Indices(mesh) + mesh.indexCount);
+			meshes[i].textures.resize(mesh.textureCount);
+			for (unsigned int j = 0; j < mesh.textureCount; j++)
+			{
+				const CookedTexture &texture = GetTexture(mesh.firstTexture + j);
+				meshes[i].textures[j].type = TextureType(texture);
+				meshes[i].textures[j].path = TexturePath(texture);
+			}
+		}
+	}
+
+	void ReadHierarchy(NodeHierarchy &hierarchy) const
+	{
+		hierarchy.Clear();
+		for (unsigned int i = 0; i < header->nodeCount; i++)
+		{
+			const CookedNode &node = nodes()[i];
+			glm::mat4 local;
+			memcpy(&local[0][0], node.local, sizeof(node.local));
+			hierarchy.AddNode(node.parent, std::string(strings() + node.nameOffset, node.nameLength), local);
+			for (unsigned int j = 0; j < node.meshCount; j++)
+				hierarchy.AddMesh(nodeMeshes()[node.firstMesh + j]);
+		}
+	}
+
+private:
+	/*  Cache data  */
+	MappedFile file;
+	const CookedModelHeader *header;
+
+	const char *strings() const { return (const char*)(file.Data() + header->stringOffset); }
+	const CookedNode *nodes() const { return (const CookedNode*)(file.Data() + header->nodeOffset); }
+	const uint32_t *nodeMeshes() const { return (const uint32_t*)(file.Data() + header->nodeMeshOffset); }
+
+	bool fits(uint64_t offset, uint64_t size) const
+	{
+		return offset <= file.Size() && size <= file.Size() - offset;
+	}
+
+	bool fail()
+	{
+		Close();
+		return false;
+	}
+};
+
+inline uint64_t AlignCooked(uint64_t offset)
+{
+	return (offset + COOKED_MODEL_ALIGNMENT - 1) / COOKED_MODEL_ALIGNMENT * COOKED_MODEL_ALIGNMENT;
+}
+
+// writes the imported meshes and their hierarchy out as a cooked file for the source with the given hash
+// and size. Needs no GL, so it runs wherever the import did. The file is written under a temporary name and
+// renamed, so a cook that's cut short never leaves a broken file behind
+inline bool WriteCookedModel(const std::string &path, uint64_t sourceHash, uint64_t sourceSize, const std::vector<ImportedMesh> &meshes,
+	const NodeHierarchy &hierarchy)
+{
+	CookedModelHeader header = {};
+	header.magic = COOKED_MODEL_MAGIC;
+	header.version = COOKED_MODEL_VERSION;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.vertexStride = sizeof(Vertex);
+	header.meshCount = meshes.size();
+
+	std::vector<CookedMesh> cookedMeshes(meshes.size());
+	std::vector<CookedTexture> textures;
+	std::string strings;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		CookedMesh &mesh = cookedMeshes[i];
+		mesh.vertexCount = meshes[i].vertices.size();
+		mesh.indexCount = meshes[i].indices.size();
+		mesh.firstTexture = textures.size();
+		mesh.textureCount = meshes[i].textures.size();
+		AABB bounds;
+		for (unsigned int j = 0; j < meshes[i].vertices.size(); j++)
+			bounds.Expand(meshes[i].vertices[j].Position);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			mesh.boundsMin[axis] = bounds.min[axis];
+			mesh.boundsMax[axis] = bounds.max[axis];
+		}
+		for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+		{
+			const ImportedTexture &texture = meshes[i].textures[j];
+			CookedTexture cooked;
+			cooked.typeOffset = strings.size();
+			cooked.typeLength = texture.type.size();
+			strings += texture.type;
+			cooked.pathOffset = strings.size();
+			cooked.pathLength = texture.path.size();
+			strings += texture.path;
+			textures.push_back(cooked);
+		}
+	}
+	std::vector<CookedNode> nodes(hierarchy.nodes.size());
+	for (unsigned int i = 0; i < nodes.size(); i++)
+	{
+		const HierarchyNode &node = hierarchy.nodes[i];
+		nodes[i].parent = node.parent;
+		nodes[i].nameOffset = strings.size();
+		nodes[i].nameLength = node.name.size();
+		strings += node.name;
+		nodes[i].firstMesh = node.firstMesh;
+		nodes[i].meshCount = node.meshCount;
+		memcpy(nodes[i].local, &hierarchy.localTransforms[i][0][0], sizeof(nodes[i].local));
+	}
+	header.textureCount = textures.size();
+	header.nodeCount = nodes.size();
+	header.nodeMeshCount = hierarchy.meshes.size();
+	header.stringBytes = strings.size();
+
+	// lay the sections out, then the geometry of every mesh after them
+	header.meshOffset = AlignCooked(sizeof(CookedModelHeader));
+	header.textureOffset = AlignCooked(header.meshOffset + cookedMeshes.size() * sizeof(CookedMesh));
+	header.nodeOffset = AlignCooked(header.textureOffset + textures.size() * sizeof(CookedTexture));
+	header.nodeMeshOffset = AlignCooked(header.nodeOffset + nodes.size() * sizeof(CookedNode));
+	header.stringOffset = AlignCooked(header.nodeMeshOffset + hierarchy.meshes.size() * sizeof(uint32_t));
+	uint64_t offset = AlignCooked(header.stringOffset + strings.size());
+	for (unsigned int i = 0; i < cookedMeshes.size(); i++)
+	{
+		cookedMeshes[i].vertexOffset = offset;
+		offset = AlignCooked(offset + (uint64_t)cookedMeshes[i].vertexCount * sizeof(Vertex));
+		cookedMeshes[i].indexOffset = offset;
+		offset = AlignCooked(offset + (uint64_t)cookedMeshes[i].indexCount * sizeof(unsigned int));
+	}
+	header.fileSize = offset;
+
+	std::string temporary = path + ".tmp";
+	std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+	uint64_t written = 0;
+	auto write = [&](uint64_t at, const void *data, uint64_t size) {
+		static const char padding[COOKED_MODEL_ALIGNMENT] = {};
+		out.write(padding, at - written);
+		if (size > 0)
+			out.write((const char*)data, size);
+		written = at + size;
+	};
+	write(0, &header, sizeof(header));
+	write(header.meshOffset, cookedMeshes.empty() ? NULL : &cookedMeshes[0], cookedMeshes.size() * sizeof(CookedMesh));
+	write(header.textureOffset, textures.empty() ? NULL : &textures[0], textures.size() * sizeof(CookedTexture));
+	write(header.nodeOffset, nodes.empty() ? NULL : &nodes[0], nodes.size() * sizeof(CookedNode));
+	write(header.nodeMeshOffset, hierarchy.meshes.empty() ? NULL : &hierarchy.meshes[0], hierarchy.meshes.size() * sizeof(uint32_t));
+	write(header.stringOffset, strings.data(), strings.size());
+	for (unsigned int i = 0; i < cookedMeshes.size(); i++)
+	{
+		write(cookedMeshes[i].vertexOffset, meshes[i].vertices.empty() ? NULL : &meshes[i].vertices[0], (uint64_t)cookedMeshes[i].vertexCount * sizeof(Vertex));
+		write(cookedMeshes[i].indexOffset, meshes[i].indices.empty() ? NULL : &meshes[i].indices[0], (uint64_t)cookedMeshes[i].indexCount * sizeof(unsigned int));
+	}
+	write(header.fileSize, NULL, 0);
+	out.close();
+	if (!out)
+	{
+		std::remove(temporary.c_str());
+		return false;
+	}
+	// rename won't replace an existing file everywhere
+	std::remove(path.c_str());
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+#endif
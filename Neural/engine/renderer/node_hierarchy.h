@@ -0,0 +1,176 @@
+#ifndef NODE_HIERARCHY_H
+#define NODE_HIERARCHY_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+struct HierarchyNode {
+	// index of the parent node, always lower than the node's own, or -1 for the root
+	int parent;
+	std::string name;
+	// the node's meshes are meshes[firstMesh, firstMesh + meshCount) of the hierarchy, which hold indices
+	// into the model's meshes
+	unsigned int firstMesh;
+	unsigned int meshCount;
+};
+
+// The node tree of a model, flattened into an array in which every parent comes before its children,
+// along with each node's local transform as it was imported. It never changes once built, so every
+// instance of the model shares the one hierarchy and keeps only a NodeTransforms of its own.
+class NodeHierarchy
+{
+public:
+	/*  Hierarchy data  */
+	std::vector<HierarchyNode> nodes;
+	std::vector<glm::mat4> localTransforms;
+	std::vector<unsigned int> meshes;
+
+	/*  Functions  */
+	// parent must already have been added, the node's meshes are added with AddMesh before the next node
+	unsigned int AddNode(int parent, const std::string &name, const glm::mat4 &local)
+	{
+		HierarchyNode node;
+		node.parent = parent < (int)nodes.size() ? parent : -1;
+		node.name = name;
+		node.firstMesh = meshes.size();
+		node.meshCount = 0;
+		nodes.push_back(node);
+		localTransforms.push_back(local);
+		return nodes.size() - 1;
+	}
+
+	void AddMesh(unsigned int mesh)
+	{
+		meshes.push_back(mesh);
+		nodes.back().meshCount++;
+	}
+
+	// a single node holding every mesh, for formats without a hierarchy
+	void MakeFlat(const std::string &name, unsigned int meshCount)
+	{
+		Clear();
+		AddNode(-1, name, glm::mat4(1.0f));
+		for (unsigned int i = 0; i < meshCount; i++)
+			AddMesh(i);
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		localTransforms.clear();
+		meshes.clear();
+	}
+
+	unsigned int Size() const { return nodes.size(); }
+
+	// -1 when no node has the name
+	int Find(const std::string &name) const
+	{
+		for (unsigned int i = 0; i < nodes.size(); i++)
+		{
+			if (nodes[i].name == name)
+				return i;
+		}
+		return -1;
+	}
+
+	// false when a parent doesn't come before its child or a mesh index is out of range
+	bool Valid(unsigned int meshCount) const
+	{
+		if (localTransforms.size() != nodes.size())
+			return false;
+		for (unsigned int i = 0; i < nodes.size(); i++)
+		{
+			if (nodes[i].parent >= (int)i || (uint64_t)nodes[i].firstMesh + nodes[i].meshCount > meshes.size())
+				return false;
+		}
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i] >= meshCount)
+				return false;
+		}
+		return true;
+	}
+};
+
+// One instance's transforms for the nodes of a NodeHierarchy: a local transform per node, starting out
+// as the imported ones, and the cached model space transform of every node. Setting a local transform
+// only marks the node dirty. Update then walks the array once front to back, and since parents come
+// first each dirty node passes its flag on to its children just before they're reached, so a moved
+// node brings its whole subtree along and untouched subtrees are skipped.
+class NodeTransforms
+{
+public:
+	/*  Functions  */
+	NodeTransforms() : hierarchy(NULL), anyDirty(false)
+	{
+	}
+
+	// the hierarchy has to outlive the transforms
+	explicit NodeTransforms(const NodeHierarchy &hierarchy)
+	{
+		Reset(hierarchy);
+	}
+
+	// back to the hierarchy's imported transforms, with the world transforms up to date
+	void Reset(const NodeHierarchy &nodeHierarchy)
+	{
+		hierarchy = &nodeHierarchy;
+		local = hierarchy->localTransforms;
+		world.resize(local.size());
+		dirty.assign(local.size(), 1);
+		anyDirty = true;
+		Update();
+	}
+
+	unsigned int Size() const { return local.size(); }
+
+	void SetLocal(unsigned int node, const glm::mat4 &transform)
+	{
+		local[node] = transform;
+		dirty[node] = 1;
+		anyDirty = true;
+	}
+
+	const glm::mat4 &Local(unsigned int node) const { return local[node]; }
+	// model space, as of the last Update
+	const glm::mat4 &World(unsigned int node) const { return world[node]; }
+	bool Dirty() const { return anyDirty; }
+
+	// recomputes the world transform of every node that, or whose ancestor, was set since the last
+	// update, and returns how many that was
+	unsigned int Update()
+	{
+		if (!anyDirty)
+			return 0;
+		unsigned int updated = 0;
+		const std::vector<HierarchyNode> &nodes = hierarchy->nodes;
+		for (unsigned int i = 0; i < nodes.size(); i++)
+		{
+			int parent = nodes[i].parent;
+			if (parent >= 0 && dirty[parent])
+				dirty[i] = 1;
+			if (!dirty[i])
+				continue;
+			world[i] = parent >= 0 ? world[parent] * local[i] : local[i];
+			updated++;
+		}
+		// only cleared once the pass is done, children read their parent's flag during it
+		std::fill(dirty.begin(), dirty.end(), 0);
+		anyDirty = false;
+		return updated;
+	}
+
+private:
+	/*  Instance data  */
+	const NodeHierarchy *hierarchy;
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<unsigned char> dirty;
+	bool anyDirty;
+};
+#endif
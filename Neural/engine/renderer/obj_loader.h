@@ -0,0 +1,593 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "mapped_file.h"
+#include "job_system.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+
+// bytes of OBJ text each parse job takes, rounded up to the end of a line
+const size_t OBJ_LOADER_CHUNK = 1 << 20;
+// a face corner without a texture coordinate or normal
+const unsigned int OBJ_NO_INDEX = 0xFFFFFFFF;
+// set on indices counted from the start of the chunk, resolved once every chunk's counts are known. The
+// other 31 bits are signed, negative ones reach back into earlier chunks
+const unsigned int OBJ_LOCAL_INDEX = 0x80000000;
+
+// Parses a decimal float at p, returning where it stopped, or p itself if there was no number there.
+// The digits are gathered into an integer and scaled by one exact power of ten, which gives the correctly
+// rounded double whenever the digits fit in 53 bits and the exponent is within 22 (every number an
+// exporter writes); anything else goes through strtod.
+inline const char *ParseObjFloat(const char *p, const char *end, float &value)
+{
+	static const double powers[23] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	const char *first = p;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+		mantissa = mantissa * 10 + (*p - '0');
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && (unsigned)(*p - '0') < 10; p++, digits++, exponent--)
+			mantissa = mantissa * 10 + (*p - '0');
+	}
+	if (p == first || (p == first + 1 && *first == '.'))
+		return start;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+		if (q < end && (unsigned)(*q - '0') < 10)
+		{
+			int e = 0;
+			for (; q < end && (unsigned)(*q - '0') < 10; q++)
+				e = std::min(e * 10 + (*q - '0'), 100000);
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	if (digits <= 15 && exponent >= -22 && exponent <= 22)
+	{
+		double result = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+	// too many digits or too large an exponent to be exact, strtod wants the text null terminated
+	char buffer[64];
+	size_t length = std::min((size_t)(p - start), sizeof(buffer) - 1);
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+	value = (float)strtod(buffer, NULL);
+	return p;
+}
+
+// a face index as written, 1 based or negative counting back from the last attribute, or 0 if missing
+inline const char *ParseObjIndex(const char *p, const char *end, long long &index)
+{
+	bool negative = false;
+	if (p < end && *p == '-')
+	{
+		negative = true;
+		p++;
+	}
+	long long value = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++)
+		value = std::min(value * 10 + (*p - '0'), 1ll << 40);
+	index = negative ? -value : value;
+	return p;
+}
+
+// Imports OBJ files and their MTL materials straight into ImportedMeshes, as a faster stand-in for
+// Assimp on static props. The file is mapped and cut into chunks at line ends, and each chunk is parsed
+// by its own job into its own arrays; face indices that count back from the end are kept relative to the
+// chunk until the chunks' attribute counts have been added up. A new mesh starts wherever the material
+// or the object/group changes, as Assimp splits them, and each mesh is built by its own job: faces are
+// fanned into triangles, identical position/texture/normal corners share one vertex, texture coordinates
+// are flipped vertically and tangents and bitangents are accumulated per vertex, as Assimp's
+// FlipUVs and CalcTangentSpace would.
+class ObjLoader
+{
+public:
+	/*  Functions  */
+	// false if the file can't be read or refers to attributes it doesn't have
+	bool Load(const std::string &path, std::vector<ImportedMesh> &meshes, JobSystem *jobs = NULL)
+	{
+		meshes.clear();
+		materials.clear();
+		MappedFile file;
+		if (!file.Open(path.c_str()))
+		{
+			std::cout << "ERROR::OBJ::Can't open " << path << std::endl;
+			return false;
+		}
+		const char *text = (const char*)file.Data();
+		const char *textEnd = text + file.Size();
+
+		// cut the file into chunks that end on a line end
+		std::vector<Chunk> chunks;
+		for (const char *p = text; p < textEnd;)
+		{
+			const char *chunkEnd = p + std::min((size_t)(textEnd - p), OBJ_LOADER_CHUNK);
+			const char *newline = chunkEnd < textEnd ? (const char*)memchr(chunkEnd, '\n', textEnd - chunkEnd) : NULL;
+			chunkEnd = newline != NULL ? newline + 1 : (chunkEnd < textEnd ? textEnd : chunkEnd);
+			Chunk chunk;
+			chunk.begin = p;
+			chunk.end = chunkEnd;
+			chunks.push_back(chunk);
+			p = chunkEnd;
+		}
+		forEach(jobs, chunks.size(), [&](unsigned int i) { parseChunk(chunks[i]); });
+
+		// where each chunk's attributes start in the file's, to resolve the indices against
+		unsigned int positions = 0, texCoords = 0, normals = 0;
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			chunks[i].positionBase = positions;
+			chunks[i].texCoordBase = texCoords;
+			chunks[i].normalBase = normals;
+			positions += chunks[i].positions.size();
+			texCoords += chunks[i].texCoords.size();
+			normals += chunks[i].normals.size();
+		}
+		forEach(jobs, chunks.size(), [&](unsigned int i) { chunks[i].valid = resolveChunk(chunks[i], positions, texCoords, normals); });
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			if (!chunks[i].valid)
+			{
+				std::cout << "ERROR::OBJ::" << path << " refers to vertices it doesn't have" << std::endl;
+				return false;
+			}
+		}
+
+		// the materials, then the runs of faces of every chunk joined up into meshes
+		std::string directory = path.substr(0, path.find_last_of('/') + 1);
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			for (unsigned int j = 0; j < chunks[i].libraries.size(); j++)
+				loadMaterials(directory + chunks[i].libraries[j]);
+		}
+		std::vector<MeshParts> parts;
+		std::string material;
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			for (unsigned int j = 0; j < chunks[i].runs.size(); j++)
+			{
+				const Run &run = chunks[i].runs[j];
+				if (run.setsMaterial)
+					material = run.material;
+				size_t runEnd = j + 1 < chunks[i].runs.size() ? chunks[i].runs[j + 1].firstCorner : chunks[i].corners.size();
+				// a chunk picks up where the last one left off, and a usemtl of the material already in use
+				// doesn't start anything new
+				bool continues = !parts.empty() && (run.continues || (run.setsMaterial && !run.startsObject && parts.back().material == material));
+				if (!continues)
+				{
+					MeshParts mesh;
+					mesh.material = material;
+					parts.push_back(mesh);
+				}
+				if (runEnd > run.firstCorner)
+				{
+					Part part = { &chunks[i], run.firstCorner, runEnd };
+					parts.back().parts.push_back(part);
+				}
+			}
+		}
+		// meshes without faces are dropped
+		std::vector<MeshParts> filled;
+		for (unsigned int i = 0; i < parts.size(); i++)
+		{
+			if (!parts[i].parts.empty())
+				filled.push_back(parts[i]);
+		}
+
+		meshes.resize(filled.size());
+		std::vector<glm::vec3> allPositions, allNormals;
+		std::vector<glm::vec2> allTexCoords;
+		gather(chunks, allPositions, allTexCoords, allNormals);
+		forEach(jobs, filled.size(), [&](unsigned int i) {
+			buildMesh(filled[i], allPositions, allTexCoords, allNormals, meshes[i]);
+		});
+		return true;
+	}
+
+private:
+	struct Corner {
+		unsigned int position, texCoord, normal;
+	};
+
+	// corners from firstCorner on belong to a new mesh, or with continues to whatever came before the chunk
+	struct Run {
+		size_t firstCorner;
+		bool continues;
+		bool startsObject;
+		bool setsMaterial;
+		std::string material;
+	};
+
+	struct Chunk {
+		const char *begin, *end;
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texCoords;
+		// three per triangle
+		std::vector<Corner> corners;
+		std::vector<Run> runs;
+		std::vector<std::string> libraries;
+		unsigned int positionBase, texCoordBase, normalBase;
+		// every index in range once resolved
+		bool valid;
+	};
+
+	struct Part {
+		const Chunk *chunk;
+		size_t begin, end;
+	};
+
+	struct MeshParts {
+		std::string material;
+		std::vector<Part> parts;
+	};
+
+	struct Material {
+		std::string name;
+		// in the order Model binds them
+		std::string diffuse, specular, normal, height;
+	};
+
+	/*  Loader data  */
+	std::vector<Material> materials;
+
+	template <typename Function>
+	static void forEach(JobSystem *jobs, unsigned int count, const Function &function)
+	{
+		if (jobs == NULL)
+		{
+			for (unsigned int i = 0; i < count; i++)
+				function(i);
+			return;
+		}
+		jobs->ParallelFor(count, 1, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int i = begin; i < end; i++)
+				function(i);
+		});
+	}
+
+	static const char *skipSpaces(const char *p, const char *end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	static bool startsWith(const char *p, const char *end, const char *word)
+	{
+		size_t length = strlen(word);
+		return (size_t)(end - p) > length && memcmp(p, word, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+	}
+
+	// the rest of the line without surrounding whitespace
+	static std::string restOfLine(const char *p, const char *end)
+	{
+		p = skipSpaces(p, end);
+		while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		return std::string(p, end);
+	}
+
+	static void parseChunk(Chunk &chunk)
+	{
+		Run first = { 0, true, false, false, "" };
+		chunk.runs.push_back(first);
+		std::vector<Corner> polygon;
+		for (const char *line = chunk.begin; line < chunk.end;)
+		{
+			const char *lineEnd = (const char*)memchr(line, '\n', chunk.end - line);
+			const char *next = lineEnd != NULL ? lineEnd + 1 : chunk.end;
+			if (lineEnd == NULL)
+				lineEnd = chunk.end;
+			if (lineEnd > line && lineEnd[-1] == '\r')
+				lineEnd--;
+			const char *p = skipSpaces(line, lineEnd);
+			line = next;
+			if (p == lineEnd)
+				continue;
+
+			if (p[0] == 'v' && lineEnd - p > 1 && (p[1] == ' ' || p[1] == '\t'))
+			{
+				glm::vec3 position(0.0f);
+				p += 2;
+				for (int i = 0; i < 3; i++)
+					p = ParseObjFloat(skipSpaces(p, lineEnd), lineEnd, position[i]);
+				chunk.positions.push_back(position);
+			}
+			else if (startsWith(p, lineEnd, "vt"))
+			{
+				glm::vec2 texCoord(0.0f);
+				p += 3;
+				for (int i = 0; i < 2; i++)
+					p = ParseObjFloat(skipSpaces(p, lineEnd), lineEnd, texCoord[i]);
+				chunk.texCoords.push_back(texCoord);
+			}
+			else if (startsWith(p, lineEnd, "vn"))
+			{
+				glm::vec3 normal(0.0f);
+				p += 3;
+				for (int i = 0; i < 3; i++)
+					p = ParseObjFloat(skipSpaces(p, lineEnd), lineEnd, normal[i]);
+				chunk.normals.push_back(normal);
+			}
+			else if (p[0] == 'f' && lineEnd - p > 1 && (p[1] == ' ' || p[1] == '\t'))
+			{
+				polygon.clear();
+				for (p = skipSpaces(p + 2, lineEnd); p < lineEnd; p = skipSpaces(p, lineEnd))
+				{
+					long long index[3] = { 0, 0, 0 };
+					const char *start = p;
+					p = ParseObjIndex(p, lineEnd, index[0]);
+					for (int i = 1; i < 3 && p < lineEnd && *p == '/'; i++)
+						p = ParseObjIndex(p + 1, lineEnd, index[i]);
+					if (p == start)
+						break;
+					Corner corner;
+					corner.position = relative(index[0], chunk.positions.size());
+					corner.texCoord = relative(index[1], chunk.texCoords.size());
+					corner.normal = relative(index[2], chunk.normals.size());
+					polygon.push_back(corner);
+				}
+				// fanned around the first corner; points and lines aren't drawn
+				for (size_t i = 2; i < polygon.size(); i++)
+				{
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+					chunk.corners.push_back(polygon[i]);
+				}
+			}
+			else if (startsWith(p, lineEnd, "usemtl"))
+			{
+				Run run = { chunk.corners.size(), false, false, true, restOfLine(p + 6, lineEnd) };
+				chunk.runs.push_back(run);
+			}
+			else if (startsWith(p, lineEnd, "o") || startsWith(p, lineEnd, "g"))
+			{
+				Run run = { chunk.corners.size(), false, true, false, "" };
+				chunk.runs.push_back(run);
+			}
+			else if (startsWith(p, lineEnd, "mtllib"))
+				chunk.libraries.push_back(restOfLine(p + 6, lineEnd));
+		}
+	}
+
+	// 1 based indices are already global, negative ones are kept relative to the chunk until its base is known.
+	// Anything out of range comes out as OBJ_LOCAL_INDEX - 1, which no file has that many vertices to reach
+	static unsigned int relative(long long index, size_t count)
+	{
+		if (index > 0)
+			return index - 1 < OBJ_LOCAL_INDEX - 1 ? (unsigned int)(index - 1) : OBJ_LOCAL_INDEX - 1;
+		if (index < 0)
+		{
+			long long local = (long long)count + index;
+			return local >= -(1ll << 30) ? OBJ_LOCAL_INDEX | ((unsigned int)local & ~OBJ_LOCAL_INDEX) : OBJ_LOCAL_INDEX - 1;
+		}
+		return OBJ_NO_INDEX;
+	}
+
+	static bool resolve(unsigned int &index, unsigned int base, unsigned int count, bool optional)
+	{
+		if (index == OBJ_NO_INDEX)
+			return optional;
+		if (index & OBJ_LOCAL_INDEX)
+		{
+			// sign extend the 31 bit offset
+			long long resolved = (long long)base + ((int)(index << 1) >> 1);
+			if (resolved < 0)
+				return false;
+			index = (unsigned int)std::min(resolved, (long long)OBJ_LOCAL_INDEX - 1);
+		}
+		return index < count;
+	}
+
+	static bool resolveChunk(Chunk &chunk, unsigned int positions, unsigned int texCoords, unsigned int normals)
+	{
+		for (size_t i = 0; i < chunk.corners.size(); i++)
+		{
+			Corner &corner = chunk.corners[i];
+			if (!resolve(corner.position, chunk.positionBase, positions, false) || !resolve(corner.texCoord, chunk.texCoordBase, texCoords, true)
+				|| !resolve(corner.normal, chunk.normalBase, normals, true))
+				return false;
+		}
+		return true;
+	}
+
+	static void gather(const std::vector<Chunk> &chunks, std::vector<glm::vec3> &positions, std::vector<glm::vec2> &texCoords, std::vector<glm::vec3> &normals)
+	{
+		for (unsigned int i = 0; i < chunks.size(); i++)
+		{
+			positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+			texCoords.insert(texCoords.end(), chunks[i].texCoords.begin(), chunks[i].texCoords.end());
+			normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		}
+	}
+
+	void buildMesh(const MeshParts &parts, const std::vector<glm::vec3> &positions, const std::vector<glm::vec2> &texCoords,
+		const std::vector<glm::vec3> &normals, ImportedMesh &mesh) const
+	{
+		size_t cornerCount = 0;
+		for (unsigned int i = 0; i < parts.parts.size(); i++)
+			cornerCount += parts.parts[i].end - parts.parts[i].begin;
+
+		// open addressing over the corners seen so far, at most half full
+		size_t slotCount = 16;
+		while (slotCount < cornerCount * 2)
+			slotCount *= 2;
+		std::vector<unsigned int> slots(slotCount, OBJ_NO_INDEX);
+		std::vector<Corner> unique;
+		unique.reserve(cornerCount / 2);
+		mesh.vertices.clear();
+		mesh.vertices.reserve(cornerCount / 2);
+		mesh.indices.resize(cornerCount);
+		size_t next = 0;
+		for (unsigned int i = 0; i < parts.parts.size(); i++)
+		{
+			const Part &part = parts.parts[i];
+			for (size_t c = part.begin; c < part.end; c++)
+			{
+				const Corner &corner = part.chunk->corners[c];
+				uint64_t hash = corner.position * 0x9E3779B97F4A7C15ull ^ corner.texCoord * 0xC2B2AE3D27D4EB4Full ^ corner.normal * 0x165667B19E3779F9ull;
+				size_t slot = (hash ^ (hash >> 29)) & (slotCount - 1);
+				while (slots[slot] != OBJ_NO_INDEX)
+				{
+					const Corner &seen = unique[slots[slot]];
+					if (seen.position == corner.position && seen.texCoord == corner.texCoord && seen.normal == corner.normal)
+						break;
+					slot = (slot + 1) & (slotCount - 1);
+				}
+				if (slots[slot] == OBJ_NO_INDEX)
+				{
+					slots[slot] = unique.size();
+					unique.push_back(corner);
+					Vertex vertex;
+					vertex.Position = positions[corner.position];
+					vertex.Normal = corner.normal != OBJ_NO_INDEX ? normals[corner.normal] : glm::vec3(0.0f);
+					vertex.TexCoords = corner.texCoord != OBJ_NO_INDEX ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+					vertex.TexCoords.y = 1.0f - vertex.TexCoords.y;
+					vertex.Tangent = glm::vec3(0.0f);
+					vertex.Bitangent = glm::vec3(0.0f);
+					vertex.Layer = 0.0f;
+					ClearBones(vertex);
+					mesh.vertices.push_back(vertex);
+				}
+				mesh.indices[next++] = slots[slot];
+			}
+		}
+		calculateTangents(mesh);
+
+		mesh.textures.clear();
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			if (materials[i].name != parts.material)
+				continue;
+			addTexture(mesh, "texture_diffuse", materials[i].diffuse);
+			addTexture(mesh, "texture_specular", materials[i].specular);
+			addTexture(mesh, "texture_normal", materials[i].normal);
+			addTexture(mesh, "texture_height", materials[i].height);
+			break;
+		}
+	}
+
+	static void addTexture(ImportedMesh &mesh, const char *type, const std::string &path)
+	{
+		if (path.empty())
+			return;
+		ImportedTexture texture;
+		texture.type = type;
+		texture.path = path;
+		mesh.textures.push_back(texture);
+	}
+
+	// tangent and bitangent of every triangle from its texture coordinates, summed onto its vertices and
+	// made perpendicular to each vertex normal
+	static void calculateTangents(ImportedMesh &mesh)
+	{
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			Vertex &a = mesh.vertices[mesh.indices[i]];
+			Vertex &b = mesh.vertices[mesh.indices[i + 1]];
+			Vertex &c = mesh.vertices[mesh.indices[i + 2]];
+			glm::vec3 edge1 = b.Position - a.Position, edge2 = c.Position - a.Position;
+			glm::vec2 uv1 = b.TexCoords - a.TexCoords, uv2 = c.TexCoords - a.TexCoords;
+			float determinant = uv1.x * uv2.y - uv2.x * uv1.y;
+			if (determinant == 0.0f)
+				continue;
+			float inverse = 1.0f / determinant;
+			glm::vec3 tangent = (edge1 * uv2.y - edge2 * uv1.y) * inverse;
+			glm::vec3 bitangent = (edge2 * uv1.x - edge1 * uv2.x) * inverse;
+			a.Tangent += tangent; b.Tangent += tangent; c.Tangent += tangent;
+			a.Bitangent += bitangent; b.Bitangent += bitangent; c.Bitangent += bitangent;
+		}
+		for (size_t i = 0; i < mesh.vertices.size(); i++)
+		{
+			Vertex &vertex = mesh.vertices[i];
+			vertex.Tangent = orthonormal(vertex.Tangent, vertex.Normal);
+			vertex.Bitangent = orthonormal(vertex.Bitangent, vertex.Normal);
+		}
+	}
+
+	static glm::vec3 orthonormal(const glm::vec3 &v, const glm::vec3 &normal)
+	{
+		glm::vec3 projected = v - normal * glm::dot(normal, v);
+		float length = glm::length(projected);
+		return length > 1e-12f ? projected / length : glm::vec3(0.0f);
+	}
+
+	// newmtl blocks and the texture maps of each, map_Bump is the normal map as Assimp reads it
+	void loadMaterials(const std::string &path)
+	{
+		MappedFile file;
+		if (!file.Open(path.c_str()))
+		{
+			std::cout << "ERROR::OBJ::Can't open material library " << path << std::endl;
+			return;
+		}
+		const char *text = (const char*)file.Data();
+		const char *textEnd = text + file.Size();
+		for (const char *line = text; line < textEnd;)
+		{
+			const char *lineEnd = (const char*)memchr(line, '\n', textEnd - line);
+			const char *next = lineEnd != NULL ? lineEnd + 1 : textEnd;
+			if (lineEnd == NULL)
+				lineEnd = textEnd;
+			if (lineEnd > line && lineEnd[-1] == '\r')
+				lineEnd--;
+			const char *p = skipSpaces(line, lineEnd);
+			line = next;
+
+			if (startsWith(p, lineEnd, "newmtl"))
+			{
+				Material material;
+				material.name = restOfLine(p + 6, lineEnd);
+				materials.push_back(material);
+			}
+			else if (!materials.empty() && startsWith(p, lineEnd, "map_Kd"))
+				materials.back().diffuse = mapPath(p + 6, lineEnd);
+			else if (!materials.empty() && startsWith(p, lineEnd, "map_Ks"))
+				materials.back().specular = mapPath(p + 6, lineEnd);
+			else if (!materials.empty() && startsWith(p, lineEnd, "map_Ka"))
+				materials.back().height = mapPath(p + 6, lineEnd);
+			else if (!materials.empty() && (startsWith(p, lineEnd, "map_Bump") || startsWith(p, lineEnd, "map_bump")))
+				materials.back().normal = mapPath(p + 8, lineEnd);
+			else if (!materials.empty() && startsWith(p, lineEnd, "bump"))
+				materials.back().normal = mapPath(p + 4, lineEnd);
+		}
+	}
+
+	// the file name of a texture map, after any -option arguments
+	static std::string mapPath(const char *p, const char *end)
+	{
+		std::string rest = restOfLine(p, end);
+		if (!rest.empty() && rest[0] == '-')
+		{
+			size_t space = rest.find_last_of(" \t");
+			if (space != std::string::npos)
+				return rest.substr(space + 1);
+		}
+		return rest;
+	}
+};
+#endif
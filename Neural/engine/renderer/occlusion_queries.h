@@ -0,0 +1,141 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+
+struct OcclusionQueryStats {
+	unsigned int frames;
+	// rooms whose query was issued, and how many of those results said nothing of the box showed
+	unsigned int queried;
+	unsigned int hidden;
+	// rooms drawn without a condition because they had no query from the frame before
+	unsigned int unconditional;
+};
+
+// A pool of GL_ANY_SAMPLES_PASSED queries, two per room, created once and reused every frame.
+// Each frame draws the rooms conditionally on the queries issued the frame before and issues the
+// other half of the pool, so nothing ever waits on a result: a query the GPU hasn't finished yet
+// just lets the room draw (GL_QUERY_NO_WAIT). Works on any GL 3.3 context.
+class OcclusionQueries
+{
+public:
+	/*  Functions  */
+	OcclusionQueries() : rooms(0), current(0)
+	{
+		ResetStats();
+	}
+
+	// one pair of queries per room, a no-op when the pool already has that many
+	void Create(unsigned int roomCount)
+	{
+		if (roomCount == rooms)
+			return;
+		Release();
+		rooms = roomCount;
+		for (int slot = 0; slot < 2; slot++)
+		{
+			queries[slot].resize(rooms);
+			issued[slot].assign(rooms, 0);
+			if (rooms > 0)
+				glGenQueries(rooms, &queries[slot][0]);
+		}
+	}
+
+	bool Enabled() const { return rooms > 0; }
+
+	// the queries issued last frame become the ones rooms are drawn against
+	void NextFrame()
+	{
+		if (!Enabled())
+			return;
+		current ^= 1;
+		stats.frames++;
+		// stats only look at results that are already in, they never wait for one
+		std::vector<unsigned char> &previous = issued[current ^ 1];
+		for (unsigned int i = 0; i < rooms; i++)
+		{
+			if (!previous[i])
+				continue;
+			GLuint available = 0, samples = 1;
+			glGetQueryObjectuiv(queries[current ^ 1][i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+				glGetQueryObjectuiv(queries[current ^ 1][i], GL_QUERY_RESULT, &samples);
+			stats.queried++;
+			stats.hidden += samples == 0;
+		}
+		issued[current].assign(rooms, 0);
+	}
+
+	// starts drawing the room conditionally on last frame's query, returns false when the room has
+	// none and is drawn regardless
+	bool BeginConditional(unsigned int room)
+	{
+		if (!Enabled())
+			return false;
+		if (!issued[current ^ 1][room])
+		{
+			stats.unconditional++;
+			return false;
+		}
+		glBeginConditionalRender(queries[current ^ 1][room], GL_QUERY_NO_WAIT);
+		return true;
+	}
+
+	void EndConditional(bool began)
+	{
+		if (began)
+			glEndConditionalRender();
+	}
+
+	// the caller draws the room's bounding box between these, with colour and depth writes off
+	void BeginQuery(unsigned int room)
+	{
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[current][room]);
+		issued[current][room] = 1;
+	}
+
+	void EndQuery()
+	{
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+	}
+
+	const OcclusionQueryStats &Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats = OcclusionQueryStats();
+	}
+
+	void PrintStats() const
+	{
+		if (stats.frames == 0)
+			return;
+		std::cout << "QUERIES::" << rooms << " rooms, per frame " << (float)stats.queried / stats.frames << " queried, "
+			<< (float)stats.hidden / stats.frames << " hidden, " << (float)stats.unconditional / stats.frames << " drawn unconditionally" << std::endl;
+	}
+
+	void Release()
+	{
+		for (int slot = 0; slot < 2; slot++)
+		{
+			if (!queries[slot].empty())
+				glDeleteQueries((GLsizei)queries[slot].size(), &queries[slot][0]);
+			queries[slot].clear();
+			issued[slot].clear();
+		}
+		rooms = 0;
+	}
+
+private:
+	/*  Query data  */
+	unsigned int rooms;
+	// the slot being issued this frame, the other one holds last frame's queries
+	int current;
+	std::vector<GLuint> queries[2];
+	std::vector<unsigned char> issued[2];
+	OcclusionQueryStats stats;
+};
+#endif
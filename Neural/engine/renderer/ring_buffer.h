@@ -0,0 +1,204 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "gl_ext.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// frames the CPU may be writing ahead of the GPU
+const unsigned int RING_BUFFER_FRAMES = 3;
+
+struct RingAllocation {
+	// where to write, good until the frame ends
+	void *data;
+	// the same bytes as an offset into Buffer(), to bind or draw from
+	GLintptr offset;
+};
+
+struct RingBufferStats {
+	unsigned int frames;
+	// frames whose region the GPU was still reading, and the time spent waiting for it to finish
+	unsigned int waits;
+	float waitMs;
+	// the most any frame allocated, and allocations that didn't fit
+	GLsizeiptr peakBytes;
+	unsigned int overflows;
+};
+
+// One GL buffer for data written every frame, split into a region per frame in flight and handed out
+// front to back within a frame. Where buffer storage is available the whole buffer stays mapped
+// persistently and coherently, so allocations point straight into memory the GPU reads: nothing is
+// allocated or copied by the driver per frame. A fence is placed at the end of every frame, and a
+// region is only written again once the GPU is done with the frame that used it last.
+//
+// On GL 3.3 allocations point into a copy of the region on the CPU instead and Flush uploads what was
+// written since the last flush with glBufferSubData. Rotating through the regions still keeps the
+// driver from having to wait on or copy a range the GPU is reading.
+class RingBuffer
+{
+public:
+	/*  Functions  */
+	RingBuffer() : buffer(0), mapped(NULL), frameSize(0), frame(0), used(0), flushed(0)
+	{
+		ResetStats();
+	}
+
+	// frameSize is the most one frame can allocate, alignment padding included
+	void Create(GLsizeiptr size, unsigned int frames = RING_BUFFER_FRAMES)
+	{
+		Release();
+		// regions start on a boundary every alignment a caller can ask for divides
+		frameSize = (size + 255) / 256 * 256;
+		fences.assign(frames, (GLsync)0);
+		frame = 0;
+		used = flushed = 0;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (GLExt.bufferStorage)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			GLExt.BufferStorage(GL_COPY_WRITE_BUFFER, frameSize * frames, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameSize * frames, flags);
+		}
+		if (mapped == NULL)
+		{
+			// a buffer made with glBufferStorage can't be respecified, so one whose mapping failed is replaced
+			if (GLExt.bufferStorage)
+			{
+				glDeleteBuffers(1, &buffer);
+				glGenBuffers(1, &buffer);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			}
+			glBufferData(GL_COPY_WRITE_BUFFER, frameSize * frames, NULL, GL_STREAM_DRAW);
+			staging.resize(frameSize);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	bool Persistent() const { return mapped != NULL; }
+	unsigned int Buffer() const { return buffer; }
+
+	// moves on to the next region, waiting for the GPU if it is still reading it
+	void BeginFrame()
+	{
+		frame = (frame + 1) % fences.size();
+		used = flushed = 0;
+		stats.frames++;
+		GLsync fence = fences[frame];
+		if (fence == 0)
+			return;
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			// a second at a time, so a lost context can't hang the render thread forever without a word
+			while (glClientWaitSync(fence, flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+			{
+				std::cout << "ERROR::RING_BUFFER::Still waiting for frame " << frame << " after a second" << std::endl;
+				flags = 0;
+			}
+			stats.waits++;
+			stats.waitMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		glDeleteSync(fence);
+		fences[frame] = 0;
+	}
+
+	// false, leaving allocation alone, when the frame's region has no room left
+	bool Allocate(GLsizeiptr size, GLsizeiptr alignment, RingAllocation &allocation)
+	{
+		GLsizeiptr start = (used + alignment - 1) / alignment * alignment;
+		if (start + size > frameSize)
+		{
+			stats.overflows++;
+			return false;
+		}
+		used = start + size;
+		stats.peakBytes = std::max(stats.peakBytes, used);
+		allocation.data = (mapped != NULL ? mapped + frame * frameSize : &staging[0]) + start;
+		allocation.offset = frame * frameSize + start;
+		return true;
+	}
+
+	// uploads what was allocated since the last flush on GL 3.3, call it before drawing with any of it
+	void Flush()
+	{
+		if (mapped == NULL && used > flushed)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, frame * frameSize + flushed, used - flushed, &staging[flushed]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		flushed = used;
+	}
+
+	// fences the region once every command reading it has been issued
+	void EndFrame()
+	{
+		Flush();
+		if (mapped != NULL)
+			fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	RingBufferStats Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats.frames = 0;
+		stats.waits = 0;
+		stats.waitMs = 0.0f;
+		stats.peakBytes = 0;
+		stats.overflows = 0;
+	}
+
+	void PrintStats() const
+	{
+		if (stats.frames == 0)
+			return;
+		std::cout << "RING::" << (mapped != NULL ? "persistent" : "glBufferSubData") << ", " << stats.frames << " frames, waited on the GPU "
+			<< stats.waits << " times for " << stats.waitMs / stats.frames << "ms per frame, at most " << stats.peakBytes << " of " << frameSize
+			<< " bytes a frame";
+		if (stats.overflows > 0)
+			std::cout << ", " << stats.overflows << " allocations didn't fit";
+		std::cout << std::endl;
+	}
+
+	void Release()
+	{
+		for (unsigned int i = 0; i < fences.size(); i++)
+		{
+			if (fences[i] != 0)
+				glDeleteSync(fences[i]);
+		}
+		fences.clear();
+		if (mapped != NULL)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		mapped = NULL;
+		staging.clear();
+	}
+
+private:
+	/*  Ring data  */
+	unsigned int buffer;
+	unsigned char *mapped;
+	// the region being written on GL 3.3
+	std::vector<unsigned char> staging;
+	std::vector<GLsync> fences;
+	GLsizeiptr frameSize;
+	unsigned int frame;
+	GLsizeiptr used, flushed;
+	RingBufferStats stats;
+};
+#endif
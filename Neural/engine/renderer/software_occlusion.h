@@ -0,0 +1,551 @@
+#ifndef SOFTWARE_OCCLUSION_H
+#define SOFTWARE_OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "cpu_features.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iostream>
+
+// the widest a row step can be, rows start on a multiple of it from the tile whichever kernel runs
+#if CPU_SSE2
+#define SOFTWARE_OCCLUSION_LANES 8
+#else
+#define SOFTWARE_OCCLUSION_LANES 1
+#endif
+
+// one occluder triangle after clipping, snapping and setup
+struct OcclusionTriangle {
+	// edge functions a*x + b*y + c at the centre of pixel (x, y), the pixel is covered when all three reach
+	// their threshold: 0 for top and left edges, the smallest step an edge function can take otherwise
+	float a[3], b[3], c[3], threshold[3];
+	// furthest depth of the triangle's plane inside pixel (x, y): zx*x + zy*y + zc
+	float zx, zy, zc;
+	// pixels whose centres fall inside the triangle's bounding box
+	int minX, minY, maxX, maxY;
+};
+
+struct SoftwareOcclusionStats {
+	unsigned int triangles;
+	float setupMs;
+	float rasterMs;
+	// per tile rasterisation time of the last frame, slowest and average
+	float slowestTileUs;
+	float averageTileUs;
+	// boxes tested since the last reset and how many of those were outside the view or behind the occluders
+	unsigned int tested;
+	unsigned int outside;
+	unsigned int occluded;
+};
+
+// Software rasteriser for occlusion culling on the CPU, no GL involved. Occluder boxes are drawn into a
+// small depth buffer split into tiles; triangles are binned per tile and the tiles are rasterised in
+// parallel, 8 pixels at a time where the CPU has AVX2 or 4 with SSE2. Vertices snap to 1/8 of a pixel so the edge
+// functions are exact in floats and coverage follows the same top-left rule as the GPU. Each covered
+// pixel stores the furthest depth the occluder reaches inside it, so a box tested against the buffer is
+// only culled when it is behind the occluders everywhere it could show.
+class SoftwareOcclusion
+{
+public:
+	/*  Functions  */
+	// the resolution is rounded up to whole tiles and capped at 256x256, past that the snapped edge
+	// functions no longer fit a float's mantissa
+	SoftwareOcclusion(int width = 256, int height = 192, unsigned int threads = 0) : stopping(false), generation(0), busy(0), nextTile(0)
+	{
+		tilesX = (std::min(width, 256) + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (std::min(height, 256) + TILE_SIZE - 1) / TILE_SIZE;
+		this->width = tilesX * TILE_SIZE;
+		this->height = tilesY * TILE_SIZE;
+		depth.assign(this->width * this->height, 1.0f);
+		tileMax.assign(tilesX * tilesY, 1.0f);
+		tileUs.assign(tilesX * tilesY, 0.0f);
+		bins.resize(tilesX * tilesY);
+		stats = SoftwareOcclusionStats();
+		viewProjection = glm::mat4(1.0f);
+		frustum = Frustum(viewProjection);
+		SetThreads(threads);
+	}
+
+	~SoftwareOcclusion()
+	{
+		stopWorkers();
+	}
+
+	// the rasterising threads, the calling thread counts as one of them. 0 uses every hardware thread
+	void SetThreads(unsigned int threads)
+	{
+		stopWorkers();
+		if (threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		threads = std::min(threads, (unsigned int)(tilesX * tilesY));
+		for (unsigned int i = 1; i < threads; i++)
+			workers.push_back(std::thread(&SoftwareOcclusion::workerLoop, this, generation));
+	}
+
+	unsigned int Threads() const { return workers.size() + 1; }
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int TilesX() const { return tilesX; }
+	int TilesY() const { return tilesY; }
+
+	// pixels a row step covers on this CPU
+	static int Lanes()
+	{
+#if CPU_SSE2
+		return UseAVX2() ? 8 : 4;
+#else
+		return 1;
+#endif
+	}
+
+	const std::vector<float> &Depth() const { return depth; }
+	// microseconds each tile took in the last Render
+	const std::vector<float> &TileTimes() const { return tileUs; }
+
+	// replaces the occluders, every box is drawn as its 12 triangles wound to face outwards
+	void SetOccluders(const std::vector<AABB> &boxes)
+	{
+		// corner i has bit 0 set for max x, bit 1 for max y and bit 2 for max z
+		static const int faces[6][4] = {
+			{ 0, 4, 6, 2 }, { 1, 3, 7, 5 }, // -x, +x
+			{ 0, 1, 5, 4 }, { 2, 6, 7, 3 }, // -y, +y
+			{ 0, 2, 3, 1 }, { 4, 5, 7, 6 }  // -z, +z
+		};
+		occluderVertices.clear();
+		for (unsigned int i = 0; i < boxes.size(); i++)
+		{
+			glm::vec3 corners[8];
+			for (int c = 0; c < 8; c++)
+				corners[c] = glm::vec3(c & 1 ? boxes[i].max.x : boxes[i].min.x, c & 2 ? boxes[i].max.y : boxes[i].min.y, c & 4 ? boxes[i].max.z : boxes[i].min.z);
+			for (int f = 0; f < 6; f++)
+			{
+				const int *q = faces[f];
+				occluderVertices.push_back(corners[q[0]]);
+				occluderVertices.push_back(corners[q[1]]);
+				occluderVertices.push_back(corners[q[2]]);
+				occluderVertices.push_back(corners[q[0]]);
+				occluderVertices.push_back(corners[q[2]]);
+				occluderVertices.push_back(corners[q[3]]);
+			}
+		}
+	}
+
+	// draws the occluders for this view
+	void Render(const glm::mat4 &viewProjection)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		setup(viewProjection);
+		std::chrono::high_resolution_clock::time_point setupEnd = std::chrono::high_resolution_clock::now();
+
+		nextTile = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+			busy = workers.size();
+		}
+		wake.notify_all();
+		rasterizeTiles();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this]() { return busy == 0; });
+		}
+		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+		stats.triangles = triangles.size();
+		stats.setupMs = std::chrono::duration<float, std::milli>(setupEnd - start).count();
+		stats.rasterMs = std::chrono::duration<float, std::milli>(end - setupEnd).count();
+		stats.slowestTileUs = *std::max_element(tileUs.begin(), tileUs.end());
+		float total = 0.0f;
+		for (unsigned int i = 0; i < tileUs.size(); i++)
+			total += tileUs[i];
+		stats.averageTileUs = total / tileUs.size();
+		this->viewProjection = viewProjection;
+		frustum = Frustum(viewProjection);
+	}
+
+	// false when the box is outside the view or certainly behind the occluders of the last Render
+	bool Visible(const AABB &box)
+	{
+		stats.tested++;
+		if (!frustum.Intersects(box))
+		{
+			stats.outside++;
+			return false;
+		}
+
+		glm::vec2 rectMin(FLT_MAX), rectMax(-FLT_MAX);
+		float nearest = FLT_MAX;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec4 clip = viewProjection * glm::vec4(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z, 1.0f);
+			// crossing the near plane, the projected rectangle means nothing
+			if (clip.w <= 0.0f || clip.z < -clip.w)
+				return true;
+			glm::vec2 screen((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height);
+			rectMin = glm::min(rectMin, screen);
+			rectMax = glm::max(rectMax, screen);
+			nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+		}
+
+		int x0 = std::max((int)std::floor(rectMin.x), 0);
+		int y0 = std::max((int)std::floor(rectMin.y), 0);
+		int x1 = std::min((int)std::ceil(rectMax.x) - 1, width - 1);
+		int y1 = std::min((int)std::ceil(rectMax.y) - 1, height - 1);
+		if (x0 > x1 || y0 > y1)
+		{
+			stats.outside++;
+			return false;
+		}
+
+		for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++)
+		{
+			for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++)
+			{
+				// the whole tile is in front of the box
+				if (tileMax[ty * tilesX + tx] < nearest)
+					continue;
+				int py1 = std::min(y1, ty * TILE_SIZE + TILE_SIZE - 1);
+				int px1 = std::min(x1, tx * TILE_SIZE + TILE_SIZE - 1);
+				for (int y = std::max(y0, ty * TILE_SIZE); y <= py1; y++)
+				{
+					const float *row = &depth[y * width];
+					for (int x = std::max(x0, tx * TILE_SIZE); x <= px1; x++)
+					{
+						if (row[x] >= nearest)
+							return true;
+					}
+				}
+			}
+		}
+		stats.occluded++;
+		return false;
+	}
+
+	// draws the same triangles one at a time over their whole bounding box with plain scalar code, no
+	// tiles or threads, to check the fast path against
+	void RenderReference(const glm::mat4 &viewProjection, std::vector<float> &reference)
+	{
+		setup(viewProjection);
+		reference.assign(width * height, 1.0f);
+		for (unsigned int t = 0; t < triangles.size(); t++)
+		{
+			const OcclusionTriangle &tri = triangles[t];
+			for (int y = tri.minY; y <= tri.maxY; y++)
+			{
+				for (int x = tri.minX; x <= tri.maxX; x++)
+				{
+					bool covered = true;
+					for (int e = 0; e < 3; e++)
+						covered = covered && tri.a[e] * x + (tri.b[e] * y + tri.c[e]) >= tri.threshold[e];
+					if (covered)
+						reference[y * width + x] = std::min(reference[y * width + x], tri.zx * x + (tri.zy * y + tri.zc));
+				}
+			}
+		}
+	}
+
+	const SoftwareOcclusionStats &Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats.tested = stats.outside = stats.occluded = 0;
+	}
+
+	void PrintStats() const
+	{
+		std::cout << "OCCLUSION::" << stats.triangles << " occluder triangles, setup " << stats.setupMs << "ms, raster "
+			<< stats.rasterMs << "ms on " << Threads() << " threads (tiles avg " << stats.averageTileUs << "us, slowest "
+			<< stats.slowestTileUs << "us), of " << stats.tested << " boxes " << stats.outside << " outside the view and "
+			<< stats.occluded << " occluded" << std::endl;
+	}
+
+private:
+	static const int TILE_SIZE = 32;
+
+	/*  Occlusion data  */
+	int width, height, tilesX, tilesY;
+	std::vector<glm::vec3> occluderVertices;
+	std::vector<OcclusionTriangle> triangles;
+	std::vector<std::vector<unsigned int> > bins;
+	std::vector<float> depth;
+	std::vector<float> tileMax;
+	std::vector<float> tileUs;
+	glm::mat4 viewProjection;
+	Frustum frustum;
+	SoftwareOcclusionStats stats;
+
+	/*  Threads  */
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	bool stopping;
+	unsigned int generation;
+	unsigned int busy;
+	std::atomic<int> nextTile;
+
+	void stopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+		stopping = false;
+	}
+
+	// seen is the generation at the time the worker was started, it waits for the next one
+	void workerLoop(unsigned int seen)
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]() { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			rasterizeTiles();
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0)
+				done.notify_one();
+		}
+	}
+
+	void rasterizeTiles()
+	{
+		int tile;
+		while ((tile = nextTile++) < tilesX * tilesY)
+			rasterizeTile(tile);
+	}
+
+	// transforms, clips and sets up every occluder triangle, then bins them to the tiles they touch
+	void setup(const glm::mat4 &viewProjection)
+	{
+		triangles.clear();
+		for (unsigned int i = 0; i < bins.size(); i++)
+			bins[i].clear();
+
+		for (unsigned int i = 0; i + 2 < occluderVertices.size(); i += 3)
+		{
+			glm::vec4 polygon[9];
+			int count = 3;
+			for (int v = 0; v < 3; v++)
+				polygon[v] = viewProjection * glm::vec4(occluderVertices[i + v], 1.0f);
+			count = clip(polygon, count);
+			for (int v = 1; v + 1 < count; v++)
+				addTriangle(polygon[0], polygon[v], polygon[v + 1]);
+		}
+
+		for (unsigned int t = 0; t < triangles.size(); t++)
+		{
+			const OcclusionTriangle &tri = triangles[t];
+			for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ty++)
+			{
+				for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; tx++)
+					bins[ty * tilesX + tx].push_back(t);
+			}
+		}
+	}
+
+	// Sutherland-Hodgman against the near plane and the four sides of the view, so everything left
+	// lands on the screen
+	static int clip(glm::vec4 *polygon, int count)
+	{
+		static const glm::vec4 planes[5] = {
+			glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+			glm::vec4(0.0f, 1.0f, 0.0f, 1.0f), glm::vec4(0.0f, -1.0f, 0.0f, 1.0f)
+		};
+		glm::vec4 scratch[9];
+		for (int p = 0; p < 5 && count > 0; p++)
+		{
+			int out = 0;
+			for (int v = 0; v < count; v++)
+			{
+				const glm::vec4 &a = polygon[v];
+				const glm::vec4 &b = polygon[(v + 1) % count];
+				float da = glm::dot(a, planes[p]);
+				float db = glm::dot(b, planes[p]);
+				if (da >= 0.0f)
+					scratch[out++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					scratch[out++] = a + (b - a) * (da / (da - db));
+			}
+			count = out;
+			for (int v = 0; v < count; v++)
+				polygon[v] = scratch[v];
+		}
+		return count;
+	}
+
+	void addTriangle(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2)
+	{
+		glm::vec3 v[3];
+		const glm::vec4 *clipped[3] = { &c0, &c1, &c2 };
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4 &c = *clipped[i];
+			// snapped to 1/8 pixel like a GPU's sub-pixel grid
+			v[i].x = std::floor((c.x / c.w * 0.5f + 0.5f) * width * 8.0f + 0.5f) / 8.0f;
+			v[i].y = std::floor((c.y / c.w * 0.5f + 0.5f) * height * 8.0f + 0.5f) / 8.0f;
+			v[i].z = c.z / c.w * 0.5f + 0.5f;
+		}
+
+		// counter-clockwise faces the camera, everything else is a back face
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (area <= 0.0f)
+			return;
+
+		OcclusionTriangle tri;
+		tri.minX = std::max((int)std::ceil(std::min(v[0].x, std::min(v[1].x, v[2].x)) - 0.5f), 0);
+		tri.minY = std::max((int)std::ceil(std::min(v[0].y, std::min(v[1].y, v[2].y)) - 0.5f), 0);
+		tri.maxX = std::min((int)std::floor(std::max(v[0].x, std::max(v[1].x, v[2].x)) - 0.5f), width - 1);
+		tri.maxY = std::min((int)std::floor(std::max(v[0].y, std::max(v[1].y, v[2].y)) - 0.5f), height - 1);
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			return;
+
+		for (int e = 0; e < 3; e++)
+		{
+			const glm::vec3 &from = v[(e + 1) % 3];
+			const glm::vec3 &to = v[(e + 2) % 3];
+			float dx = to.x - from.x;
+			float dy = to.y - from.y;
+			tri.a[e] = -dy;
+			tri.b[e] = dx;
+			// moved to the pixel centre, every term is a multiple of 1/64 so nothing rounds
+			tri.c[e] = from.x * to.y - from.y * to.x + 0.5f * tri.a[e] + 0.5f * tri.b[e];
+			bool topLeft = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+			tri.threshold[e] = topLeft ? 0.0f : 1.0f / 64.0f;
+		}
+
+		float z1 = v[1].z - v[0].z;
+		float z2 = v[2].z - v[0].z;
+		tri.zx = (z1 * (v[2].y - v[0].y) - z2 * (v[1].y - v[0].y)) / area;
+		tri.zy = (z2 * (v[1].x - v[0].x) - z1 * (v[2].x - v[0].x)) / area;
+		// the plane at the pixel centre pushed out to its furthest corner
+		tri.zc = v[0].z - tri.zx * v[0].x - tri.zy * v[0].y + 0.5f * (tri.zx + tri.zy) + 0.5f * (std::abs(tri.zx) + std::abs(tri.zy));
+		triangles.push_back(tri);
+	}
+
+	void rasterizeTile(int tile)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		int tileX = (tile % tilesX) * TILE_SIZE;
+		int tileY = (tile / tilesX) * TILE_SIZE;
+		for (int y = tileY; y < tileY + TILE_SIZE; y++)
+			std::fill(&depth[y * width + tileX], &depth[y * width + tileX] + TILE_SIZE, 1.0f);
+
+		const std::vector<unsigned int> &bin = bins[tile];
+		for (unsigned int i = 0; i < bin.size(); i++)
+		{
+			const OcclusionTriangle &tri = triangles[bin[i]];
+			// whole lanes from the start of the tile, pixels past the triangle fail its edge tests
+			int x0 = tileX + (std::max(tri.minX, tileX) - tileX) / SOFTWARE_OCCLUSION_LANES * SOFTWARE_OCCLUSION_LANES;
+			int x1 = std::min(tri.maxX, tileX + TILE_SIZE - 1);
+			int y0 = std::max(tri.minY, tileY);
+			int y1 = std::min(tri.maxY, tileY + TILE_SIZE - 1);
+			for (int y = y0; y <= y1; y++)
+				rasterizeRow(tri, &depth[y * width], y, x0, x1);
+		}
+
+		float furthest = 0.0f;
+		for (int y = tileY; y < tileY + TILE_SIZE; y++)
+		{
+			for (int x = tileX; x < tileX + TILE_SIZE; x++)
+				furthest = std::max(furthest, depth[y * width + x]);
+		}
+		tileMax[tile] = furthest;
+		tileUs[tile] = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	static void rasterizeRow(const OcclusionTriangle &tri, float *row, int y, int x0, int x1)
+	{
+#if CPU_AVX2
+		if (UseAVX2())
+		{
+			rasterizeRow8(tri, row, y, x0, x1);
+			return;
+		}
+#endif
+#if CPU_SSE2
+		rasterizeRow4(tri, row, y, x0, x1);
+#else
+		float e0 = tri.b[0] * y + tri.c[0];
+		float e1 = tri.b[1] * y + tri.c[1];
+		float e2 = tri.b[2] * y + tri.c[2];
+		float zRow = tri.zy * y + tri.zc;
+		for (int x = x0; x <= x1; x++)
+		{
+			if (tri.a[0] * x + e0 >= tri.threshold[0] && tri.a[1] * x + e1 >= tri.threshold[1] && tri.a[2] * x + e2 >= tri.threshold[2])
+				row[x] = std::min(row[x], tri.zx * x + zRow);
+		}
+#endif
+	}
+
+#if CPU_AVX2
+	static CPU_AVX2_TARGET void rasterizeRow8(const OcclusionTriangle &tri, float *row, int y, int x0, int x1)
+	{
+		__m256 a0 = _mm256_set1_ps(tri.a[0]), a1 = _mm256_set1_ps(tri.a[1]), a2 = _mm256_set1_ps(tri.a[2]);
+		__m256 e0 = _mm256_set1_ps(tri.b[0] * y + tri.c[0]);
+		__m256 e1 = _mm256_set1_ps(tri.b[1] * y + tri.c[1]);
+		__m256 e2 = _mm256_set1_ps(tri.b[2] * y + tri.c[2]);
+		__m256 t0 = _mm256_set1_ps(tri.threshold[0]), t1 = _mm256_set1_ps(tri.threshold[1]), t2 = _mm256_set1_ps(tri.threshold[2]);
+		__m256 zx = _mm256_set1_ps(tri.zx);
+		__m256 zRow = _mm256_set1_ps(tri.zy * y + tri.zc);
+		const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		for (int x = x0; x <= x1; x += 8)
+		{
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+			__m256 covered = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), e0), t0, _CMP_GE_OQ);
+			covered = _mm256_and_ps(covered, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), e1), t1, _CMP_GE_OQ));
+			covered = _mm256_and_ps(covered, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), e2), t2, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(covered) == 0)
+				continue;
+			__m256 z = _mm256_add_ps(_mm256_mul_ps(zx, px), zRow);
+			__m256 old = _mm256_loadu_ps(row + x);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), covered));
+		}
+	}
+#endif
+
+#if CPU_SSE2
+	static void rasterizeRow4(const OcclusionTriangle &tri, float *row, int y, int x0, int x1)
+	{
+		__m128 a0 = _mm_set1_ps(tri.a[0]), a1 = _mm_set1_ps(tri.a[1]), a2 = _mm_set1_ps(tri.a[2]);
+		__m128 e0 = _mm_set1_ps(tri.b[0] * y + tri.c[0]);
+		__m128 e1 = _mm_set1_ps(tri.b[1] * y + tri.c[1]);
+		__m128 e2 = _mm_set1_ps(tri.b[2] * y + tri.c[2]);
+		__m128 t0 = _mm_set1_ps(tri.threshold[0]), t1 = _mm_set1_ps(tri.threshold[1]), t2 = _mm_set1_ps(tri.threshold[2]);
+		__m128 zx = _mm_set1_ps(tri.zx);
+		__m128 zRow = _mm_set1_ps(tri.zy * y + tri.zc);
+		const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		for (int x = x0; x <= x1; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 covered = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), e0), t0);
+			covered = _mm_and_ps(covered, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), e1), t1));
+			covered = _mm_and_ps(covered, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), e2), t2));
+			if (_mm_movemask_ps(covered) == 0)
+				continue;
+			__m128 z = _mm_add_ps(_mm_mul_ps(zx, px), zRow);
+			__m128 old = _mm_loadu_ps(row + x);
+			__m128 nearer = _mm_min_ps(old, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(covered, nearer), _mm_andnot_ps(covered, old)));
+		}
+	}
+#endif
+};
+#endif
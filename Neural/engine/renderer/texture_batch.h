@@ -0,0 +1,332 @@
+#ifndef TEXTURE_BATCH_H
+#define TEXTURE_BATCH_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "job_system.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+// the job system batches decode on unless given one. Set to NULL, as --serial-textures does, every batch
+// decodes its images one after another on the thread that uploads it instead
+inline JobSystem *&TextureDecodeJobs()
+{
+	static JobSystem *jobs = &Jobs();
+	return jobs;
+}
+
+struct TextureBatchStats {
+	unsigned int textures;
+	unsigned int images;
+	// summed over every thread that decoded
+	float decodeMs;
+	// on the uploading thread: the GL calls, and the time spent waiting for decodes or running jobs instead
+	float uploadMs;
+	float waitMs;
+};
+
+// Decodes the images of many textures at once and uploads them from the thread that owns the GL context.
+// Add and its variants name the texture straight away and queue a job per image, so decoding starts while
+// the caller gets on with anything else; Upload then takes each texture as soon as all of its images are
+// decoded, whichever that is first, and only does the GL calls itself. While nothing is ready it runs
+// queued jobs rather than waiting idle, which is also what decodes everything when there is one thread.
+class TextureBatch
+{
+public:
+	/*  Functions  */
+	TextureBatch(JobSystem *jobs = TextureDecodeJobs()) : jobs(jobs), uploaded(0)
+	{
+		ResetStats();
+	}
+
+	// whatever wasn't uploaded yet goes up now, no job is left writing into a destroyed batch
+	~TextureBatch()
+	{
+		Upload();
+	}
+
+	TextureBatch(const TextureBatch&) = delete;
+	TextureBatch &operator=(const TextureBatch&) = delete;
+
+	// a mipmapped, repeating 2D texture of the image at path, in as many channels as the file has
+	unsigned int Add(const std::string &path)
+	{
+		return queue(TEXTURE_BATCH_2D, std::vector<std::string>(1, path), 0, NULL);
+	}
+
+	// a cube map of six RGB faces, in the order +X, -X, +Y, -Y, +Z, -Z
+	unsigned int AddCubemap(const std::vector<std::string> &faces)
+	{
+		return queue(TEXTURE_BATCH_CUBEMAP, faces, 3, NULL);
+	}
+
+	// the images as the layers of one RGBA texture array. Layers have to share a size, so every image is
+	// scaled to the largest one's; an empty path or an image that fails to load is filled with fill
+	unsigned int AddArray(const std::vector<std::string> &paths, const unsigned char fill[4])
+	{
+		return queue(TEXTURE_BATCH_ARRAY, paths, 4, fill);
+	}
+
+	// uploads every texture added so far, each as soon as its images are decoded
+	void Upload()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		float waitMs = 0.0f;
+		if (jobs == NULL)
+		{
+			for (unsigned int t = 0; t < textures.size(); t++)
+			{
+				for (unsigned int i = 0; i < textures[t].images.size() && textures[t].pending > 0; i++)
+					decode(textures[t], i);
+			}
+		}
+		while (uploaded < textures.size())
+		{
+			Entry *texture = NULL;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!ready.empty())
+				{
+					texture = ready.front();
+					ready.pop_front();
+				}
+			}
+			if (texture == NULL)
+			{
+				std::chrono::high_resolution_clock::time_point waitStart = std::chrono::high_resolution_clock::now();
+				if (!jobs->RunOne())
+					std::this_thread::yield();
+				waitMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+				continue;
+			}
+			upload(*texture);
+			uploaded++;
+		}
+		stats.waitMs += waitMs;
+		stats.uploadMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count() - waitMs;
+	}
+
+	TextureBatchStats Stats() const { return stats; }
+
+	void ResetStats()
+	{
+		stats.textures = 0;
+		stats.images = 0;
+		stats.decodeMs = 0.0f;
+		stats.uploadMs = 0.0f;
+		stats.waitMs = 0.0f;
+	}
+
+	void PrintStats(const std::string &name) const
+	{
+		std::cout << name << ": " << stats.textures << " textures from " << stats.images << " images, decoded in " << stats.decodeMs << "ms on "
+			<< (jobs != NULL ? jobs->Threads() : 1) << " threads, uploaded in " << stats.uploadMs << "ms after waiting " << stats.waitMs << "ms" << std::endl;
+	}
+
+private:
+	enum TextureBatchKind {
+		TEXTURE_BATCH_2D,
+		TEXTURE_BATCH_CUBEMAP,
+		TEXTURE_BATCH_ARRAY
+	};
+
+	struct Image {
+		std::string path;
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		unsigned char *data = NULL;
+	};
+
+	struct Entry {
+		TextureBatchKind kind;
+		unsigned int name;
+		// channels to decode to, 0 for as many as the file has
+		int components;
+		unsigned char fill[4];
+		std::vector<Image> images;
+		// images still to decode, guarded by mutex
+		unsigned int pending;
+	};
+
+	/*  Batch data  */
+	JobSystem *jobs;
+	// a deque, so the jobs' references stay put while more textures are added
+	std::deque<Entry> textures;
+	unsigned int uploaded;
+	// textures whose images are all decoded, oldest first
+	std::mutex mutex;
+	std::deque<Entry*> ready;
+	TextureBatchStats stats;
+
+	unsigned int queue(TextureBatchKind kind, const std::vector<std::string> &paths, int components, const unsigned char fill[4])
+	{
+		textures.push_back(Entry());
+		Entry &texture = textures.back();
+		texture.kind = kind;
+		texture.components = components;
+		for (int c = 0; c < 4; c++)
+			texture.fill[c] = fill != NULL ? fill[c] : 0;
+		texture.images.resize(paths.size());
+		for (unsigned int i = 0; i < paths.size(); i++)
+			texture.images[i].path = paths[i];
+		texture.pending = paths.size();
+		glGenTextures(1, &texture.name);
+		stats.textures++;
+		if (texture.pending == 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.push_back(&texture);
+		}
+		else if (jobs != NULL)
+		{
+			Entry *queued = &texture;
+			for (unsigned int i = 0; i < paths.size(); i++)
+				jobs->Run([this, queued, i]() { decode(*queued, i); });
+		}
+		return texture.name;
+	}
+
+	// runs on any thread, touches nothing but its own image until it takes the lock
+	void decode(Entry &texture, unsigned int i)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		Image &image = texture.images[i];
+		if (!image.path.empty())
+			image.data = stbi_load(image.path.c_str(), &image.width, &image.height, &image.channels, texture.components);
+		float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.decodeMs += ms;
+		stats.images++;
+		if (--texture.pending == 0)
+			ready.push_back(&texture);
+	}
+
+	void upload(Entry &texture)
+	{
+		for (unsigned int i = 0; i < texture.images.size(); i++)
+		{
+			if (texture.images[i].data == NULL && !texture.images[i].path.empty())
+				std::cout << (texture.kind == TEXTURE_BATCH_CUBEMAP ? "Cubemap texture" : "Texture") << " failed to load at path: " << texture.images[i].path << std::endl;
+		}
+		if (texture.kind == TEXTURE_BATCH_2D)
+			upload2D(texture);
+		else if (texture.kind == TEXTURE_BATCH_CUBEMAP)
+			uploadCubemap(texture);
+		else
+			uploadArray(texture);
+		for (unsigned int i = 0; i < texture.images.size(); i++)
+		{
+			if (texture.images[i].data != NULL)
+				stbi_image_free(texture.images[i].data);
+			texture.images[i].data = NULL;
+		}
+	}
+
+	static void upload2D(const Entry &texture)
+	{
+		const Image &image = texture.images[0];
+		if (image.data == NULL)
+			return;
+		GLenum format = GL_RGBA;
+		if (image.channels == 1)
+			format = GL_RED;
+		else if (image.channels == 3)
+			format = GL_RGB;
+
+		glBindTexture(GL_TEXTURE_2D, texture.name);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	static void uploadCubemap(const Entry &texture)
+	{
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture.name);
+		for (unsigned int i = 0; i < texture.images.size(); i++)
+		{
+			const Image &image = texture.images[i];
+			if (image.data != NULL)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	static void uploadArray(const Entry &texture)
+	{
+		const std::vector<Image> &images = texture.images;
+		int width = 1, height = 1;
+		for (unsigned int i = 0; i < images.size(); i++)
+		{
+			if (images[i].data == NULL)
+				continue;
+			width = std::max(width, images[i].width);
+			height = std::max(height, images[i].height);
+		}
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture.name);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, images.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		std::vector<unsigned char> layer((size_t)width * height * 4);
+		for (unsigned int i = 0; i < images.size(); i++)
+		{
+			const Image &image = images[i];
+			const unsigned char *data = image.data;
+			if (data == NULL)
+			{
+				for (size_t j = 0; j < layer.size(); j += 4)
+					memcpy(&layer[j], texture.fill, 4);
+				data = &layer[0];
+			}
+			else if (image.width != width || image.height != height)
+			{
+				// bilinear, sampling at texel centres
+				for (int y = 0; y < height; y++)
+				{
+					float sourceY = std::max((y + 0.5f) * image.height / height - 0.5f, 0.0f);
+					int y0 = std::min((int)sourceY, image.height - 1), y1 = std::min(y0 + 1, image.height - 1);
+					float fy = sourceY - y0;
+					for (int x = 0; x < width; x++)
+					{
+						float sourceX = std::max((x + 0.5f) * image.width / width - 0.5f, 0.0f);
+						int x0 = std::min((int)sourceX, image.width - 1), x1 = std::min(x0 + 1, image.width - 1);
+						float fx = sourceX - x0;
+						for (int c = 0; c < 4; c++)
+						{
+							float top = image.data[((size_t)y0 * image.width + x0) * 4 + c] * (1.0f - fx) + image.data[((size_t)y0 * image.width + x1) * 4 + c] * fx;
+							float bottom = image.data[((size_t)y1 * image.width + x0) * 4 + c] * (1.0f - fx) + image.data[((size_t)y1 * image.width + x1) * 4 + c] * fx;
+							layer[((size_t)y * width + x) * 4 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+						}
+					}
+				}
+				data = &layer[0];
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		}
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+};
+#endif
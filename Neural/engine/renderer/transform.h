@@ -0,0 +1,64 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Position, rotation about y in degrees and scale of an object, with its world and normal matrices
+// cached. The setters rebuild the matrices straight away, so objects that never move pay for them once
+// instead of every frame, and the getters never write: any number of threads can read a transform at
+// once, as the room recording jobs do, as long as none of them sets it.
+class Transform
+{
+public:
+	/*  Functions  */
+	Transform() : position(0.0f), rotation(0.0f), scale(1.0f), world(1.0f), normal(1.0f)
+	{
+	}
+
+	void SetPosition(const glm::vec3 &newPosition)
+	{
+		position = newPosition;
+		update();
+	}
+
+	void SetRotation(float degrees)
+	{
+		rotation = degrees;
+		update();
+	}
+
+	void SetScale(const glm::vec3 &newScale)
+	{
+		scale = newScale;
+		update();
+	}
+
+	const glm::vec3 &Position() const { return position; }
+	float Rotation() const { return rotation; }
+	const glm::vec3 &Scale() const { return scale; }
+
+	// translate * rotate * scale
+	const glm::mat4 &World() const { return world; }
+
+	// inverse transpose of the world matrix's upper 3x3, for transforming normals
+	const glm::mat3 &Normal() const { return normal; }
+
+private:
+	/*  Transform data  */
+	glm::vec3 position;
+	float rotation;
+	glm::vec3 scale;
+	glm::mat4 world;
+	glm::mat3 normal;
+
+	void update()
+	{
+		world = glm::mat4(1.0f);
+		world = glm::translate(world, position);
+		world = glm::rotate(world, glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
+		world = glm::scale(world, scale);
+		normal = glm::transpose(glm::inverse(glm::mat3(world)));
+	}
+};
+#endif
@@ -0,0 +1,230 @@
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "transform.h"
+#include "cpu_features.h"
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+// Transforms of objects that move every frame, kept as structure of arrays: one array per component of
+// the position, yaw and scale. Compute builds translate * rotate(yaw about y) * scale for a whole SIMD
+// register of objects at once (8 where the CPU has AVX2, 4 with SSE2), with a polynomial sine and
+// cosine instead of calls into the C library, and writes the matrices out column major at any stride. Pointing it at the
+// model matrix of the first DrawData in a mapped buffer with a stride of sizeof(DrawData) fills the
+// per-draw data in place.
+class TransformBatch
+{
+public:
+	/*  Functions  */
+	void Clear()
+	{
+		positionX.clear(); positionY.clear(); positionZ.clear();
+		yaw.clear();
+		scaleX.clear(); scaleY.clear(); scaleZ.clear();
+	}
+
+	// returns the index to update the object by
+	unsigned int Add(const Transform &transform)
+	{
+		positionX.push_back(0.0f); positionY.push_back(0.0f); positionZ.push_back(0.0f);
+		yaw.push_back(0.0f);
+		scaleX.push_back(1.0f); scaleY.push_back(1.0f); scaleZ.push_back(1.0f);
+		unsigned int index = Size() - 1;
+		Set(index, transform.Position(), transform.Rotation(), transform.Scale());
+		return index;
+	}
+
+	// yaw in degrees, like Transform
+	void Set(unsigned int index, const glm::vec3 &position, float degrees, const glm::vec3 &scale)
+	{
+		SetPosition(index, position);
+		SetYaw(index, degrees);
+		scaleX[index] = scale.x;
+		scaleY[index] = scale.y;
+		scaleZ[index] = scale.z;
+	}
+
+	void SetPosition(unsigned int index, const glm::vec3 &position)
+	{
+		positionX[index] = position.x;
+		positionY[index] = position.y;
+		positionZ[index] = position.z;
+	}
+
+	void SetYaw(unsigned int index, float degrees)
+	{
+		yaw[index] = degrees;
+	}
+
+	unsigned int Size() const { return positionX.size(); }
+
+	// objects a Compute step builds on this CPU
+	static unsigned int Lanes()
+	{
+#if CPU_SSE2
+		return UseAVX2() ? 8 : 4;
+#else
+		return 1;
+#endif
+	}
+
+	// writes Size() matrices of 16 floats, each stride bytes after the one before
+	void Compute(void *destination, size_t stride) const
+	{
+		unsigned char *out = (unsigned char*)destination;
+		unsigned int count = Size();
+		unsigned int i = 0;
+#if CPU_AVX2
+		if (UseAVX2())
+		{
+			for (; i + 8 <= count; i += 8)
+				computeLanes8(i, out + i * stride, stride);
+		}
+#endif
+#if CPU_SSE2
+		for (; i + 4 <= count; i += 4)
+			computeLanes4(i, out + i * stride, stride);
+#endif
+		for (; i < count; i++)
+			computeOne(i, (float*)(out + i * stride));
+	}
+
+	// the same matrices built one at a time with glm, what Compute is checked and timed against
+	void ComputeReference(void *destination, size_t stride) const
+	{
+		unsigned char *out = (unsigned char*)destination;
+		for (unsigned int i = 0; i < Size(); i++)
+		{
+			glm::mat4 world = glm::mat4(1.0f);
+			world = glm::translate(world, glm::vec3(positionX[i], positionY[i], positionZ[i]));
+			world = glm::rotate(world, glm::radians(yaw[i]), glm::vec3(0.0f, 1.0f, 0.0f));
+			world = glm::scale(world, glm::vec3(scaleX[i], scaleY[i], scaleZ[i]));
+			*(glm::mat4*)(out + i * stride) = world;
+		}
+	}
+
+private:
+	/*  Transform data  */
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> yaw;
+	std::vector<float> scaleX, scaleY, scaleZ;
+
+	void computeOne(unsigned int i, float *m) const
+	{
+		float radians = glm::radians(yaw[i]);
+		float s = std::sin(radians), c = std::cos(radians);
+		m[0] = c * scaleX[i];  m[1] = 0.0f;        m[2] = -s * scaleX[i]; m[3] = 0.0f;
+		m[4] = 0.0f;           m[5] = scaleY[i];   m[6] = 0.0f;           m[7] = 0.0f;
+		m[8] = s * scaleZ[i];  m[9] = 0.0f;        m[10] = c * scaleZ[i]; m[11] = 0.0f;
+		m[12] = positionX[i];  m[13] = positionY[i]; m[14] = positionZ[i]; m[15] = 1.0f;
+	}
+
+	// Both kernels reduce the angle to [-pi/4, pi/4] around the nearest multiple of pi/2 in three steps
+	// (Cody and Waite), evaluate the Cephes sinf and cosf polynomials there and pick and negate them by
+	// quadrant. Every lane then holds one component of a matrix, so each group of four components is
+	// transposed into four objects' columns before it is stored.
+#if CPU_AVX2
+	CPU_AVX2_TARGET void computeLanes8(unsigned int i, unsigned char *out, size_t stride) const
+	{
+		__m256 radians = _mm256_mul_ps(_mm256_loadu_ps(&yaw[i]), _mm256_set1_ps(0.01745329251994329577f));
+		__m256 quadrantF = _mm256_round_ps(_mm256_mul_ps(radians, _mm256_set1_ps(0.63661977236758134308f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256i quadrant = _mm256_cvtps_epi32(quadrantF);
+		__m256 r = _mm256_sub_ps(radians, _mm256_mul_ps(quadrantF, _mm256_set1_ps(1.5703125f)));
+		r = _mm256_sub_ps(r, _mm256_mul_ps(quadrantF, _mm256_set1_ps(4.837512969970703125e-4f)));
+		r = _mm256_sub_ps(r, _mm256_mul_ps(quadrantF, _mm256_set1_ps(7.54978995489188216e-8f)));
+		__m256 r2 = _mm256_mul_ps(r, r);
+
+		__m256 sinR = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-1.9515295891e-4f), r2), _mm256_set1_ps(8.3321608736e-3f));
+		sinR = _mm256_add_ps(_mm256_mul_ps(sinR, r2), _mm256_set1_ps(-1.6666654611e-1f));
+		sinR = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinR, r2), r), r);
+		__m256 cosR = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.443315711809948e-5f), r2), _mm256_set1_ps(-1.388731625493765e-3f));
+		cosR = _mm256_add_ps(_mm256_mul_ps(cosR, r2), _mm256_set1_ps(4.166664568298827e-2f));
+		cosR = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(cosR, r2), r2), _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(r2, _mm256_set1_ps(0.5f))));
+
+		// odd quadrants swap sine and cosine, sine is negative in quadrants 2 and 3, cosine in 1 and 2
+		__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+		__m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30));
+		__m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+		__m256 s = _mm256_xor_ps(_mm256_blendv_ps(sinR, cosR, swap), sinSign);
+		__m256 c = _mm256_xor_ps(_mm256_blendv_ps(cosR, sinR, swap), cosSign);
+
+		__m256 sx = _mm256_loadu_ps(&scaleX[i]);
+		__m256 sz = _mm256_loadu_ps(&scaleZ[i]);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 columns[4][4] = {
+			{ _mm256_mul_ps(c, sx), zero, _mm256_xor_ps(_mm256_mul_ps(s, sx), _mm256_set1_ps(-0.0f)), zero },
+			{ zero, _mm256_loadu_ps(&scaleY[i]), zero, zero },
+			{ _mm256_mul_ps(s, sz), zero, _mm256_mul_ps(c, sz), zero },
+			{ _mm256_loadu_ps(&positionX[i]), _mm256_loadu_ps(&positionY[i]), _mm256_loadu_ps(&positionZ[i]), _mm256_set1_ps(1.0f) }
+		};
+		for (int column = 0; column < 4; column++)
+		{
+			// a 4x4 transpose inside each 128 bit half leaves objects 0-3 in the low halves, 4-7 in the high
+			__m256 t0 = _mm256_unpacklo_ps(columns[column][0], columns[column][1]);
+			__m256 t1 = _mm256_unpackhi_ps(columns[column][0], columns[column][1]);
+			__m256 t2 = _mm256_unpacklo_ps(columns[column][2], columns[column][3]);
+			__m256 t3 = _mm256_unpackhi_ps(columns[column][2], columns[column][3]);
+			__m256 object[4] = {
+				_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)),
+				_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2))
+			};
+			for (int lane = 0; lane < 4; lane++)
+			{
+				_mm_storeu_ps((float*)(out + lane * stride) + column * 4, _mm256_castps256_ps128(object[lane]));
+				_mm_storeu_ps((float*)(out + (lane + 4) * stride) + column * 4, _mm256_extractf128_ps(object[lane], 1));
+			}
+		}
+	}
+#endif
+
+#if CPU_SSE2
+	void computeLanes4(unsigned int i, unsigned char *out, size_t stride) const
+	{
+		__m128 radians = _mm_mul_ps(_mm_loadu_ps(&yaw[i]), _mm_set1_ps(0.01745329251994329577f));
+		// SSE2 has no round, converting with the default rounding mode rounds to nearest
+		__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(radians, _mm_set1_ps(0.63661977236758134308f)));
+		__m128 quadrantF = _mm_cvtepi32_ps(quadrant);
+		__m128 r = _mm_sub_ps(radians, _mm_mul_ps(quadrantF, _mm_set1_ps(1.5703125f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(quadrantF, _mm_set1_ps(4.837512969970703125e-4f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(quadrantF, _mm_set1_ps(7.54978995489188216e-8f)));
+		__m128 r2 = _mm_mul_ps(r, r);
+
+		__m128 sinR = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f));
+		sinR = _mm_add_ps(_mm_mul_ps(sinR, r2), _mm_set1_ps(-1.6666654611e-1f));
+		sinR = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinR, r2), r), r);
+		__m128 cosR = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+		cosR = _mm_add_ps(_mm_mul_ps(cosR, r2), _mm_set1_ps(4.166664568298827e-2f));
+		cosR = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cosR, r2), r2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, _mm_set1_ps(0.5f))));
+
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+		__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+		__m128 s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cosR), _mm_andnot_ps(swap, sinR)), sinSign);
+		__m128 c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sinR), _mm_andnot_ps(swap, cosR)), cosSign);
+
+		__m128 sx = _mm_loadu_ps(&scaleX[i]);
+		__m128 sz = _mm_loadu_ps(&scaleZ[i]);
+		__m128 zero = _mm_setzero_ps();
+		__m128 columns[4][4] = {
+			{ _mm_mul_ps(c, sx), zero, _mm_xor_ps(_mm_mul_ps(s, sx), _mm_set1_ps(-0.0f)), zero },
+			{ zero, _mm_loadu_ps(&scaleY[i]), zero, zero },
+			{ _mm_mul_ps(s, sz), zero, _mm_mul_ps(c, sz), zero },
+			{ _mm_loadu_ps(&positionX[i]), _mm_loadu_ps(&positionY[i]), _mm_loadu_ps(&positionZ[i]), _mm_set1_ps(1.0f) }
+		};
+		for (int column = 0; column < 4; column++)
+		{
+			_MM_TRANSPOSE4_PS(columns[column][0], columns[column][1], columns[column][2], columns[column][3]);
+			for (int lane = 0; lane < 4; lane++)
+				_mm_storeu_ps((float*)(out + lane * stride) + column * 4, columns[column][lane]);
+		}
+	}
+#endif
+};
+#endif
@@ -18,34 +18,46 @@ struct Light {
 in vec3 FragPos;  
 in vec3 Normal;  
 in vec2 TexCoords;
+flat in float Layer;
   
  #define TOTALLIGHTS 128
 
 uniform vec3 viewPos;
 uniform Material material;
+// a model with merged materials samples the layer of its vertices from these instead
+uniform bool mergedMaterials;
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray specularArray;
 uniform Light light;
-uniform Light lights[TOTALLIGHTS];
-uniform int amountOfLights;
+// written to a ring buffer once a frame by the engine, std140 pads every vec3 in it to a vec4
+layout (std140) uniform LightBlock {
+    int amountOfLights;
+    Light lights[TOTALLIGHTS];
+};
 
 void main()
 {
+    // the maps are read once here rather than once per light
+    vec3 diffuseTexel = mergedMaterials ? texture(diffuseArray, vec3(TexCoords, Layer)).rgb : texture(material.diffuse, TexCoords).rgb;
+    vec3 specularTexel = mergedMaterials ? texture(specularArray, vec3(TexCoords, Layer)).rgb : texture(material.specular, TexCoords).rgb;
+
     // ambient
 	float distance = length(light.position - FragPos);
 	float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.016* (distance * distance));    
 
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
+    vec3 ambient = light.ambient * diffuseTexel;
   	
     // diffuse 
     vec3 norm = normalize(Normal);
     vec3 lightDir = normalize(light.position - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;  
+    vec3 diffuse = light.diffuse * diff * diffuseTexel;  
     
     // specular
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;  
+    vec3 specular = light.specular * spec * specularTexel;  
      
 	  vec3 result = ambient + diffuse + specular;
 	for(int i = 0; i < amountOfLights;i++)
@@ -55,17 +67,17 @@ void main()
 
 
 			 // ambient
-		ambient = lights[i].ambient * texture(material.diffuse, TexCoords).rgb;
+		ambient = lights[i].ambient * diffuseTexel;
   	
 		// diffuse 
 		lightDir = normalize(lights[i].position - FragPos);
 		diff = max(dot(norm, lightDir), 0.0);
-		diffuse = lights[i].diffuse * diff * texture(material.diffuse, TexCoords).rgb;  
+		diffuse = lights[i].diffuse * diff * diffuseTexel;  
     
 		// specular
 		reflectDir = reflect(-lightDir, norm);  
 		spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-		specular = lights[i].specular * spec * texture(material.specular, TexCoords).rgb;  
+		specular = lights[i].specular * spec * specularTexel;  
      
 		ambient *= attenuation;
 		diffuse *= attenuation;
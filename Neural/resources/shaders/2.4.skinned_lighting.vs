@@ -0,0 +1,52 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 6) in float aLayer;
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in mat3 aInstanceNormal;
+layout (location = 14) in uvec4 aBoneIds;
+layout (location = 15) in vec4 aBoneWeights;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out float Layer;
+
+// the node's transform, for the meshes that aren't skinned
+uniform mat4 model;
+uniform mat3 normalMatrix;
+uniform mat4 view;
+uniform mat4 projection;
+
+// every instance's skinning matrices one after another, four texels each, starting at the first
+// instance of the draw
+uniform samplerBuffer bones;
+uniform int boneCount;
+uniform int firstInstance;
+
+mat4 boneMatrix(uint bone)
+{
+    int texel = ((firstInstance + gl_InstanceID) * boneCount + int(bone)) * 4;
+    return mat4(texelFetch(bones, texel), texelFetch(bones, texel + 1), texelFetch(bones, texel + 2), texelFetch(bones, texel + 3));
+}
+
+void main()
+{
+    // the weights add up to 1 on a skinned vertex and to 0 on any other
+    mat4 skin = model;
+    mat3 skinNormal = normalMatrix;
+    if (dot(aBoneWeights, vec4(1.0)) > 0.5)
+    {
+        skin = aBoneWeights.x * boneMatrix(aBoneIds.x) + aBoneWeights.y * boneMatrix(aBoneIds.y)
+            + aBoneWeights.z * boneMatrix(aBoneIds.z) + aBoneWeights.w * boneMatrix(aBoneIds.w);
+        // bones are taken to scale uniformly, so their blend stands in for its own normal matrix
+        skinNormal = mat3(skin);
+    }
+    FragPos = vec3(aInstanceModel * skin * vec4(aPos, 1.0));
+    Normal = aInstanceNormal * skinNormal * aNormal;
+    TexCoords = aTexCoords;
+    Layer = aLayer;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,70 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 6) in float aLayer;
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in mat3 aInstanceNormal;
+layout (location = 14) in uvec4 aBoneIds;
+layout (location = 15) in vec4 aBoneWeights;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out float Layer;
+
+// the node's transform, for the meshes that aren't skinned
+uniform mat4 model;
+uniform mat3 normalMatrix;
+uniform mat4 view;
+uniform mat4 projection;
+
+// every clip's frames, a row each, of three texels a bone holding the top three rows of its matrix
+uniform sampler2D bakedBones;
+// per instance: its clip's first frame and frame count, the frame it is at when time is 0 and how many
+// frames it moves on a second
+uniform samplerBuffer crowd;
+uniform int firstInstance;
+uniform float time;
+
+// the two frames the instance is between and how far it is from the first to the second
+int frame;
+int nextFrame;
+float blend;
+
+mat4 boneMatrix(uint bone)
+{
+    int texel = int(bone) * 3;
+    vec4 rows[3];
+    for (int i = 0; i < 3; i++)
+        rows[i] = mix(texelFetch(bakedBones, ivec2(texel + i, frame), 0), texelFetch(bakedBones, ivec2(texel + i, nextFrame), 0), blend);
+    return transpose(mat4(rows[0], rows[1], rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+void main()
+{
+    vec4 playback = texelFetch(crowd, firstInstance + gl_InstanceID);
+    float position = mod(time * playback.w + playback.z, playback.y);
+    int frames = int(playback.y);
+    int first = min(int(position), frames - 1);
+    blend = position - float(first);
+    frame = int(playback.x) + first;
+    nextFrame = int(playback.x) + (first + 1 == frames ? 0 : first + 1);
+
+    // the weights add up to 1 on a skinned vertex and to 0 on any other
+    mat4 skin = model;
+    mat3 skinNormal = normalMatrix;
+    if (dot(aBoneWeights, vec4(1.0)) > 0.5)
+    {
+        skin = aBoneWeights.x * boneMatrix(aBoneIds.x) + aBoneWeights.y * boneMatrix(aBoneIds.y)
+            + aBoneWeights.z * boneMatrix(aBoneIds.z) + aBoneWeights.w * boneMatrix(aBoneIds.w);
+        // bones are taken to scale uniformly, so their blend stands in for its own normal matrix
+        skinNormal = mat3(skin);
+    }
+    FragPos = vec3(aInstanceModel * skin * vec4(aPos, 1.0));
+    Normal = aInstanceNormal * skinNormal * aNormal;
+    TexCoords = aTexCoords;
+    Layer = aLayer;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
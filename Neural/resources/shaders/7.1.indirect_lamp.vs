@@ -0,0 +1,21 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 5) in uint aDrawID;
+
+struct DrawData {
+    mat4 model;
+    mat3 normal;
+    uint material;
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawData draws[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+	gl_Position = projection * view * draws[aDrawID].model * vec4(aPos, 1.0);
+}
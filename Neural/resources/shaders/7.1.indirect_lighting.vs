@@ -0,0 +1,35 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 6) in float aLayer;
+layout (location = 5) in uint aDrawID;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out float Layer;
+
+struct DrawData {
+    mat4 model;
+    mat3 normal;
+    uint material;
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawData draws[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    mat4 model = draws[aDrawID].model;
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = draws[aDrawID].normal * aNormal;
+    TexCoords = aTexCoords;
+    Layer = aLayer;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,164 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+struct CullBounds {
+    vec3 boundsMin;
+    uint pass;
+    vec3 boundsMax;
+    uint firstCommand;
+};
+
+layout (std430, binding = 1) readonly buffer InputCommands {
+    DrawCommand inputCommands[];
+};
+layout (std430, binding = 2) readonly buffer Bounds {
+    CullBounds bounds[];
+};
+layout (std430, binding = 3) writeonly buffer OutputCommands {
+    DrawCommand outputCommands[];
+};
+layout (std430, binding = 4) buffer DrawCounts {
+    uint drawCounts[];
+};
+// 1 for every draw the first pass left out only because the pyramid hid it
+layout (std430, binding = 5) buffer OcclusionState {
+    uint occludedDraws[];
+};
+// running totals, read back for the culling stats
+layout (std430, binding = 6) buffer CullStats {
+    uint frustumCulled;
+    uint occlusionCulled;
+    uint disoccluded;
+};
+
+uniform vec4 frustumPlanes[6];
+uniform uint commandCount;
+// compact visible commands to the front of their pass, or keep them in place with instanceCount 0
+uniform bool compact;
+
+// 0 tests the frustum and last frame's pyramid, 1 retests what the pyramid hid against this frame's
+uniform int phase;
+uniform bool occlusion;
+uniform sampler2D depthPyramid;
+uniform int pyramidLevels;
+// the view projection the pyramid was rendered with
+uniform mat4 pyramidViewProjection;
+
+// same arithmetic, in the same order, as Frustum::Intersects on the CPU
+bool insideFrustum(vec3 boxMin, vec3 boxMax)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 plane = frustumPlanes[i];
+        float x = plane.x >= 0.0 ? boxMax.x : boxMin.x;
+        float y = plane.y >= 0.0 ? boxMax.y : boxMin.y;
+        float z = plane.z >= 0.0 ? boxMax.z : boxMin.z;
+        precise float distance = plane.x * x;
+        distance += plane.y * y;
+        distance += plane.z * z;
+        distance += plane.w;
+        if (distance < 0.0)
+            return false;
+    }
+    return true;
+}
+
+// true when the box is certainly behind the depth in the pyramid
+bool occluded(vec3 boxMin, vec3 boxMax)
+{
+    vec2 rectMin = vec2(1e30);
+    vec2 rectMax = vec2(-1e30);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x, (i & 2) != 0 ? boxMax.y : boxMin.y, (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = pyramidViewProjection * vec4(corner, 1.0);
+        // crossing the near plane, the projected rectangle means nothing
+        if (clip.w <= 0.0 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc.xy * 0.5 + 0.5);
+        rectMax = max(rectMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    // off the screen the pyramid was rendered for, it knows nothing about the box
+    if (rectMax.x < 0.0 || rectMax.y < 0.0 || rectMin.x > 1.0 || rectMin.y > 1.0)
+        return false;
+
+    // the level where the rectangle spans at most 2x2 texels
+    vec2 size = vec2(textureSize(depthPyramid, 0));
+    vec2 pixelMin = clamp(rectMin, 0.0, 1.0) * size;
+    vec2 pixelMax = clamp(rectMax, 0.0, 1.0) * size;
+    vec2 extent = pixelMax - pixelMin;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, pyramidLevels - 1);
+
+    // from the base size rather than textureSize(depthPyramid, level), llvmpipe gets that wrong when the
+    // level differs between invocations
+    ivec2 levelSize = max(textureSize(depthPyramid, 0) >> level, ivec2(1));
+    ivec2 texelMin = min(ivec2(pixelMin) >> level, levelSize - 1);
+    ivec2 texelMax = min(ivec2(pixelMax) >> level, levelSize - 1);
+    float furthest = 0.0;
+    for (int y = texelMin.y; y <= texelMax.y; y++)
+    {
+        for (int x = texelMin.x; x <= texelMax.x; x++)
+            furthest = max(furthest, texelFetch(depthPyramid, ivec2(x, y), level).r);
+    }
+    return nearest > furthest;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= commandCount)
+        return;
+
+    DrawCommand command = inputCommands[i];
+    CullBounds box = bounds[i];
+    bool visible;
+    if (phase == 0)
+    {
+        visible = insideFrustum(box.boundsMin, box.boundsMax);
+        bool hidden = visible && occlusion && occluded(box.boundsMin, box.boundsMax);
+        occludedDraws[i] = hidden ? 1u : 0u;
+        if (!visible)
+            atomicAdd(frustumCulled, 1u);
+        else if (hidden)
+        {
+            atomicAdd(occlusionCulled, 1u);
+            visible = false;
+        }
+    }
+    else
+    {
+        // only what the first pass skipped for occlusion gets another chance, everything else was drawn or is
+        // outside the frustum
+        visible = occludedDraws[i] != 0u && (!occlusion || !occluded(box.boundsMin, box.boundsMax));
+        if (visible)
+            atomicAdd(disoccluded, 1u);
+    }
+
+    if (compact)
+    {
+        if (visible)
+        {
+            uint slot = atomicAdd(drawCounts[box.pass], 1u);
+            outputCommands[box.firstCommand + slot] = command;
+        }
+    }
+    else
+    {
+        if (!visible)
+            command.instanceCount = 0u;
+        else
+            atomicAdd(drawCounts[box.pass], 1u);
+        outputCommands[i] = command;
+    }
+}
@@ -0,0 +1,43 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (r32f, binding = 0) uniform writeonly image2D destination;
+
+// the depth texture for level 0, the pyramid itself for every level after that
+uniform sampler2D source;
+uniform int sourceLevel;
+// false copies the source 1:1, true keeps the furthest depth of each 2x2 block
+uniform bool downsample;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    if (!downsample)
+    {
+        imageStore(destination, texel, vec4(texelFetch(source, texel, 0).r));
+        return;
+    }
+
+    // an odd source leaves a row or column over, the last texel of this level takes it in as well
+    ivec2 sourceSize = textureSize(source, sourceLevel);
+    ivec2 extent = ivec2(2);
+    if (texel.x == size.x - 1 && (sourceSize.x & 1) != 0)
+        extent.x = 3;
+    if (texel.y == size.y - 1 && (sourceSize.y & 1) != 0)
+        extent.y = 3;
+
+    float depth = 0.0;
+    for (int y = 0; y < extent.y; y++)
+    {
+        for (int x = 0; x < extent.x; x++)
+        {
+            ivec2 sourceTexel = min(texel * 2 + ivec2(x, y), sourceSize - 1);
+            depth = max(depth, texelFetch(source, sourceTexel, sourceLevel).r);
+        }
+    }
+    imageStore(destination, texel, vec4(depth));
+}